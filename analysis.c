@@ -0,0 +1,317 @@
+#include "analysis.h"
+#include "async_io.h"
+#include "time_utils.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#define ANALYSIS_BUFFER_BYTES (1 << 16)   /* records kept before a write */
+
+/* Per-bin sums gathered by each thread */
+enum { SUM_COUNT, SUM_MASS, SUM_VR, SUM_VPHI, SUM_V2, N_SUMS };
+
+static AnalysisConfig config;
+static int            enabled   = 0;
+static double         r_max     = 0.0;
+static double*        potential = NULL;
+static int            potential_cap = 0;
+static double*        sums      = NULL;   /* n_bins x N_SUMS per thread */
+static int            sums_threads = 0;
+static unsigned char* buffer    = NULL;
+static size_t         buffered  = 0, buffer_cap = 0;
+static uint64_t       n_records = 0;
+static double         first_energy = 0.0, last_energy = 0.0;
+static double         analysis_time = 0.0;
+static char           log_path[ASYNC_IO_PATH_MAX];
+
+static bool resume_file(int resume_step);
+static bool write_header(void);
+static void flush_records(void);
+static void fit_radius(const ParticleSystem* sys, double cx, double cy);
+
+bool analysis_init(const AnalysisConfig* cfg, int resume_step) {
+    config  = *cfg;
+    enabled = cfg->every_steps > 0;
+    if (!enabled)
+        return true;
+    r_max = cfg->r_max;
+
+    size_t record = (size_t)analysis_record_bytes((uint32_t)cfg->n_bins);
+    buffer_cap = record > ANALYSIS_BUFFER_BYTES
+                     ? record
+                     : ANALYSIS_BUFFER_BYTES / record * record;
+    buffer = malloc(buffer_cap);
+    if (!buffer) {
+        fprintf(stderr, "Error: Memory allocation failed for analysis "
+                        "buffer.\n");
+        exit(1);
+    }
+
+    snprintf(log_path, sizeof(log_path), "data/outputs/analysis_%s.nba",
+             cfg->label);
+    /* With an auto radius the header goes out with the first record */
+    if (resume_step >= 0 && resume_file(resume_step))
+        return async_io_start();
+    if (r_max > 0.0 && !write_header())
+        return false;
+    return async_io_start();
+}
+
+double* analysis_potential(int step, int N) {
+    if (!enabled || step % config.every_steps != 0)
+        return NULL;
+    if (potential_cap < N) {
+        free(potential);
+        potential = malloc((size_t)N * sizeof(double));
+        if (!potential) {
+            fprintf(stderr, "Error: Memory allocation failed for "
+                            "potential.\n");
+            exit(1);
+        }
+        potential_cap = N;
+    }
+    return potential;
+}
+
+/** Two parallel passes: mass moments first, then energies, Lz and the
+ * radial bins about the centre of mass. Each thread fills its own bins;
+ * they are summed in thread order, so a record does not depend on
+ * scheduling.
+ * ----------------------------------------------------------------- */
+void analysis_step(const ParticleSystem* sys, int step, double sim_time,
+                   const double* pot, const ExternalPotential* ext) {
+    if (!enabled || step % config.every_steps != 0 || !pot)
+        return;
+    double t0 = sim_time_now();
+    int N = sys->N, B = config.n_bins;
+    const double* x  = sys->pos_x;
+    const double* y  = sys->pos_y;
+    const double* m  = sys->mass;
+    const double* vx = sys->vx;
+    const double* vy = sys->vy;
+
+    double M = 0.0, mx = 0.0, my = 0.0, px = 0.0, py = 0.0;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) reduction(+ : M, mx, my, px, py)
+#endif
+    for (int i = 0; i < N; i++) {
+        M  += m[i];
+        mx += m[i] * x[i];
+        my += m[i] * y[i];
+        px += m[i] * vx[i];
+        py += m[i] * vy[i];
+    }
+    double cx = mx / M, cy = my / M, cvx = px / M, cvy = py / M;
+    if (r_max <= 0.0) {
+        fit_radius(sys, cx, cy);
+        if (!write_header()) {
+            enabled = 0;
+            return;
+        }
+    }
+
+    int T = 1;
+#ifdef _OPENMP
+    T = omp_get_max_threads();
+#endif
+    if (sums_threads < T) {
+        free(sums);
+        sums = malloc((size_t)T * B * N_SUMS * sizeof(double));
+        if (!sums) {
+            fprintf(stderr, "Error: Memory allocation failed for analysis "
+                            "bins.\n");
+            exit(1);
+        }
+        sums_threads = T;
+    }
+    memset(sums, 0, (size_t)T * B * N_SUMS * sizeof(double));
+
+    double kinetic = 0.0, potential_energy = 0.0, lz = 0.0, outside = 0.0;
+    double bin_scale = B / r_max;
+#ifdef _OPENMP
+#pragma omp parallel num_threads(T) \
+    reduction(+ : kinetic, potential_energy, lz, outside)
+#endif
+    {
+        int t = 0;
+#ifdef _OPENMP
+        t = omp_get_thread_num();
+#endif
+        double* s = sums + (size_t)t * B * N_SUMS;
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+        for (int i = 0; i < N; i++) {
+            kinetic          += 0.5 * m[i] * (vx[i] * vx[i] + vy[i] * vy[i]);
+            /* Pairs are counted twice in pot, the field once */
+            potential_energy += m[i] * (0.5 * pot[i] +
+                                        external_potential(ext, x[i], y[i]));
+            double dx = x[i] - cx, dy = y[i] - cy;
+            double dvx = vx[i] - cvx, dvy = vy[i] - cvy;
+            lz += m[i] * (dx * dvy - dy * dvx);
+
+            double r = sqrt(dx * dx + dy * dy);
+            int b = (int)(r * bin_scale);
+            if (b >= B) {
+                outside += 1.0;
+                continue;
+            }
+            double vr = 0.0, vphi = 0.0;
+            if (r > 0.0) {
+                vr   = (dx * dvx + dy * dvy) / r;
+                vphi = (dx * dvy - dy * dvx) / r;
+            }
+            double* bin = s + (size_t)b * N_SUMS;
+            bin[SUM_COUNT] += 1.0;
+            bin[SUM_MASS]  += m[i];
+            bin[SUM_VR]    += m[i] * vr;
+            bin[SUM_VPHI]  += m[i] * vphi;
+            bin[SUM_V2]    += m[i] * (vr * vr + vphi * vphi);
+        }
+    }
+    size_t record = (size_t)analysis_record_bytes((uint32_t)B);
+    if (buffered + record > buffer_cap)
+        flush_records();
+    unsigned char* p = buffer + buffered;
+    int64_t st = step;
+    memcpy(p, &st, 8);
+    memcpy(p + 8, &sim_time, 8);
+    double* rec = (double*)(p + 16);   /* records are multiples of 8 bytes */
+    double energy = kinetic + potential_energy;
+    double scalars[ANALYSIS_SCALARS] = { M, cx, cy, px, py, kinetic,
+                                         potential_energy, energy, lz,
+                                         outside };
+    memcpy(rec, scalars, sizeof(scalars));
+    rec += ANALYSIS_SCALARS;
+    for (int b = 0; b < B; b++) {
+        double acc[N_SUMS] = { 0.0 };
+        for (int t = 0; t < T; t++)
+            for (int k = 0; k < N_SUMS; k++)
+                acc[k] += sums[((size_t)t * B + b) * N_SUMS + k];
+        double r0 = b / bin_scale, r1 = (b + 1) / bin_scale;
+        double mb = acc[SUM_MASS];
+        double vr   = mb > 0.0 ? acc[SUM_VR] / mb : 0.0;
+        double vphi = mb > 0.0 ? acc[SUM_VPHI] / mb : 0.0;
+        double var  = mb > 0.0 ? acc[SUM_V2] / mb - vr * vr - vphi * vphi
+                               : 0.0;
+        rec[0] = acc[SUM_COUNT];
+        rec[1] = mb / (M_PI * (r1 * r1 - r0 * r0));
+        rec[2] = vr;
+        rec[3] = vphi;
+        rec[4] = var > 0.0 ? sqrt(var) : 0.0;
+        rec += ANALYSIS_BIN_COLUMNS;
+    }
+    buffered += record;
+
+    if (n_records == 0)
+        first_energy = energy;
+    last_energy = energy;
+    n_records++;
+    analysis_time += sim_time_now() - t0;
+}
+
+void analysis_finish(void) {
+    if (!buffer)
+        return;
+    flush_records();
+    if (n_records > 0)
+        printf("Analysis: %s | %llu records | dE/E %.2e | %.2f ms/record\n",
+               log_path, (unsigned long long)n_records,
+               first_energy != 0.0
+                   ? (last_energy - first_energy) / fabs(first_energy) : 0.0,
+               analysis_time * 1e3 / (double)n_records);
+    free(potential);
+    free(sums);
+    free(buffer);
+    potential = sums = NULL;
+    buffer = NULL;
+    potential_cap = sums_threads = 0;
+}
+
+/** Cut an earlier run's log back to the records up to resume_step. The
+ * log must have the same binning; an auto radius is taken from it.
+ * ----------------------------------------------------------------- */
+static bool resume_file(int resume_step) {
+    FILE* f = fopen(log_path, "r+b");
+    if (!f)
+        return false;
+    AnalysisHeader h;
+    bool same = fread(&h, sizeof(h), 1, f) == 1 &&
+                memcmp(h.magic, ANALYSIS_MAGIC, 8) == 0 &&
+                h.n_bins == (uint32_t)config.n_bins &&
+                (config.r_max <= 0.0 || h.r_max == config.r_max);
+    uint64_t record = analysis_record_bytes(h.n_bins);
+    uint64_t keep = 0;
+    int64_t  st;
+    while (same && fseek(f, (long)(sizeof(h) + keep * record), SEEK_SET) == 0 &&
+           fread(&st, sizeof(st), 1, f) == 1 && st <= resume_step) {
+        /* Only whole records count */
+        if (fseek(f, (long)(sizeof(h) + (keep + 1) * record - 1), SEEK_SET) != 0 ||
+            fgetc(f) == EOF)
+            break;
+        keep++;
+    }
+    bool ok = same && fflush(f) == 0 &&
+              ftruncate(fileno(f), (off_t)(sizeof(h) + keep * record)) == 0;
+    fclose(f);
+    if (same && !ok)
+        perror("Error truncating analysis log");
+    if (ok)
+        r_max = h.r_max;
+    return ok;
+}
+
+static bool write_header(void) {
+    FILE* f = fopen(log_path, "wb");
+    if (!f) {
+        perror("Error creating analysis log");
+        return false;
+    }
+    AnalysisHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, ANALYSIS_MAGIC, 8);
+    h.version = 1;
+    h.n_bins  = (uint32_t)config.n_bins;
+    h.r_max   = r_max;
+    bool ok = fwrite(&h, sizeof(h), 1, f) == 1;
+    if (fclose(f) != 0 || !ok) {
+        perror("Error writing analysis log");
+        return false;
+    }
+    return true;
+}
+
+/* Hand the buffered records to the I/O thread */
+static void flush_records(void) {
+    if (buffered == 0)
+        return;
+    StageBuffer* slot = async_io_acquire(buffered);
+    memcpy(slot->data, buffer, buffered);
+    slot->len    = buffered;
+    slot->append = 1;
+    snprintf(slot->path, sizeof(slot->path), "%s", log_path);
+    async_io_submit(slot);
+    buffered = 0;
+}
+
+/* Auto radius: the farthest particle from the centre of mass, so the
+ * first record has every particle in a bin */
+static void fit_radius(const ParticleSystem* sys, double cx, double cy) {
+    double r2 = 0.0;
+    int N = sys->N;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) reduction(max : r2)
+#endif
+    for (int i = 0; i < N; i++) {
+        double dx = sys->pos_x[i] - cx, dy = sys->pos_y[i] - cy;
+        double d = dx * dx + dy * dy;
+        if (d > r2) r2 = d;
+    }
+    /* Nudged out so the farthest particle falls in the last bin */
+    r_max = r2 > 0.0 ? sqrt(r2) * (1.0 + 1e-9) : 1.0;
+}
@@ -0,0 +1,58 @@
+#ifndef ANALYSIS_H
+#define ANALYSIS_H
+
+#include "external.h"
+#include "types.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/* In-situ analysis log, data/outputs/analysis_<label>.nba: an
+ * AnalysisHeader, then one fixed-size record per analysed step of
+ * int64 step, double time, the ANALYSIS_SCALARS below and, per radial
+ * bin, the ANALYSIS_BIN_COLUMNS below. Radii, velocities and Lz are
+ * taken about the centre of mass and its velocity; bin b covers
+ * [b, b + 1) * r_max / n_bins. */
+#define ANALYSIS_MAGIC        "NBODYANL"
+#define ANALYSIS_SCALARS      10  /* mass, com_x, com_y, p_x, p_y, kinetic,
+                                     potential, total energy, Lz, n_outside;
+                                     potential includes the external field */
+#define ANALYSIS_BIN_COLUMNS  5   /* count, surface density, mean v_r,
+                                     mean v_phi, velocity dispersion */
+
+typedef struct {
+    char     magic[8];
+    uint32_t version;     /* 1 */
+    uint32_t n_bins;
+    double   r_max;
+} AnalysisHeader;
+
+typedef struct {
+    int         every_steps;  /* analyse every K steps, 0 = off */
+    int         n_bins;       /* radial profile bins */
+    double      r_max;        /* profile radius, 0 = fitted to the first record */
+    const char* label;        /* run label used in file names */
+} AnalysisConfig;
+
+static inline uint64_t analysis_record_bytes(uint32_t n_bins) {
+    return 16 + 8 * (ANALYSIS_SCALARS + ANALYSIS_BIN_COLUMNS * (uint64_t)n_bins);
+}
+
+// Create the log, or with resume_step >= 0 keep the records up to that
+// step of an existing log with the same binning.
+bool analysis_init(const AnalysisConfig* cfg, int resume_step);
+
+// Potential buffer for the force pass that ends step, or NULL when no
+// record is due then.
+double* analysis_potential(int step, int N);
+
+// Called after a completed step with the potential from its force pass
+// and the external field, oriented for sim_time; appends a record if one
+// is due.
+void analysis_step(const ParticleSystem* sys, int step, double sim_time,
+                   const double* potential, const ExternalPotential* ext);
+
+// Queue the buffered records and print the summary; main stops the
+// shared writer afterwards.
+void analysis_finish(void);
+
+#endif
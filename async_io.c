@@ -0,0 +1,219 @@
+#include "async_io.h"
+#include "time_utils.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Two slots: the simulation fills one while the other is written */
+#define N_SLOTS 2
+
+enum { SLOT_FREE, SLOT_FILLING, SLOT_QUEUED, SLOT_WRITING };
+
+static StageBuffer     slots[N_SLOTS];
+static int             slot_state[N_SLOTS];
+static unsigned long   slot_seq[N_SLOTS];   /* submission order */
+static unsigned long   next_seq = 0;
+static int             running  = 0;
+static int             stopping = 0;
+static pthread_t       io_thread;
+static pthread_mutex_t lock    = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  changed = PTHREAD_COND_INITIALIZER;
+static AsyncIOStats    stats;
+
+static void* io_main(void* arg);
+static bool  write_file(const StageBuffer* slot);
+
+bool async_io_start(void) {
+    if (running)
+        return true;
+    for (int s = 0; s < N_SLOTS; s++) {
+        slots[s].data = NULL;
+        slots[s].len  = 0;
+        slots[s].cap  = 0;
+        slot_state[s] = SLOT_FREE;
+    }
+    stopping = 0;
+    stats = (AsyncIOStats){0, 0, 0, 0.0, 0.0};
+    if (pthread_create(&io_thread, NULL, io_main, NULL) != 0) {
+        fprintf(stderr, "Error: could not start the I/O thread.\n");
+        return false;
+    }
+    running = 1;
+    return true;
+}
+
+StageBuffer* async_io_acquire(size_t bytes) {
+    pthread_mutex_lock(&lock);
+    int s = -1;
+    double t_wait = 0.0;
+    for (;;) {
+        for (int i = 0; i < N_SLOTS && s < 0; i++)
+            if (slot_state[i] == SLOT_FREE)
+                s = i;
+        if (s >= 0)
+            break;
+        if (t_wait == 0.0)
+            t_wait = sim_time_now();
+        pthread_cond_wait(&changed, &lock);
+    }
+    if (t_wait != 0.0) {
+        stats.stalls++;
+        stats.stall_time += sim_time_now() - t_wait;
+    }
+    slot_state[s] = SLOT_FILLING;
+    pthread_mutex_unlock(&lock);
+
+    StageBuffer* slot = &slots[s];
+    if (slot->cap < bytes) {
+        free(slot->data);
+        slot->data = malloc(bytes);
+        slot->cap  = slot->data ? bytes : 0;
+        if (!slot->data) {
+            fprintf(stderr, "Error: Memory allocation failed for staging "
+                            "buffer (%zu bytes).\n", bytes);
+            exit(1);
+        }
+    }
+    slot->len = 0;
+    slot->append = 0;
+    slot->atomic = 0;
+    slot->failed = NULL;
+    slot->path[0] = '\0';
+    return slot;
+}
+
+void async_io_submit(StageBuffer* slot) {
+    int s = (int)(slot - slots);
+    pthread_mutex_lock(&lock);
+    slot_state[s] = SLOT_QUEUED;
+    slot_seq[s]   = next_seq++;
+    pthread_cond_broadcast(&changed);
+    pthread_mutex_unlock(&lock);
+}
+
+int async_io_drain(void) {
+    if (!running)
+        return stats.write_errors;
+    pthread_mutex_lock(&lock);
+    for (;;) {
+        int busy = 0;
+        for (int s = 0; s < N_SLOTS; s++)
+            if (slot_state[s] == SLOT_QUEUED || slot_state[s] == SLOT_WRITING)
+                busy = 1;
+        if (!busy)
+            break;
+        pthread_cond_wait(&changed, &lock);
+    }
+    int failed = stats.write_errors;
+    pthread_mutex_unlock(&lock);
+    return failed;
+}
+
+void async_io_stop(AsyncIOStats* out) {
+    if (running) {
+        async_io_drain();
+        pthread_mutex_lock(&lock);
+        stopping = 1;
+        pthread_cond_broadcast(&changed);
+        pthread_mutex_unlock(&lock);
+        pthread_join(io_thread, NULL);
+        running = 0;
+        for (int s = 0; s < N_SLOTS; s++) {
+            free(slots[s].data);
+            slots[s].data = NULL;
+            slots[s].cap  = 0;
+        }
+    }
+    if (out)
+        *out = stats;
+}
+
+/** I/O thread: write queued slots oldest first, then hand them back.
+ * ----------------------------------------------------------------- */
+static void* io_main(void* arg) {
+    (void)arg;
+    pthread_mutex_lock(&lock);
+    for (;;) {
+        int s = -1;
+        for (int i = 0; i < N_SLOTS; i++)
+            if (slot_state[i] == SLOT_QUEUED &&
+                (s < 0 || slot_seq[i] < slot_seq[s]))
+                s = i;
+        if (s < 0) {
+            if (stopping)
+                break;
+            pthread_cond_wait(&changed, &lock);
+            continue;
+        }
+        slot_state[s] = SLOT_WRITING;
+        int* failed = slots[s].failed;
+        int skip = failed && *failed;
+        pthread_mutex_unlock(&lock);
+
+        double t0 = sim_time_now();
+        bool ok = !skip && write_file(&slots[s]);
+        double elapsed = sim_time_now() - t0;
+
+        pthread_mutex_lock(&lock);
+        stats.write_time += elapsed;
+        if (ok) stats.files_written++;
+        else    stats.write_errors++;
+        if (!ok && failed)
+            *failed = 1;
+        slot_state[s] = SLOT_FREE;
+        pthread_cond_broadcast(&changed);
+    }
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+static bool write_file(const StageBuffer* slot) {
+    char tmp_path[ASYNC_IO_PATH_MAX + 8];
+    const char* path = slot->path;
+    if (slot->atomic) {
+        snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", slot->path);
+        path = tmp_path;
+    }
+
+    int flags = O_WRONLY | O_CREAT | (slot->append ? O_APPEND : O_TRUNC);
+    int fd = open(path, flags, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Error opening %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    /* A failed append is cut back off, so the file ends on a whole record */
+    off_t start = slot->append ? lseek(fd, 0, SEEK_END) : 0;
+    const unsigned char* p = slot->data;
+    size_t left = slot->len;
+    while (left > 0) {
+        ssize_t n = write(fd, p, left);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {   /* a write of nothing would be retried forever */
+            fprintf(stderr, "Error writing %s: %s\n", path,
+                    n < 0 ? strerror(errno) : "no progress");
+            if (slot->append && start >= 0 && ftruncate(fd, start) != 0)
+                fprintf(stderr, "Error truncating %s: %s\n", path,
+                        strerror(errno));
+            close(fd);
+            return false;
+        }
+        p    += n;
+        left -= (size_t)n;
+    }
+    if (slot->atomic && fsync(fd) != 0) {
+        close(fd);
+        return false;
+    }
+    if (close(fd) != 0)
+        return false;
+    if (slot->atomic && rename(tmp_path, slot->path) != 0) {
+        fprintf(stderr, "Error renaming %s: %s\n", tmp_path, strerror(errno));
+        return false;
+    }
+    return true;
+}
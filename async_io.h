@@ -0,0 +1,47 @@
+#ifndef ASYNC_IO_H
+#define ASYNC_IO_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define ASYNC_IO_PATH_MAX 256
+
+/* One staging slot: filled by the simulation, drained by the I/O thread */
+typedef struct {
+    unsigned char* data;
+    size_t len;
+    size_t cap;
+    int    append;   /* append to path instead of replacing it */
+    int    atomic;   /* write path.tmp, fsync, then rename over path */
+    int*   failed;   /* set when the write fails; writes queued with it
+                        already set are skipped, so an appended stream
+                        stops at its last whole record */
+    char   path[ASYNC_IO_PATH_MAX];
+} StageBuffer;
+
+typedef struct {
+    int    files_written;
+    int    write_errors;
+    int    stalls;        /* acquires that had to wait for the I/O thread */
+    double stall_time;    /* seconds the simulation spent waiting */
+    double write_time;    /* seconds the I/O thread spent writing */
+} AsyncIOStats;
+
+// Start the background writer thread with two staging slots.
+bool async_io_start(void);
+
+// Get a free slot with at least bytes of capacity; blocks while both
+// slots are still queued or being written.
+StageBuffer* async_io_acquire(size_t bytes);
+
+// Queue a filled slot; the I/O thread writes data[0, len) to path.
+void async_io_submit(StageBuffer* slot);
+
+// Wait until every submitted slot has been written. Returns the number
+// of writes that have failed since the thread started.
+int async_io_drain(void);
+
+// Drain, stop the thread and free the slots.
+void async_io_stop(AsyncIOStats* stats);
+
+#endif
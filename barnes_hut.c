@@ -1,10 +1,13 @@
+#include "barnes_hut.h"
 #include "ds.h"
 #include "kmeans.h"
 #include "morton.h"
+#include "ooc.h"
 #include "types.h"
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #ifdef _OPENMP
 #include <omp.h>
 #endif
@@ -15,28 +18,105 @@
 static const double COINCIDENT_EPS      = 1e-9;
 static const double DOMAIN_PADDING_FRAC = 0.05;
 static const int    ARENA_NODE_FACTOR   = 100;
+static const int    NOT_IN_TREE         = -2;  /* matches no particle_idx */
 #define CHUNK_SIZE 128
 
+/* Out-of-core: particles sharing one far-field interaction list, levels of
+ * each chunk tree kept resident, and chunk trees cached between targets */
+#define OOC_GROUP         512
+#define OOC_SUMMARY_DEPTH 6
+#define OOC_TREE_CACHE    16
+
 /* Pre-allocated node pool, reused every timestep */
-static NodeArena arena   = {NULL, 0, 0};
-static int       arena_N = 0;
+static NodeArena  arena   = {NULL, 0, 0};
+static int        arena_N = 0;
+static NodeArena* build_arena = &arena;  /* where create_node allocates */
+static TNode*     tree_root   = NULL;    /* last in-core tree, for LOD */
+static int        tree_N      = 0;
 
 /* Shared within each timestep */
 static double G_val     = 0.0;
 static double theta_val = 0.0;
+static double tracer_val = 0.0;   /* bodies this light stay out of trees */
+static double heavy_val  = 0.0;   /* heavier ones too, 0 = none */
+static double outlier_r2 = 0.0;   /* squared outlier radius, 0 = none */
+static double centre_x = 0.0, centre_y = 0.0;   /* outliers are far from it */
+
+/* Heavy bodies and massive outliers, summed directly by every target */
+static int     n_direct   = 0, direct_cap = 0;
+static int*    direct_idx = NULL;
+static double* direct_x   = NULL;
+static double* direct_y   = NULL;
+static double* direct_m   = NULL;
+
+/* Carried across timesteps; see barnes_hut_get_state */
+static int    domain_initialized  = 0;
+static int    domain_N            = 0;
+static double x_min = 0.0, x_max = 0.0, y_min = 0.0, y_max = 0.0;
+static double last_recluster_time = -1.0;
+
+/* Out-of-core state: chunk summaries and the cache of full chunk trees */
+enum { SUMMARY_BODY, SUMMARY_CELL, SUMMARY_CUT };
+
+typedef struct {
+    double pos_x, pos_y, mass, size;
+    int    first_child;   /* relative to the chunk's root; contiguous */
+    int    n_children;
+    int    kind;          /* SUMMARY_CUT cells have children not kept */
+} SummaryNode;
+
+typedef struct {
+    int       chunk;      /* -1 = stale */
+    long      last_use;
+    NodeArena arena;
+    TNode*    root;
+} CachedTree;
+
+static SummaryNode* summary        = NULL;
+static size_t       summary_len    = 0, summary_cap = 0;
+static size_t*      summary_root   = NULL;  /* per chunk */
+static double*      chunk_box      = NULL;  /* per chunk: bbox */
+static char*        near_cur       = NULL;  /* per chunk: near flags */
+static char*        near_next      = NULL;
+static TNode**      near_roots     = NULL;
+static int          ooc_chunks_cap = 0;
+static CachedTree*  tree_cache     = NULL;
+static int          tree_cache_len = 0, tree_cache_cap = 0;
+static long         cache_clock    = 0;
 
 static int    is_leaf(TNode* node);
+static void   find_centre(const ParticleSystem* sys, double radius);
+static int    is_outlier(double px, double py);
+static int    in_tree(const ParticleSystem* sys, int i);
+static void   collect_direct(const ParticleSystem* sys);
+static void   add_direct(double pos_x, double pos_y, double mass, int skip,
+                        double* res_fx, double* res_fy, double* res_pot);
 static int    quadrant(double px, double py, double mx, double my);
 static void   init_domain(const double* x, const double* y, int N,
                           double* x_min, double* x_max,
                           double* y_min, double* y_max);
-static void   expand_domain_if_needed(const double* x, const double* y, int N,
+static int    expand_domain_if_needed(const double* x, const double* y, int N,
                                       double* x_min, double* x_max,
                                       double* y_min, double* y_max);
 static TNode* create_node(double LB, double RB, double DB, double UB);
 static void   insert(TNode* node, int idx, ParticleSystem* sys);
 static void   compute_force_single(int i, ParticleSystem* sys, TNode* root,
-                                   double* res_fx, double* res_fy);
+                                   double* res_fx, double* res_fy,
+                                   double* res_pot);
+static void   traverse(double pos_x, double pos_y, double mass, int skip,
+                       const TNode* root, double* res_fx, double* res_fy,
+                       double* res_pot);
+static int    chunk_count(int N, int c);
+static TNode* cached_tree(int c);
+static TNode* chunk_tree(ParticleSystem* sys, int c);
+static void   summarize(int c, const TNode* root);
+static int    far_enough(const SummaryNode* node, const double* box);
+static void   classify(int t, int n_chunks, char* near);
+static size_t collect_far(int s, const double* box, double** list,
+                          size_t* cap, size_t n);
+static int    lod_is_cut(const TNode* node, int depth, int max_depth,
+                         double min_size);
+static void   lod_reserve(LodCut* cut, int n);
 
 void compute_force_barnes_hut(ParticleSystem* sys, KernelConfig* config) {
     int N = sys->N;
@@ -45,10 +125,7 @@ void compute_force_barnes_hut(ParticleSystem* sys, KernelConfig* config) {
     double* fx_out  = sys->fx;
     double* fy_out  = sys->fy;
 
-    static int    domain_initialized = 0;
-    static int    domain_N           = 0;
-    static double x_min = 0.0, x_max = 0.0, y_min = 0.0, y_max = 0.0;
-
+    find_centre(sys, config->outlier_radius);
     if (!domain_initialized || domain_N != N) {
         init_domain(x, y, N, &x_min, &x_max, &y_min, &y_max);
         domain_initialized = 1;
@@ -62,7 +139,6 @@ void compute_force_barnes_hut(ParticleSystem* sys, KernelConfig* config) {
         static int*   clusters            = NULL;
         static int*   c_size              = NULL;
         static int    last_N              = 0, last_k = 0;
-        static double last_recluster_time = -1.0;
         static const double RECLUSTER_INTERVAL = 1e-4;
 
         if (!clusters || last_N < N) {
@@ -92,12 +168,19 @@ void compute_force_barnes_hut(ParticleSystem* sys, KernelConfig* config) {
     }
     reset_arena(&arena);
 
-    G_val     = G_FACTOR / N;
-    theta_val = config->theta_max;
+    G_val      = G_FACTOR / N;
+    theta_val  = config->theta_max;
+    tracer_val = config->tracer_mass;
+    heavy_val  = config->heavy_mass;
+    collect_direct(sys);
 
+    /* Tracers are targets only; heavy bodies and outliers are summed
+     * directly. The tree holds the rest */
     TNode* root = create_node(x_min, x_max, y_min, y_max);
     for (int i = 0; i < N; i++)
-        insert(root, i, sys);
+        if (in_tree(sys, i)) insert(root, i, sys);
+    tree_root = root;
+    tree_N    = N;
 
     /* Only the per-particle force traversal is parallelised;
      * tree building and Morton sort remain serial. */
@@ -105,17 +188,464 @@ void compute_force_barnes_hut(ParticleSystem* sys, KernelConfig* config) {
 #pragma omp parallel for schedule(dynamic, CHUNK_SIZE) num_threads(config->n_threads)
 #endif
     for (int i = 0; i < N; i++)
-        compute_force_single(i, sys, root, &fx_out[i], &fy_out[i]);
+        compute_force_single(i, sys, root, &fx_out[i], &fy_out[i],
+                             config->potential ? &config->potential[i] : NULL);
+}
+
+/** Out-of-core force pass over a mapped, Z-ordered working file.
+ * Every chunk's tree is built once to record its top levels as a small
+ * resident summary. Then, per target chunk, a source chunk is "near" if
+ * its summary cannot satisfy the opening criterion for the whole target
+ * bounding box; near chunks contribute through their full trees (cached
+ * between targets), far ones through summary cells only. Each group of
+ * OOC_GROUP targets walks the far summaries against its own, tighter box.
+ * The next target chunk is prefetched while the current one computes.
+ * ----------------------------------------------------------------- */
+void compute_force_barnes_hut_ooc(ParticleSystem* sys, KernelConfig* config) {
+    int N = sys->N;
+    double box[4];
+
+    find_centre(sys, config->outlier_radius);
+    if (!domain_initialized || domain_N != N) {
+        init_domain(sys->pos_x, sys->pos_y, N, &x_min, &x_max, &y_min, &y_max);
+        domain_initialized = 1;
+        domain_N = N;
+        box[0] = x_min; box[1] = x_max; box[2] = y_min; box[3] = y_max;
+        if (!ooc_sort(sys, box)) exit(1);
+    } else if (expand_domain_if_needed(sys->pos_x, sys->pos_y, N, &x_min,
+                                       &x_max, &y_min, &y_max)) {
+        box[0] = x_min; box[1] = x_max; box[2] = y_min; box[3] = y_max;
+        if (!ooc_sort(sys, box)) exit(1);
+    } else {
+        /* Both pairings every step, so no parity has to survive a restart */
+        box[0] = x_min; box[1] = x_max; box[2] = y_min; box[3] = y_max;
+        ooc_reorder(sys, box, 0);
+        ooc_reorder(sys, box, 1);
+    }
+
+    G_val      = G_FACTOR / N;
+    theta_val  = config->theta_max;
+    tracer_val = config->tracer_mass;
+    heavy_val  = config->heavy_mass;
+    tree_root  = NULL;
+    collect_direct(sys);   /* no single tree to cut out of core */
+
+    double* pot  = config->potential;
+    int n_chunks = (N + OOC_CHUNK - 1) / OOC_CHUNK;
+    if (n_chunks > ooc_chunks_cap) {
+        free(summary_root);
+        free(chunk_box);
+        free(near_cur);
+        free(near_next);
+        free(near_roots);
+        summary_root = malloc((size_t)n_chunks * sizeof(size_t));
+        chunk_box    = malloc((size_t)n_chunks * 4 * sizeof(double));
+        near_cur     = malloc((size_t)n_chunks);
+        near_next    = malloc((size_t)n_chunks);
+        near_roots   = malloc((size_t)n_chunks * sizeof(TNode*));
+        if (!summary_root || !chunk_box || !near_cur || !near_next ||
+            !near_roots) {
+            fprintf(stderr, "Error: Memory allocation failed for "
+                            "out-of-core summary.\n");
+            exit(1);
+        }
+        ooc_chunks_cap = n_chunks;
+    }
+
+    /* Positions moved since the last step, so every cached tree is stale */
+    for (int k = 0; k < tree_cache_len; k++)
+        tree_cache[k].chunk = -1;
+    summary_len = 0;
+    for (int c = 0; c < n_chunks; c++) {
+        if (c + 1 < n_chunks)
+            ooc_prefetch(sys, (c + 1) * OOC_CHUNK, chunk_count(N, c + 1));
+        cache_clock++;
+        summarize(c, chunk_tree(sys, c));
+    }
+
+    classify(0, n_chunks, near_cur);
+    for (int t = 0; t < n_chunks; t++) {
+        int first = t * OOC_CHUNK;
+        int count = chunk_count(N, t);
+
+        /* Start reading the next targets and the near chunks whose trees
+         * will have to be rebuilt for them */
+        if (t + 1 < n_chunks) {
+            classify(t + 1, n_chunks, near_next);
+            ooc_prefetch(sys, (t + 1) * OOC_CHUNK, chunk_count(N, t + 1));
+            for (int s = 0; s < n_chunks; s++)
+                if (near_next[s] && !cached_tree(s))
+                    ooc_prefetch(sys, s * OOC_CHUNK, chunk_count(N, s));
+        }
+
+        cache_clock++;
+        int n_near = 0, self = 0;
+        for (int s = 0; s < n_chunks; s++) {
+            if (!near_cur[s]) continue;
+            if (s == t) self = n_near;
+            near_roots[n_near++] = chunk_tree(sys, s);
+        }
+
+        int n_groups = (count + OOC_GROUP - 1) / OOC_GROUP;
+#ifdef _OPENMP
+#pragma omp parallel num_threads(config->n_threads)
+#endif
+        {
+            double* far = NULL;   /* x, y, mass triples */
+            size_t  far_cap = 0;
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic, 1)
+#endif
+            for (int g = 0; g < n_groups; g++) {
+                int lo = first + g * OOC_GROUP;
+                int hi = lo + OOC_GROUP < first + count ? lo + OOC_GROUP
+                                                        : first + count;
+                double gbox[4] = { sys->pos_x[lo], sys->pos_x[lo],
+                                   sys->pos_y[lo], sys->pos_y[lo] };
+                for (int i = lo + 1; i < hi; i++) {
+                    if (sys->pos_x[i] < gbox[0]) gbox[0] = sys->pos_x[i];
+                    if (sys->pos_x[i] > gbox[1]) gbox[1] = sys->pos_x[i];
+                    if (sys->pos_y[i] < gbox[2]) gbox[2] = sys->pos_y[i];
+                    if (sys->pos_y[i] > gbox[3]) gbox[3] = sys->pos_y[i];
+                }
+                size_t n_far = 0;
+                for (int s = 0; s < n_chunks; s++)
+                    if (!near_cur[s])
+                        n_far = collect_far(s, gbox, &far, &far_cap, n_far);
+
+                for (int i = lo; i < hi; i++) {
+                    double px = sys->pos_x[i], py = sys->pos_y[i];
+                    double m  = sys->mass[i] > 0.0 ? sys->mass[i] : 1.0;
+                    double fx = 0.0, fy = 0.0, phi = 0.0;
+                    for (int k = 0; k < n_near; k++) {
+                        double ax, ay, ap;
+                        traverse(px, py, m, k == self ? i - first : NOT_IN_TREE,
+                                 near_roots[k], &ax, &ay, pot ? &ap : NULL);
+                        fx += ax;
+                        fy += ay;
+                        if (pot) phi += ap;
+                    }
+                    for (size_t k = 0; k < n_far; k++) {
+                        double dx = px - far[3 * k];
+                        double dy = py - far[3 * k + 1];
+                        double r  = sqrt(dx * dx + dy * dy);
+                        double denom = r + EPSILON;
+                        double f = G_val * m * far[3 * k + 2] /
+                                   (denom * denom * denom);
+                        fx += f * (-dx);
+                        fy += f * (-dy);
+                        if (pot)
+                            phi -= G_val * far[3 * k + 2] * (r + denom) /
+                                   (2.0 * denom * denom);
+                    }
+                    if (n_direct > 0) {
+                        double hx, hy, hp;
+                        add_direct(px, py, m, i, &hx, &hy, pot ? &hp : NULL);
+                        fx += hx;
+                        fy += hy;
+                        if (pot) phi += hp;
+                    }
+                    sys->fx[i] = fx;
+                    sys->fy[i] = fy;
+                    if (pot) pot[i] = phi;
+                }
+            }
+            free(far);
+        }
+
+        char* swap = near_cur;
+        near_cur  = near_next;
+        near_next = swap;
+    }
+}
+
+/** Level-of-detail cut of the last tree.
+ * Mass and centre of mass come from the cut cells themselves. For the
+ * velocity moments every particle walks down from the root, taking the
+ * quadrant it was inserted through, until it reaches its cut cell; this
+ * also finds particles merged into a coincident leaf. Tracers, heavy
+ * bodies and outliers are in no cell. The walks run in parallel, the
+ * sums serially in index order.
+ * ----------------------------------------------------------------- */
+int barnes_hut_lod(const ParticleSystem* sys, int max_depth,
+                   double min_size, LodCut* cut) {
+    static int* slot_of   = NULL;   /* per arena node: cut cell or -1 */
+    static int* cell_of   = NULL;   /* per particle */
+    static int  slot_cap  = 0, cell_cap = 0;
+    if (!tree_root || tree_N != sys->N)
+        return 0;
+    int N = sys->N;
+
+    if (slot_cap < (int)arena.size) {
+        free(slot_of);
+        slot_cap = (int)arena.size;
+        slot_of  = malloc((size_t)slot_cap * sizeof(int));
+    }
+    if (cell_cap < N) {
+        free(cell_of);
+        cell_cap = N;
+        cell_of  = malloc((size_t)N * sizeof(int));
+    }
+    if (!slot_of || !cell_of) {
+        fprintf(stderr, "Error: Memory allocation failed for LOD cut.\n");
+        exit(1);
+    }
+    for (size_t k = 0; k < arena.size; k++)
+        slot_of[k] = -1;
+
+    /* Number the cut cells depth-first */
+    const TNode* stack[256];
+    int depth[256];
+    int sp = 0;
+    stack[sp] = tree_root;
+    depth[sp++] = 0;
+    cut->n = 0;
+    while (sp > 0) {
+        const TNode* node = stack[--sp];
+        int d = depth[sp];
+        if (!lod_is_cut(node, d, max_depth, min_size)) {
+            for (int j = 3; j >= 0; j--) {
+                if (!node->child[j]) continue;
+                stack[sp] = node->child[j];
+                depth[sp++] = d + 1;
+            }
+            continue;
+        }
+        lod_reserve(cut, cut->n + 1);
+        int c = cut->n++;
+        slot_of[node - arena.buffer] = c;
+        cut->pos_x[c] = node->pos_x;
+        cut->pos_y[c] = node->pos_y;
+        cut->mass[c]  = node->mass;
+        cut->size[c]  = node->x_max - node->x_min;
+        cut->vx[c] = cut->vy[c] = cut->sigma[c] = 0.0;
+        cut->brightness[c] = cut->count[c] = 0.0;
+    }
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+    for (int i = 0; i < N; i++) {
+        if (!in_tree(sys, i)) {
+            cell_of[i] = -1;
+            continue;
+        }
+        double px = sys->pos_x[i], py = sys->pos_y[i];
+        const TNode* node = tree_root;
+        int d = 0;
+        while (node && !lod_is_cut(node, d, max_depth, min_size)) {
+            double mx = (node->x_min + node->x_max) * 0.5;
+            double my = (node->y_min + node->y_max) * 0.5;
+            node = node->child[quadrant(px, py, mx, my)];
+            d++;
+        }
+        cell_of[i] = node ? slot_of[node - arena.buffer] : -1;
+    }
+
+    /* sigma holds sum m |v|^2 until the end */
+    for (int i = 0; i < N; i++) {
+        int c = cell_of[i];
+        if (c < 0) continue;
+        double m = sys->mass[i], vx = sys->vx[i], vy = sys->vy[i];
+        cut->vx[c]         += m * vx;
+        cut->vy[c]         += m * vy;
+        cut->sigma[c]      += m * (vx * vx + vy * vy);
+        cut->brightness[c] += m * sys->brightness[i];
+        cut->count[c]      += 1.0;
+    }
+    for (int c = 0; c < cut->n; c++) {
+        double m = cut->mass[c];
+        if (m <= 0.0) continue;
+        cut->vx[c] /= m;
+        cut->vy[c] /= m;
+        cut->brightness[c] /= m;
+        double var = cut->sigma[c] / m -
+                     (cut->vx[c] * cut->vx[c] + cut->vy[c] * cut->vy[c]);
+        cut->sigma[c] = var > 0.0 ? sqrt(var) : 0.0;
+    }
+    return 1;
+}
+
+void barnes_hut_lod_free(LodCut* cut) {
+    free(cut->pos_x);
+    free(cut->pos_y);
+    free(cut->mass);
+    free(cut->vx);
+    free(cut->vy);
+    free(cut->sigma);
+    free(cut->brightness);
+    free(cut->size);
+    free(cut->count);
+    memset(cut, 0, sizeof(*cut));
+}
+
+const TNode* barnes_hut_tree(const ParticleSystem* sys) {
+    return tree_root && tree_N == sys->N ? tree_root : NULL;
+}
+
+/** Depth-first over the last tree, pruning cells whose box lies farther
+ * than r from the query box. Children are pushed in reverse so the
+ * results come out in tree order, which for Z-ordered arrays is index
+ * order.
+ * ----------------------------------------------------------------- */
+int barnes_hut_within(const ParticleSystem* sys, const double box[4],
+                      double r, int* out, int cap) {
+    if (!tree_root || tree_N != sys->N)
+        return -1;
+    const TNode* stack[256];
+    int sp = 0, n = 0;
+    double r2 = r * r;
+    stack[sp++] = tree_root;
+    while (sp > 0) {
+        const TNode* node = stack[--sp];
+        int idx = node->particle_idx;
+        double lo_x = node->x_min, hi_x = node->x_max;
+        double lo_y = node->y_min, hi_y = node->y_max;
+        if (idx >= 0) {
+            lo_x = hi_x = sys->pos_x[idx];
+            lo_y = hi_y = sys->pos_y[idx];
+        }
+        /* Gap between the query box and the cell (or particle) */
+        double dx = lo_x > box[1] ? lo_x - box[1]
+                  : box[0] > hi_x ? box[0] - hi_x : 0.0;
+        double dy = lo_y > box[3] ? lo_y - box[3]
+                  : box[2] > hi_y ? box[2] - hi_y : 0.0;
+        if (dx * dx + dy * dy > r2)
+            continue;
+        if (idx >= 0) {
+            if (n < cap) out[n] = idx;
+            n++;
+            continue;
+        }
+        for (int j = 3; j >= 0; j--)
+            if (node->child[j]) stack[sp++] = node->child[j];
+    }
+    return n;
+}
+
+/** Every leaf names its owner; only particles merged into a coincident
+ * leaf walk down from the root to find theirs. Bodies kept out of the
+ * tree keep -1.
+ * ----------------------------------------------------------------- */
+int barnes_hut_leaf_owners(const ParticleSystem* sys, int* owner) {
+    if (!tree_root || tree_N != sys->N)
+        return 0;
+    int N = sys->N;
+    long n_nodes = (long)arena.size;
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
+    {
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+        for (int i = 0; i < N; i++)
+            owner[i] = -1;
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+        for (long k = 0; k < n_nodes; k++) {
+            int idx = arena.buffer[k].particle_idx;
+            if (idx >= 0) owner[idx] = idx;
+        }
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+        for (int i = 0; i < N; i++) {
+            if (owner[i] >= 0 || !in_tree(sys, i)) continue;
+            double px = sys->pos_x[i], py = sys->pos_y[i];
+            const TNode* node = tree_root;
+            while (node && !is_leaf((TNode*)node)) {
+                double mx = (node->x_min + node->x_max) * 0.5;
+                double my = (node->y_min + node->y_max) * 0.5;
+                node = node->child[quadrant(px, py, mx, my)];
+            }
+            owner[i] = node ? node->particle_idx : i;
+        }
+    }
+    return 1;
+}
+
+/** Probe points sorted into Morton order so that points walked one
+ * after another by a thread open nearly the same cells. A probe is no
+ * body of the tree, so nothing is skipped and a unit mass turns the
+ * force into the acceleration.
+ * ----------------------------------------------------------------- */
+int barnes_hut_field(const ParticleSystem* sys, const double* px,
+                     const double* py, int n, double* ax, double* ay,
+                     double* pot) {
+    static int* order     = NULL;
+    static int  order_cap = 0;
+    if (!tree_root || tree_N != sys->N)
+        return 0;
+    if (order_cap < n) {
+        free(order);
+        order = malloc((size_t)n * sizeof(int));
+        if (!order) {
+            fprintf(stderr, "Error: Memory allocation failed for probe "
+                            "order.\n");
+            exit(1);
+        }
+        order_cap = n;
+    }
+    double box[4] = { tree_root->x_min, tree_root->x_max,
+                      tree_root->y_min, tree_root->y_max };
+    morton_order(px, py, n, box, order);
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, CHUNK_SIZE)
+#endif
+    for (int k = 0; k < n; k++) {
+        int q = order[k];
+        traverse(px[q], py[q], 1.0, NOT_IN_TREE, tree_root, &ax[q], &ay[q],
+                 pot ? &pot[q] : NULL);
+        if (n_direct > 0) {
+            double hx, hy, hp;
+            add_direct(px[q], py[q], 1.0, NOT_IN_TREE, &hx, &hy,
+                      pot ? &hp : NULL);
+            ax[q] += hx;
+            ay[q] += hy;
+            if (pot) pot[q] += hp;
+        }
+    }
+    return 1;
+}
+
+void barnes_hut_get_state(BHState* state) {
+    state->domain_valid = domain_initialized;
+    state->domain_N     = domain_N;
+    state->x_min = x_min;
+    state->x_max = x_max;
+    state->y_min = y_min;
+    state->y_max = y_max;
+    state->last_recluster_time = last_recluster_time;
+}
+
+void barnes_hut_set_state(const BHState* state) {
+    domain_initialized = state->domain_valid;
+    domain_N = state->domain_N;
+    x_min = state->x_min;
+    x_max = state->x_max;
+    y_min = state->y_min;
+    y_max = state->y_max;
+    last_recluster_time = state->last_recluster_time;
 }
 
 /** Compute the bounding square for all particles with a small padding.
+ * Outliers do not stretch it, unless every particle is one.
  * ----------------------------------------------------------------- */
 static void init_domain(const double* x, const double* y, int N,
                         double* x_min, double* x_max,
                         double* y_min, double* y_max) {
-    double nx_min = x[0], nx_max = x[0];
-    double ny_min = y[0], ny_max = y[0];
-    for (int i = 1; i < N; i++) {
+    int first = 0;
+    while (first < N && is_outlier(x[first], y[first])) first++;
+    int skip_outliers = first < N;
+    if (!skip_outliers) first = 0;
+
+    double nx_min = x[first], nx_max = x[first];
+    double ny_min = y[first], ny_max = y[first];
+    for (int i = first + 1; i < N; i++) {
+        if (skip_outliers && is_outlier(x[i], y[i])) continue;
         if (x[i] < nx_min) nx_min = x[i];
         if (x[i] > nx_max) nx_max = x[i];
         if (y[i] < ny_min) ny_min = y[i];
@@ -132,37 +662,60 @@ static void init_domain(const double* x, const double* y, int N,
     *y_max = ny_min + size + size * DOMAIN_PADDING_FRAC;
 }
 
-/** Grow the domain if any particle has escaped the current bounds.
+/** Grow the domain if any particle but an outlier has escaped the
+ * current bounds. Returns 1 if the domain was recomputed.
  * ----------------------------------------------------------------- */
-static void expand_domain_if_needed(const double* x, const double* y, int N,
-                                    double* x_min, double* x_max,
-                                    double* y_min, double* y_max) {
+static int expand_domain_if_needed(const double* x, const double* y, int N,
+                                   double* x_min, double* x_max,
+                                   double* y_min, double* y_max) {
     for (int i = 0; i < N; i++) {
+        if (is_outlier(x[i], y[i])) continue;
         if (x[i] < *x_min || x[i] > *x_max || y[i] < *y_min || y[i] > *y_max) {
             init_domain(x, y, N, x_min, x_max, y_min, y_max);
-            return;
+            return 1;
         }
     }
+    return 0;
 }
 
 /** Iterative tree traversal using an explicit stack.
  * Accepts a subtree as one pseudo-body when cell_width / r < theta.
  * ----------------------------------------------------------------- */
 static void compute_force_single(int i, ParticleSystem* sys, TNode* root,
-                                 double* res_fx, double* res_fy) {
-    double pos_x = sys->pos_x[i];
-    double pos_y = sys->pos_y[i];
-    double mass  = sys->mass[i];
+                                 double* res_fx, double* res_fy,
+                                 double* res_pot) {
+    /* A massless tracer gets the force on a unit mass */
+    double m = sys->mass[i] > 0.0 ? sys->mass[i] : 1.0;
+    traverse(sys->pos_x[i], sys->pos_y[i], m, i, root, res_fx, res_fy,
+             res_pot);
+    if (n_direct > 0) {
+        double hx, hy, hp;
+        add_direct(sys->pos_x[i], sys->pos_y[i], m, i, &hx, &hy,
+                  res_pot ? &hp : NULL);
+        *res_fx += hx;
+        *res_fy += hy;
+        if (res_pot) *res_pot += hp;
+    }
+}
 
-    TNode* stack[256];
+/** Force on a body at (pos_x, pos_y) from the tree at root, skipping the
+ * leaf of particle skip (NOT_IN_TREE when the body is not in this tree).
+ * With res_pot, also the potential per unit mass over the same accepted
+ * nodes. It is the one the softened force derives from:
+ * phi(r) = -G M (2r + eps) / (2 (r + eps)^2).
+ * ----------------------------------------------------------------- */
+static void traverse(double pos_x, double pos_y, double mass, int skip,
+                     const TNode* root, double* res_fx, double* res_fy,
+                     double* res_pot) {
+    const TNode* stack[256];
     int sp = 0;
     if (root) stack[sp++] = root;
 
-    double fx = 0.0, fy = 0.0;
+    double fx = 0.0, fy = 0.0, phi = 0.0;
 
     while (sp > 0) {
-        TNode* node = stack[--sp];
-        if (node->particle_idx == i) continue;
+        const TNode* node = stack[--sp];
+        if (node->particle_idx == skip) continue;
 
         double dx = pos_x - node->pos_x;
         double dy = pos_y - node->pos_y;
@@ -174,6 +727,8 @@ static void compute_force_single(int i, ParticleSystem* sys, TNode* root,
             double f = G_val * mass * node->mass / (denom * denom * denom);
             fx += f * (-dx);
             fy += f * (-dy);
+            if (res_pot)
+                phi -= G_val * node->mass * (r + denom) / (2.0 * denom * denom);
         } else {
             for (int j = 0; j < 4; j++) {
                 if (node->child[j]) stack[sp++] = node->child[j];
@@ -183,6 +738,320 @@ static void compute_force_single(int i, ParticleSystem* sys, TNode* root,
 
     *res_fx = fx;
     *res_fy = fy;
+    if (res_pot) *res_pot = phi;
+}
+
+/** Centre of mass of the step, serially so it does not depend on the
+ * thread count, when outliers are to be measured from it.
+ * ----------------------------------------------------------------- */
+static void find_centre(const ParticleSystem* sys, double radius) {
+    outlier_r2 = radius > 0.0 ? radius * radius : 0.0;
+    if (outlier_r2 <= 0.0)
+        return;
+    double m = 0.0, mx = 0.0, my = 0.0;
+    for (int i = 0; i < sys->N; i++) {
+        m  += sys->mass[i];
+        mx += sys->mass[i] * sys->pos_x[i];
+        my += sys->mass[i] * sys->pos_y[i];
+    }
+    centre_x = m > 0.0 ? mx / m : 0.0;
+    centre_y = m > 0.0 ? my / m : 0.0;
+}
+
+static int is_outlier(double px, double py) {
+    double dx = px - centre_x, dy = py - centre_y;
+    return outlier_r2 > 0.0 && dx * dx + dy * dy > outlier_r2;
+}
+
+/* Tracers, heavy bodies and outliers stay out of the tree */
+static int in_tree(const ParticleSystem* sys, int i) {
+    double m = sys->mass[i];
+    return m > tracer_val && (heavy_val <= 0.0 || m <= heavy_val) &&
+           !is_outlier(sys->pos_x[i], sys->pos_y[i]);
+}
+
+/** Gather the heavy bodies and the outliers that have mass into short
+ * contiguous arrays, in index order, after the step's reordering.
+ * ----------------------------------------------------------------- */
+static void collect_direct(const ParticleSystem* sys) {
+    n_direct = 0;
+    if (heavy_val <= 0.0 && outlier_r2 <= 0.0)
+        return;
+    for (int i = 0; i < sys->N; i++) {
+        if (in_tree(sys, i) || sys->mass[i] <= tracer_val) continue;
+        if (n_direct == direct_cap) {
+            direct_cap = direct_cap ? direct_cap * 2 : 64;
+            direct_idx = realloc(direct_idx, (size_t)direct_cap * sizeof(int));
+            direct_x   = realloc(direct_x, (size_t)direct_cap * sizeof(double));
+            direct_y   = realloc(direct_y, (size_t)direct_cap * sizeof(double));
+            direct_m   = realloc(direct_m, (size_t)direct_cap * sizeof(double));
+            if (!direct_idx || !direct_x || !direct_y || !direct_m) {
+                fprintf(stderr, "Error: Memory allocation failed for direct "
+                                "bodies.\n");
+                exit(1);
+            }
+        }
+        direct_idx[n_direct] = i;
+        direct_x[n_direct]   = sys->pos_x[i];
+        direct_y[n_direct]   = sys->pos_y[i];
+        direct_m[n_direct]   = sys->mass[i];
+        n_direct++;
+    }
+}
+
+/** Exact force of every direct body but skip on a body at (pos_x, pos_y),
+ * with the same softening as the tree. No branch in the loop, so it
+ * vectorises: the skipped body just gets zero weight.
+ * ----------------------------------------------------------------- */
+static void add_direct(double pos_x, double pos_y, double mass, int skip,
+                      double* res_fx, double* res_fy, double* res_pot) {
+    double ax = 0.0, ay = 0.0, phi = 0.0;
+#ifdef _OPENMP
+#pragma omp simd reduction(+ : ax, ay, phi)
+#endif
+    for (int k = 0; k < n_direct; k++) {
+        double dx = pos_x - direct_x[k];
+        double dy = pos_y - direct_y[k];
+        double r  = sqrt(dx * dx + dy * dy);
+        double denom = r + EPSILON;
+        double w = direct_idx[k] == skip ? 0.0 : direct_m[k];
+        double f = w / (denom * denom * denom);
+        ax  += f * (-dx);
+        ay  += f * (-dy);
+        phi += w * (r + denom) / (2.0 * denom * denom);
+    }
+    *res_fx = G_val * mass * ax;
+    *res_fy = G_val * mass * ay;
+    if (res_pot) *res_pot = -G_val * phi;
+}
+
+/* A cut cell: a leaf, or as deep or as small as the cut asks for */
+static int lod_is_cut(const TNode* node, int depth, int max_depth,
+                      double min_size) {
+    return is_leaf((TNode*)node) || (max_depth > 0 && depth >= max_depth) ||
+           (min_size > 0.0 && node->x_max - node->x_min <= min_size);
+}
+
+/* Grow every array of cut to hold at least n cells */
+static void lod_reserve(LodCut* cut, int n) {
+    if (n <= cut->cap)
+        return;
+    int cap = cut->cap ? cut->cap * 2 : 1024;
+    double** arrays[9] = { &cut->pos_x, &cut->pos_y, &cut->mass, &cut->vx,
+                           &cut->vy, &cut->sigma, &cut->brightness,
+                           &cut->size, &cut->count };
+    for (int a = 0; a < 9; a++) {
+        *arrays[a] = realloc(*arrays[a], (size_t)cap * sizeof(double));
+        if (!*arrays[a]) {
+            fprintf(stderr, "Error: Memory allocation failed for LOD cut.\n");
+            exit(1);
+        }
+    }
+    cut->cap = cap;
+}
+
+/** Number of particles in chunk c.
+ * ----------------------------------------------------------------- */
+static int chunk_count(int N, int c) {
+    int first = c * OOC_CHUNK;
+    return N - first < OOC_CHUNK ? N - first : OOC_CHUNK;
+}
+
+/* Root of chunk c's tree if it is cached, else NULL */
+static TNode* cached_tree(int c) {
+    for (int k = 0; k < tree_cache_len; k++)
+        if (tree_cache[k].chunk == c)
+            return tree_cache[k].root;
+    return NULL;
+}
+
+/** Full tree of chunk c, from the cache or built into the least recently
+ * used slot. Trees used for the current target (cache_clock) are never
+ * evicted; the cache grows instead. Also records the chunk's bbox.
+ * ----------------------------------------------------------------- */
+static TNode* chunk_tree(ParticleSystem* sys, int c) {
+    CachedTree* slot = NULL;
+    for (int k = 0; k < tree_cache_len; k++) {
+        if (tree_cache[k].chunk == c) {
+            tree_cache[k].last_use = cache_clock;
+            return tree_cache[k].root;
+        }
+        if (tree_cache[k].last_use < cache_clock &&
+            (!slot || tree_cache[k].last_use < slot->last_use))
+            slot = &tree_cache[k];
+    }
+    if (!slot) {
+        if (tree_cache_len == tree_cache_cap) {
+            tree_cache_cap = tree_cache_cap ? 2 * tree_cache_cap
+                                            : OOC_TREE_CACHE;
+            tree_cache = realloc(tree_cache,
+                                 (size_t)tree_cache_cap * sizeof(CachedTree));
+            if (!tree_cache) {
+                fprintf(stderr, "Error: Memory allocation failed for "
+                                "out-of-core tree cache.\n");
+                exit(1);
+            }
+        }
+        slot = &tree_cache[tree_cache_len++];
+        slot->arena.buffer = NULL;
+        init_arena(&slot->arena, (size_t)OOC_CHUNK * ARENA_NODE_FACTOR);
+    }
+
+    int first = c * OOC_CHUNK;
+    ParticleSystem v;
+    v.N     = chunk_count(sys->N, c);
+    v.pos_x = sys->pos_x + first;
+    v.pos_y = sys->pos_y + first;
+    v.mass  = sys->mass + first;
+
+    double* cb = &chunk_box[4 * c];
+    cb[0] = cb[1] = v.pos_x[0];
+    cb[2] = cb[3] = v.pos_y[0];
+    for (int i = 1; i < v.N; i++) {
+        if (v.pos_x[i] < cb[0]) cb[0] = v.pos_x[i];
+        if (v.pos_x[i] > cb[1]) cb[1] = v.pos_x[i];
+        if (v.pos_y[i] < cb[2]) cb[2] = v.pos_y[i];
+        if (v.pos_y[i] > cb[3]) cb[3] = v.pos_y[i];
+    }
+
+    double lb, rb, db, ub;
+    init_domain(v.pos_x, v.pos_y, v.N, &lb, &rb, &db, &ub);
+    reset_arena(&slot->arena);
+    build_arena = &slot->arena;
+    slot->root = create_node(lb, rb, db, ub);
+    for (int i = 0; i < v.N; i++)
+        if (in_tree(&v, i)) insert(slot->root, i, &v);
+    build_arena = &arena;
+
+    slot->chunk    = c;
+    slot->last_use = cache_clock;
+    return slot->root;
+}
+
+/** Copy the top OOC_SUMMARY_DEPTH levels of chunk c's tree, breadth
+ * first so that the children of each cell are contiguous.
+ * ----------------------------------------------------------------- */
+static void summarize(int c, const TNode* root) {
+    static const TNode** queue = NULL;
+    static int*          depth = NULL;
+    static size_t        queue_cap = 0;
+
+    size_t n = 0;
+    summary_root[c] = summary_len;
+    for (size_t k = 0; k <= n; k++) {
+        if (n + 4 >= queue_cap) {
+            queue_cap = queue_cap ? 2 * queue_cap : 4096;
+            queue = realloc(queue, queue_cap * sizeof(TNode*));
+            depth = realloc(depth, queue_cap * sizeof(int));
+        }
+        if (summary_len + k + 4 >= summary_cap) {
+            summary_cap = summary_cap ? 2 * summary_cap : 65536;
+            summary = realloc(summary, summary_cap * sizeof(SummaryNode));
+        }
+        if (!queue || !depth || !summary) {
+            fprintf(stderr, "Error: Memory allocation failed for "
+                            "out-of-core summary.\n");
+            exit(1);
+        }
+        if (k == 0) {
+            queue[0] = root;
+            depth[0] = 0;
+        }
+
+        const TNode* t = queue[k];
+        SummaryNode* s = &summary[summary_len + k];
+        s->pos_x = t->pos_x;
+        s->pos_y = t->pos_y;
+        s->mass  = t->mass;
+        s->size  = t->x_max - t->x_min;
+        s->first_child = 0;
+        s->n_children  = 0;
+        if (t->particle_idx != -1 || is_leaf((TNode*)t)) {
+            s->kind = SUMMARY_BODY;
+        } else if (depth[k] == OOC_SUMMARY_DEPTH) {
+            s->kind = SUMMARY_CUT;
+        } else {
+            s->kind = SUMMARY_CELL;
+            s->first_child = (int)(n + 1);
+            for (int j = 0; j < 4; j++) {
+                if (!t->child[j]) continue;
+                queue[++n] = t->child[j];
+                depth[n]   = depth[k] + 1;
+                s->n_children++;
+            }
+        }
+    }
+    summary_len += n + 1;
+}
+
+/* Opening criterion against every point of box: the cell is accepted
+ * only if it is far enough from the nearest point of box */
+static int far_enough(const SummaryNode* node, const double* box) {
+    double dx = 0.0, dy = 0.0;
+    if (node->pos_x < box[0])      dx = box[0] - node->pos_x;
+    else if (node->pos_x > box[1]) dx = node->pos_x - box[1];
+    if (node->pos_y < box[2])      dy = box[2] - node->pos_y;
+    else if (node->pos_y > box[3]) dy = node->pos_y - box[3];
+    return node->size < theta_val * sqrt(dx * dx + dy * dy);
+}
+
+/** Mark the chunks whose particles target chunk t needs: itself, and
+ * every chunk whose summary would have to be opened below its cut.
+ * ----------------------------------------------------------------- */
+static void classify(int t, int n_chunks, char* near) {
+    const double* box = &chunk_box[4 * t];
+    for (int s = 0; s < n_chunks; s++) {
+        near[s] = s == t;
+        const SummaryNode* base = &summary[summary_root[s]];
+        int stack[256];
+        int sp = 0;
+        stack[sp++] = 0;
+        while (sp > 0 && !near[s]) {
+            const SummaryNode* node = &base[stack[--sp]];
+            if (node->kind == SUMMARY_BODY || far_enough(node, box))
+                continue;
+            if (node->kind == SUMMARY_CUT) {
+                near[s] = 1;
+                break;
+            }
+            for (int j = 0; j < node->n_children; j++)
+                stack[sp++] = node->first_child + j;
+        }
+    }
+}
+
+/** Append the cells of far chunk s accepted for box to list as
+ * (x, y, mass) triples; returns the new length. A far chunk is never
+ * opened below its cut for a box inside the target chunk's box.
+ * ----------------------------------------------------------------- */
+static size_t collect_far(int s, const double* box, double** list,
+                          size_t* cap, size_t n) {
+    const SummaryNode* base = &summary[summary_root[s]];
+    int stack[256];
+    int sp = 0;
+    stack[sp++] = 0;
+    while (sp > 0) {
+        const SummaryNode* node = &base[stack[--sp]];
+        if (node->kind == SUMMARY_CELL && !far_enough(node, box)) {
+            for (int j = 0; j < node->n_children; j++)
+                stack[sp++] = node->first_child + j;
+            continue;
+        }
+        if (n == *cap) {
+            *cap = *cap ? 2 * *cap : 4096;
+            *list = realloc(*list, *cap * 3 * sizeof(double));
+            if (!*list) {
+                fprintf(stderr, "Error: Memory allocation failed for "
+                                "out-of-core interaction list.\n");
+                exit(1);
+            }
+        }
+        (*list)[3 * n]     = node->pos_x;
+        (*list)[3 * n + 1] = node->pos_y;
+        (*list)[3 * n + 2] = node->mass;
+        n++;
+    }
+    return n;
 }
 
 /** Insert particle idx into the quadtree.
@@ -262,7 +1131,7 @@ static void insert(TNode* node, int idx, ParticleSystem* sys) {
 
 /* Allocate a node from the arena instead of calling malloc each time */
 static TNode* create_node(double LB, double RB, double DB, double UB) {
-    TNode* node = arena_alloc(&arena);
+    TNode* node = arena_alloc(build_arena);
     if (!node) {
         fprintf(stderr, "Error: arena out of memory!\n");
         exit(1);
@@ -0,0 +1,81 @@
+#ifndef BARNES_HUT_H
+#define BARNES_HUT_H
+
+#include "ds.h"
+#include "types.h"
+
+/* State that survives between timesteps and decides the next step's
+ * tree and ordering, so a restart must restore it for identical results. */
+typedef struct {
+    int    domain_valid;
+    int    domain_N;
+    double x_min, x_max, y_min, y_max;
+    double last_recluster_time;  /* -1 = never clustered */
+} BHState;
+
+/* Level-of-detail cut of the tree: one pseudo-particle per cut cell */
+typedef struct {
+    int     n, cap;
+    double* pos_x;       /* centre of mass */
+    double* pos_y;
+    double* mass;        /* total mass */
+    double* vx;          /* mass-weighted mean velocity */
+    double* vy;
+    double* sigma;       /* mass-weighted velocity dispersion */
+    double* brightness;  /* mass-weighted mean brightness */
+    double* size;        /* cell side */
+    double* count;       /* particles in the cell */
+} LodCut;
+
+// Bodies of mass at most config->tracer_mass are left out of the tree:
+// they feel the others but pull on nothing, and a massless one gets the
+// force on a unit mass, its acceleration. Bodies heavier than
+// config->heavy_mass (if > 0) are left out too; every target sums them
+// directly, so they act on each other exactly. So are outliers, bodies
+// farther than config->outlier_radius (if > 0) from the centre of mass:
+// the tree domain is fitted to the rest, and an outlier walks the tree
+// like any target.
+void compute_force_barnes_hut(ParticleSystem* sys, KernelConfig* config);
+
+// Barnes-Hut over a Z-ordered out-of-core working file (see ooc.h),
+// one spatial chunk at a time; sys may be remapped by a re-sort.
+void compute_force_barnes_hut_ooc(ParticleSystem* sys, KernelConfig* config);
+
+// Cut the tree of the last in-core force pass where cells reach depth
+// max_depth or side min_size (0 = no limit; leaves always end it) and
+// summarise sys per cut cell. Returns 0 when no tree matches sys.
+int  barnes_hut_lod(const ParticleSystem* sys, int max_depth,
+                    double min_size, LodCut* cut);
+void barnes_hut_lod_free(LodCut* cut);
+
+// Root of the last in-core tree, or NULL when it was not built from sys.
+// Leaves hold particle indices of sys; read-only until the next force pass.
+const TNode* barnes_hut_tree(const ParticleSystem* sys);
+
+// Particles of the last in-core tree within r of the box x_min, x_max,
+// y_min, y_max (a point when the box is empty): writes up to cap indices
+// to out and returns how many there are (possibly more than cap), or -1
+// when no tree matches sys. A leaf of coincident particles reports only
+// the one that owns it (see barnes_hut_leaf_owners).
+int  barnes_hut_within(const ParticleSystem* sys, const double box[4],
+                       double r, int* out, int cap);
+
+// owner[i] = the particle that owns particle i's leaf: i itself, or the
+// first of the coincident particles merged into that leaf, which has a
+// smaller index; -1 for tracers, heavy bodies and outliers, in no leaf.
+// Returns 0 when no tree matches sys.
+int  barnes_hut_leaf_owners(const ParticleSystem* sys, int* owner);
+
+// Acceleration (ax, ay) and potential per unit mass (pot, may be NULL) of
+// the last in-core tree and its direct bodies at n arbitrary points, with
+// the opening angle and softening of that force pass. Points are walked
+// in parallel in Morton order of the tree domain. Returns 0 when no tree
+// matches sys.
+int  barnes_hut_field(const ParticleSystem* sys, const double* px,
+                      const double* py, int n, double* ax, double* ay,
+                      double* pot);
+
+void barnes_hut_get_state(BHState* state);
+void barnes_hut_set_state(const BHState* state);
+
+#endif
@@ -0,0 +1,332 @@
+#include "checkpoint.h"
+#include "async_io.h"
+#include "ids.h"
+#include "io.h"
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CHECKPOINT_MAGIC "NBCHK001"
+
+/* The header is padded so every array starts page-aligned */
+#define HEADER_BYTES 4096
+#define N_ARRAYS     CHECKPOINT_ARRAYS
+
+/* Arrays are copied and read in pieces of this many doubles */
+#define COPY_CHUNK (1 << 17)
+
+typedef struct {
+    char     magic[8];
+    int32_t  version_id;
+    int32_t  N;
+    int32_t  step;
+    int32_t  k_clusters;
+    double   dt;
+    double   theta;
+    double   current_time;
+    int32_t  domain_valid;
+    int32_t  domain_N;
+    double   x_min, x_max, y_min, y_max;
+    double   last_recluster_time;
+    uint32_t n_arrays;
+    uint32_t id_bytes;    /* sizeof(ParticleId) if ids follow the arrays */
+    double   tracer_mass; /* zero in older files: massless tracers only */
+    double   heavy_mass;  /* zero in older files: no direct summation */
+    int32_t  external_kind;  /* ExternalKind; zero in older files: none */
+    int32_t  reserved;
+    double   external[7];    /* x0, y0, gm, scale, v0, q, omega */
+    double   outlier_radius; /* zero in older files: no outliers */
+} CheckpointHeader;
+
+/* Fixed on-disk array order; velocities and forces together hold the
+ * half-kick state, so the next step continues exactly. */
+void checkpoint_array_list(const ParticleSystem* sys,
+                           double* arrays[N_ARRAYS]) {
+    arrays[0] = sys->pos_x;
+    arrays[1] = sys->pos_y;
+    arrays[2] = sys->mass;
+    arrays[3] = sys->vx;
+    arrays[4] = sys->vy;
+    arrays[5] = sys->fx;
+    arrays[6] = sys->fy;
+    arrays[7] = sys->brightness;
+}
+
+static void fill_header(CheckpointHeader* h, int N,
+                        const CheckpointState* state) {
+    memset(h, 0, sizeof(*h));
+    memcpy(h->magic, CHECKPOINT_MAGIC, 8);
+    h->version_id   = state->version_id;
+    h->N            = N;
+    h->step         = state->step;
+    h->k_clusters   = state->k_clusters;
+    h->dt           = state->dt;
+    h->theta        = state->theta;
+    h->current_time = state->current_time;
+    h->tracer_mass  = state->tracer_mass;
+    h->heavy_mass   = state->heavy_mass;
+    h->outlier_radius = state->outlier_radius;
+    const ExternalPotential* e = &state->external;
+    h->external_kind = (int32_t)e->kind;
+    double ext[7] = { e->x0, e->y0, e->gm, e->scale, e->v0, e->q, e->omega };
+    memcpy(h->external, ext, sizeof(ext));
+    h->domain_valid = state->bh.domain_valid;
+    h->domain_N     = state->bh.domain_N;
+    h->x_min = state->bh.x_min;
+    h->x_max = state->bh.x_max;
+    h->y_min = state->bh.y_min;
+    h->y_max = state->bh.y_max;
+    h->last_recluster_time = state->bh.last_recluster_time;
+    h->n_arrays = N_ARRAYS;
+}
+
+static void read_header(const CheckpointHeader* h, CheckpointState* state) {
+    state->version_id   = h->version_id;
+    state->step         = h->step;
+    state->k_clusters   = h->k_clusters;
+    state->dt           = h->dt;
+    state->theta        = h->theta;
+    state->current_time = h->current_time;
+    state->tracer_mass  = h->tracer_mass;
+    state->heavy_mass   = h->heavy_mass;
+    state->outlier_radius = h->outlier_radius;
+    ExternalPotential* e = &state->external;
+    memset(e, 0, sizeof(*e));
+    e->kind  = (ExternalKind)h->external_kind;
+    e->x0    = h->external[0];
+    e->y0    = h->external[1];
+    e->gm    = h->external[2];
+    e->scale = h->external[3];
+    e->v0    = h->external[4];
+    e->q     = h->external[5];
+    e->omega = h->external[6];
+    e->cos_t = 1.0;
+    state->bh.domain_valid = h->domain_valid;
+    state->bh.domain_N     = h->domain_N;
+    state->bh.x_min = h->x_min;
+    state->bh.x_max = h->x_max;
+    state->bh.y_min = h->y_min;
+    state->bh.y_max = h->y_max;
+    state->bh.last_recluster_time = h->last_recluster_time;
+}
+
+void checkpoint_write_async(const char* path, const ParticleSystem* sys,
+                            const CheckpointState* state) {
+    size_t array_bytes = (size_t)sys->N * sizeof(double);
+    size_t id_bytes = sys->id ? (size_t)sys->N * sizeof(ParticleId) : 0;
+    size_t bytes = HEADER_BYTES + N_ARRAYS * array_bytes + id_bytes;
+    StageBuffer* slot = async_io_acquire(bytes);
+
+    CheckpointHeader h;
+    fill_header(&h, sys->N, state);
+    h.id_bytes = sys->id ? (uint32_t)sizeof(ParticleId) : 0;
+    memset(slot->data, 0, HEADER_BYTES);
+    memcpy(slot->data, &h, sizeof(h));
+
+    double* arrays[N_ARRAYS];
+    checkpoint_array_list(sys, arrays);
+    int chunks = (sys->N + COPY_CHUNK - 1) / COPY_CHUNK;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+    for (int c = 0; c < chunks; c++) {
+        for (int a = 0; a < N_ARRAYS; a++) {
+            size_t first = (size_t)c * COPY_CHUNK;
+            size_t count = (size_t)sys->N - first < COPY_CHUNK
+                               ? (size_t)sys->N - first : COPY_CHUNK;
+            memcpy(slot->data + HEADER_BYTES + a * array_bytes +
+                       first * sizeof(double),
+                   arrays[a] + first, count * sizeof(double));
+        }
+    }
+    if (sys->id)
+        memcpy(slot->data + HEADER_BYTES + N_ARRAYS * array_bytes, sys->id,
+               id_bytes);
+
+    slot->len    = bytes;
+    slot->atomic = 1;
+    snprintf(slot->path, sizeof(slot->path), "%s", path);
+    async_io_submit(slot);
+}
+
+/** Read the header, then pread every array straight into place.
+ * Index ranges are split statically over threads, as in the integrators,
+ * so each thread first-touches the pages it will update.
+ * ----------------------------------------------------------------- */
+bool checkpoint_read(const char* path, ParticleSystem* sys,
+                     CheckpointState* state) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror("Error opening checkpoint");
+        return false;
+    }
+
+    CheckpointHeader h;
+    if (pread(fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h) ||
+        memcmp(h.magic, CHECKPOINT_MAGIC, 8) != 0 || h.N <= 0 ||
+        h.n_arrays != N_ARRAYS) {
+        fprintf(stderr, "Error: %s is not a checkpoint file.\n", path);
+        close(fd);
+        return false;
+    }
+    if (h.id_bytes != 0 && h.id_bytes != sizeof(ParticleId)) {
+        fprintf(stderr, "Error: %s holds %u-byte particle ids; this build "
+                        "uses %u-byte ids (NBODY_ID64).\n", path, h.id_bytes,
+                (unsigned)sizeof(ParticleId));
+        close(fd);
+        return false;
+    }
+
+    read_header(&h, state);
+
+    *sys = io_alloc_particles(h.N);
+    double* arrays[N_ARRAYS];
+    checkpoint_array_list(sys, arrays);
+    size_t array_bytes = (size_t)h.N * sizeof(double);
+    int chunks = (h.N + COPY_CHUNK - 1) / COPY_CHUNK;
+    bool ok = true;
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) reduction(&& : ok)
+#endif
+    for (int c = 0; c < chunks; c++) {
+        for (int a = 0; a < N_ARRAYS; a++) {
+            size_t first = (size_t)c * COPY_CHUNK;
+            size_t count = (size_t)h.N - first < COPY_CHUNK
+                               ? (size_t)h.N - first : COPY_CHUNK;
+            char*  dst  = (char*)(arrays[a] + first);
+            size_t left = count * sizeof(double);
+            off_t  off  = HEADER_BYTES + (off_t)a * array_bytes +
+                          (off_t)(first * sizeof(double));
+            while (left > 0) {
+                ssize_t n = pread(fd, dst, left, off);
+                if (n <= 0) {
+                    ok = false;
+                    break;
+                }
+                dst  += n;
+                left -= (size_t)n;
+                off  += n;
+            }
+        }
+    }
+
+    if (ok && h.id_bytes != 0) {
+        size_t id_bytes = (size_t)h.N * sizeof(ParticleId);
+        sys->id = malloc(id_bytes);
+        ok = sys->id &&
+             pread(fd, sys->id, id_bytes,
+                   HEADER_BYTES + (off_t)N_ARRAYS * array_bytes) ==
+                 (ssize_t)id_bytes &&
+             ids_adopt(sys);
+    }
+
+    close(fd);
+    if (!ok) {
+        fprintf(stderr, "Error: checkpoint %s is truncated.\n", path);
+        io_free_particles(sys);
+    }
+    return ok;
+}
+
+/** Map a checkpoint-layout file shared and point sys into it.
+ * A new file is sized sparse; its pages are written by whoever fills the
+ * arrays, so nothing is read or zeroed up front.
+ * ----------------------------------------------------------------- */
+bool checkpoint_map(const char* path, int N, CheckpointMap* map,
+                    ParticleSystem* sys, CheckpointState* state) {
+    memset(map, 0, sizeof(*map));
+    map->fd = open(path, N > 0 ? O_RDWR | O_CREAT | O_TRUNC : O_RDWR, 0644);
+    if (map->fd < 0) {
+        perror("Error opening working file");
+        return false;
+    }
+
+    CheckpointHeader h;
+    if (N > 0) {
+        map->bytes = HEADER_BYTES + (size_t)N_ARRAYS * (size_t)N * sizeof(double);
+        if (ftruncate(map->fd, (off_t)map->bytes) != 0) {
+            perror("Error sizing working file");
+            close(map->fd);
+            return false;
+        }
+    } else {
+        struct stat st;
+        if (pread(map->fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h) ||
+            memcmp(h.magic, CHECKPOINT_MAGIC, 8) != 0 || h.N <= 0 ||
+            h.n_arrays != N_ARRAYS || fstat(map->fd, &st) != 0 ||
+            (size_t)st.st_size < HEADER_BYTES + (size_t)N_ARRAYS *
+                                     (size_t)h.N * sizeof(double)) {
+            fprintf(stderr, "Error: %s is not a complete checkpoint.\n", path);
+            close(map->fd);
+            return false;
+        }
+        N = h.N;
+        map->bytes = HEADER_BYTES + (size_t)N_ARRAYS * (size_t)N * sizeof(double);
+        if (state)
+            read_header(&h, state);
+    }
+
+    void* base = mmap(NULL, map->bytes, PROT_READ | PROT_WRITE, MAP_SHARED,
+                      map->fd, 0);
+    if (base == MAP_FAILED) {
+        perror("Error mapping working file");
+        close(map->fd);
+        return false;
+    }
+    map->base = base;
+
+    double* arrays[N_ARRAYS];
+    for (int a = 0; a < N_ARRAYS; a++)
+        arrays[a] = (double*)(map->base + HEADER_BYTES +
+                              (size_t)a * (size_t)N * sizeof(double));
+    sys->N          = N;
+    sys->pos_x      = arrays[0];
+    sys->pos_y      = arrays[1];
+    sys->mass       = arrays[2];
+    sys->vx         = arrays[3];
+    sys->vy         = arrays[4];
+    sys->fx         = arrays[5];
+    sys->fy         = arrays[6];
+    sys->brightness = arrays[7];
+    sys->id         = NULL;
+    sys->index_of   = NULL;
+
+    /* The arrays are about to change; until the next sync the file must
+     * not pass for a checkpoint */
+    return checkpoint_map_sync(map, sys, NULL);
+}
+
+bool checkpoint_map_sync(CheckpointMap* map, const ParticleSystem* sys,
+                         const CheckpointState* state) {
+    CheckpointHeader h;
+    if (state) {
+        fill_header(&h, sys->N, state);
+        if (msync(map->base, map->bytes, MS_SYNC) != 0) {
+            perror("Error flushing working file");
+            return false;
+        }
+    } else {
+        memset(&h, 0, sizeof(h));
+    }
+    memcpy(map->base, &h, sizeof(h));
+    if (msync(map->base, HEADER_BYTES, MS_SYNC) != 0) {
+        perror("Error flushing working file");
+        return false;
+    }
+    return true;
+}
+
+void checkpoint_unmap(CheckpointMap* map) {
+    if (map->base)
+        munmap(map->base, map->bytes);
+    if (map->fd >= 0)
+        close(map->fd);
+    memset(map, 0, sizeof(*map));
+    map->fd = -1;
+}
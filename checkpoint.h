@@ -0,0 +1,62 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "barnes_hut.h"
+#include "external.h"
+#include "types.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/* The particle arrays a checkpoint holds, in file order */
+#define CHECKPOINT_ARRAYS 8
+
+/* Everything besides the particle arrays that a bit-exact restart needs */
+typedef struct {
+    int     version_id;
+    int     step;          /* completed steps */
+    int     k_clusters;
+    double  dt;
+    double  theta;
+    double  current_time;
+    double  tracer_mass;
+    double  heavy_mass;
+    double  outlier_radius;
+    ExternalPotential external;
+    BHState bh;
+} CheckpointState;
+
+// The arrays of sys in the fixed on-disk order of a checkpoint.
+void checkpoint_array_list(const ParticleSystem* sys,
+                           double* arrays[CHECKPOINT_ARRAYS]);
+
+// Stage the full state for the background writer; the file is written
+// to path.tmp and renamed, so path always holds a complete checkpoint.
+void checkpoint_write_async(const char* path, const ParticleSystem* sys,
+                            const CheckpointState* state);
+
+// Load a checkpoint into newly allocated particle arrays.
+bool checkpoint_read(const char* path, ParticleSystem* sys,
+                     CheckpointState* state);
+
+/* A checkpoint file mapped shared, so the particle arrays live in the
+ * file itself (the out-of-core working file) */
+typedef struct {
+    unsigned char* base;
+    size_t         bytes;
+    int            fd;
+} CheckpointMap;
+
+// N > 0: create path sized for N particles and map it; the header stays
+// invalid until checkpoint_map_sync. N == 0: map an existing checkpoint
+// in place and fill state. sys points into the mapping either way.
+bool checkpoint_map(const char* path, int N, CheckpointMap* map,
+                    ParticleSystem* sys, CheckpointState* state);
+
+// Write the header and flush the mapping; the file is then a complete
+// checkpoint of state (state may be NULL to mark it invalid instead).
+bool checkpoint_map_sync(CheckpointMap* map, const ParticleSystem* sys,
+                         const CheckpointState* state);
+
+void checkpoint_unmap(CheckpointMap* map);
+
+#endif
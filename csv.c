@@ -0,0 +1,523 @@
+#include "csv.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#define N_FIELDS   6
+#define MAX_COLS   64        /* columns looked at per line */
+#define SNIFF_BYTES 4096
+
+static const char* const FIELD_NAMES[N_FIELDS] = {
+    "x", "y", "mass", "vx", "vy", "brightness"
+};
+
+/* Powers of ten that are exact doubles, for the fast parsing path */
+static const double POW10[23] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+#ifdef __SIZEOF_INT128__
+typedef unsigned __int128 u128;
+
+static const uint64_t POW10_U64[20] = {
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL,
+    10000000ULL, 100000000ULL, 1000000000ULL, 10000000000ULL,
+    100000000000ULL, 1000000000000ULL, 10000000000000ULL,
+    100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+    100000000000000000ULL, 1000000000000000000ULL,
+    10000000000000000000ULL
+};
+
+/* 10^k for 0 <= k <= 38, every power of ten that fits 128 bits */
+static u128 pow10_u128(int k) {
+    return k <= 19 ? (u128)POW10_U64[k]
+                   : (u128)POW10_U64[19] * POW10_U64[k - 19];
+}
+#endif
+
+typedef struct {
+    char delim;              /* ',', '\t', or ' ' for runs of blanks */
+    int  n_cols;
+    int  field[MAX_COLS];    /* field stored from each column, -1 = none */
+    int  has_brightness;
+} Layout;
+
+static const char* line_end(const char* p, const char* end);
+static int  is_data_line(const char* p, const char* end);
+static int  split_line(const char* p, const char* end, char delim,
+                       const char* tok[MAX_COLS][2]);
+static bool parse_line(const char* p, const char* end, const Layout* L,
+                       double vals[N_FIELDS]);
+static bool parse_double(const char* s, const char* e, double* out);
+static bool parse_slow(const char* s, const char* e, double* out);
+static int  format_double(double v, char* dst);
+static bool detect_layout(const char* p, const char* end, Layout* L,
+                          const char* filename);
+
+bool csv_is_text(const unsigned char* p, size_t len) {
+    if (len > SNIFF_BYTES)
+        len = SNIFF_BYTES;
+    bool digit = false;
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = p[i];
+        if ((c < 0x20 || c > 0x7e) && c != '\n' && c != '\r' && c != '\t')
+            return false;
+        digit |= c >= '0' && c <= '9';
+    }
+    return digit;
+}
+
+/** Two passes over the same line-aligned chunks, one per thread: count
+ * the particle lines, then parse each chunk straight into its slice of
+ * the arrays. Static chunks match the integrator's static schedule, so
+ * pages are first-touched by the thread that later updates them.
+ * ----------------------------------------------------------------- */
+ParticleSystem csv_parse(const char* text, size_t len, int N,
+                         const char* filename, IoAllocator alloc) {
+    const char* end  = text + len;
+    const char* body = text;
+    Layout L;
+
+    /* The first non-comment line fixes the layout; skip it if a header */
+    for (;;) {
+        if (body >= end) {
+            fprintf(stderr, "Error: %s holds no particles.\n", filename);
+            exit(1);
+        }
+        const char* eol = line_end(body, end);
+        if (is_data_line(body, eol)) {
+            if (detect_layout(body, eol, &L, filename))
+                body = eol < end ? eol + 1 : end;
+            break;
+        }
+        body = eol < end ? eol + 1 : end;
+    }
+
+    int T = 1;
+#ifdef _OPENMP
+    T = omp_get_max_threads();
+#endif
+    const char** start = malloc(((size_t)T + 1) * sizeof(*start));
+    long long* first   = malloc(((size_t)T + 1) * sizeof(*first));
+    if (!start || !first) {
+        fprintf(stderr, "Error: Memory allocation failed for text parser.\n");
+        exit(1);
+    }
+    size_t body_len = (size_t)(end - body);
+    start[0] = body;
+    for (int t = 1; t < T; t++) {
+        const char* p = body + body_len / T * t;
+        const char* eol = line_end(p > start[t - 1] ? p - 1 : start[t - 1],
+                                   end);
+        start[t] = eol < end ? eol + 1 : end;
+    }
+    start[T] = end;
+
+#ifdef _OPENMP
+#pragma omp parallel num_threads(T)
+#endif
+    {
+        int t = 0;
+#ifdef _OPENMP
+        t = omp_get_thread_num();
+#endif
+        long long n = 0;
+        for (const char* p = start[t]; p < start[t + 1];) {
+            const char* eol = line_end(p, start[t + 1]);
+            n += is_data_line(p, eol);
+            p = eol + 1;
+        }
+        first[t + 1] = n;
+    }
+    first[0] = 0;
+    for (int t = 0; t < T; t++)
+        first[t + 1] += first[t];
+
+    long long total = first[T];
+    if (total == 0 || total > 0x7fffffffLL ||
+        (N != 0 && total < N)) {
+        fprintf(stderr, "Error: %s holds %lld particles, expected %d\n",
+                filename, total, N);
+        exit(1);
+    }
+    if (N == 0)
+        N = (int)total;
+
+    ParticleSystem sys = alloc(N);
+    const char* bad = NULL;
+#ifdef _OPENMP
+#pragma omp parallel num_threads(T)
+#endif
+    {
+        int t = 0;
+#ifdef _OPENMP
+        t = omp_get_thread_num();
+#endif
+        long long i = first[t];
+        for (const char* p = start[t]; p < start[t + 1] && i < N;) {
+            const char* eol = line_end(p, start[t + 1]);
+            if (is_data_line(p, eol)) {
+                double v[N_FIELDS];
+                if (!parse_line(p, eol, &L, v)) {
+#ifdef _OPENMP
+#pragma omp critical(csv_error)
+#endif
+                    if (!bad || p < bad)
+                        bad = p;
+                    break;
+                }
+                sys.pos_x[i]      = v[0];
+                sys.pos_y[i]      = v[1];
+                sys.mass[i]       = v[2];
+                sys.vx[i]         = v[3];
+                sys.vy[i]         = v[4];
+                sys.brightness[i] = L.has_brightness ? v[5] : 1.0;
+                sys.fx[i]         = 0.0;
+                sys.fy[i]         = 0.0;
+                i++;
+            }
+            p = eol + 1;
+        }
+    }
+    free(start);
+    free(first);
+
+    if (bad) {
+        long long line = 1;
+        for (const char* p = text; p < bad; p++)
+            line += *p == '\n';
+        fprintf(stderr, "Error: %s:%lld: cannot parse particle line.\n",
+                filename, line);
+        exit(1);
+    }
+    return sys;
+}
+
+size_t csv_format(const ParticleSystem* sys, int first, int count,
+                  char* dst) {
+    char* p = dst;
+    for (int i = first; i < first + count; i++) {
+        p += format_double(sys->pos_x[i], p);
+        *p++ = ',';
+        p += format_double(sys->pos_y[i], p);
+        *p++ = ',';
+        p += format_double(sys->mass[i], p);
+        *p++ = ',';
+        p += format_double(sys->vx[i], p);
+        *p++ = ',';
+        p += format_double(sys->vy[i], p);
+        *p++ = ',';
+        p += format_double(sys->brightness[i], p);
+        *p++ = '\n';
+    }
+    return (size_t)(p - dst);
+}
+
+/* End of the line starting at p (its '\n', or end) */
+static const char* line_end(const char* p, const char* end) {
+    const char* eol = memchr(p, '\n', (size_t)(end - p));
+    return eol ? eol : end;
+}
+
+/* Anything but blank lines and '#' comments */
+static int is_data_line(const char* p, const char* end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+        p++;
+    return p < end && *p != '#';
+}
+
+/** Cut a line into at most MAX_COLS trimmed fields.
+ * ----------------------------------------------------------------- */
+static int split_line(const char* p, const char* end, char delim,
+                      const char* tok[MAX_COLS][2]) {
+    if (end > p && end[-1] == '\r')
+        end--;
+    int n = 0;
+    while (n < MAX_COLS) {
+        while (p < end && (*p == ' ' || *p == '\t') &&
+               (delim == ' ' || *p != delim))
+            p++;
+        if (delim == ' ' && p == end)
+            break;
+        const char* q = p;
+        if (delim == ' ')
+            while (q < end && *q != ' ' && *q != '\t') q++;
+        else
+            while (q < end && *q != delim) q++;
+        const char* e = q;
+        while (e > p && (e[-1] == ' ' || e[-1] == '\t'))
+            e--;
+        tok[n][0] = p;
+        tok[n][1] = e;
+        n++;
+        if (q == end)
+            break;
+        p = q + 1;
+    }
+    return n;
+}
+
+static bool parse_line(const char* p, const char* end, const Layout* L,
+                       double vals[N_FIELDS]) {
+    const char* tok[MAX_COLS][2];
+    int n = split_line(p, end, L->delim, tok);
+    if (n < L->n_cols)
+        return false;
+    for (int c = 0; c < L->n_cols; c++)
+        if (L->field[c] >= 0 &&
+            !parse_double(tok[c][0], tok[c][1], &vals[L->field[c]]))
+            return false;
+    return true;
+}
+
+/** Decimal to double. Up to 19 significant digits are gathered into an
+ * integer; when it fits a double's mantissa and the exponent a power of
+ * ten that is exact, one multiply or divide gives the correctly rounded
+ * result. Everything else goes through strtod.
+ * ----------------------------------------------------------------- */
+static bool parse_double(const char* s, const char* e, double* out) {
+    const char* p = s;
+    bool neg = false;
+    if (p < e && (*p == '+' || *p == '-'))
+        neg = *p++ == '-';
+
+    uint64_t w = 0;
+    int digits = 0, exp10 = 0;
+    bool any = false, truncated = false;
+    while (p < e && *p == '0') {
+        p++;
+        any = true;
+    }
+    for (; p < e && *p >= '0' && *p <= '9'; p++) {
+        if (digits < 19) {
+            w = w * 10 + (uint64_t)(*p - '0');
+            digits++;
+        } else {
+            exp10++;
+            truncated |= *p != '0';
+        }
+        any = true;
+    }
+    if (p < e && *p == '.') {
+        p++;
+        if (digits == 0)
+            for (; p < e && *p == '0'; p++) {
+                exp10--;
+                any = true;
+            }
+        for (; p < e && *p >= '0' && *p <= '9'; p++) {
+            if (digits < 19) {
+                w = w * 10 + (uint64_t)(*p - '0');
+                digits++;
+                exp10--;
+            } else {
+                truncated |= *p != '0';
+            }
+            any = true;
+        }
+    }
+    if (!any)
+        return parse_slow(s, e, out);   /* inf, nan */
+    if (p < e && (*p == 'e' || *p == 'E')) {
+        p++;
+        int sign = 1, x = 0;
+        if (p < e && (*p == '+' || *p == '-'))
+            sign = *p++ == '-' ? -1 : 1;
+        if (p == e || *p < '0' || *p > '9')
+            return false;
+        for (; p < e && *p >= '0' && *p <= '9'; p++)
+            if (x < 100000)
+                x = x * 10 + (*p - '0');
+        exp10 += sign * x;
+    }
+    if (p != e)
+        return false;
+
+    if (!truncated && w == 0) {
+        *out = neg ? -0.0 : 0.0;
+        return true;
+    }
+    if (!truncated && w <= (1ULL << 53) && exp10 >= -22 && exp10 <= 22) {
+        double d = (double)w;
+        d = exp10 < 0 ? d / POW10[-exp10] : d * POW10[exp10];
+        *out = neg ? -d : d;
+        return true;
+    }
+#ifdef __SIZEOF_INT128__
+    /* Longer mantissas, e.g. 17-digit output of csv_format: w * 10^k is
+     * exact in 128 bits; w / 10^k is a 128-bit quotient of at least 64
+     * bits with the remainder as sticky bit. Either rounds once. */
+    if (!truncated && exp10 >= 0 && exp10 <= 19) {
+        double d = (double)((u128)w * pow10_u128(exp10));
+        *out = neg ? -d : d;
+        return true;
+    }
+    if (!truncated && exp10 < 0 && exp10 >= -19) {
+        int lz = __builtin_clzll(w);
+        u128 num = (u128)(w << lz) << 64;
+        u128 den = pow10_u128(-exp10);
+        u128 q = num / den;
+        q |= num % den != 0;
+        double d = ldexp((double)q, -64 - lz);
+        *out = neg ? -d : d;
+        return true;
+    }
+#endif
+    return parse_slow(s, e, out);
+}
+
+/* strtod on a copy: the token is not NUL-terminated in the mapping */
+static bool parse_slow(const char* s, const char* e, double* out) {
+    char buf[128];
+    size_t n = (size_t)(e - s);
+    if (n == 0 || n >= sizeof(buf))
+        return false;
+    memcpy(buf, s, n);
+    buf[n] = '\0';
+    char* stop = NULL;
+    *out = strtod(buf, &stop);
+    return stop == buf + n;
+}
+
+/** snprintf("%.17g") without printf in the usual range: the 17 digits
+ * are one exact 128-bit product of the mantissa and a power of ten,
+ * shifted and rounded half to even. Zeros, huge, tiny and non-finite
+ * values go through snprintf; the output is the same either way.
+ * ----------------------------------------------------------------- */
+static int format_double(double v, char* dst) {
+#ifdef __SIZEOF_INT128__
+    uint64_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    int be = (int)(bits >> 52 & 0x7ff);
+    if (be != 0 && be != 0x7ff) {
+        uint64_t m = (bits & ((1ULL << 52) - 1)) | (1ULL << 52);
+        int e = be - 1075;                    /* |v| = m * 2^e */
+        int X = (int)(((e + 52) * 78913LL) >> 18);  /* ~floor(log10 |v|) */
+        const uint64_t lo = 10000000000000000ULL;   /* 10^16 */
+        uint64_t D = 0;
+        for (int tries = 0; tries < 3; tries++) {
+            int k = 16 - X;                   /* D = round(|v| * 10^k) */
+            if (k < 0 || k > 22 || e >= 8 || -e >= 128) {
+                D = 0;
+                break;
+            }
+            u128 P = (u128)m * pow10_u128(k);
+            if (e >= 0) {
+                D = (uint64_t)(P << e);
+            } else {
+                int s = -e;
+                u128 rem  = P & (((u128)1 << s) - 1);
+                u128 half = (u128)1 << (s - 1);
+                D = (uint64_t)(P >> s);
+                if (rem > half || (rem == half && (D & 1)))
+                    D++;
+            }
+            if (D >= 10 * lo)
+                X++;
+            else if (D < lo)
+                X--;
+            else
+                break;
+        }
+        if (D >= lo && D < 10 * lo) {
+            char digits[17];
+            for (int i = 16; i >= 0; i--) {
+                digits[i] = (char)('0' + D % 10);
+                D /= 10;
+            }
+            int nd = 17;
+            while (nd > 1 && digits[nd - 1] == '0')
+                nd--;
+
+            char* p = dst;
+            if (bits >> 63)
+                *p++ = '-';
+            if (X >= -4 && X < 17) {
+                if (X >= 0) {
+                    for (int i = 0; i <= X; i++)
+                        *p++ = digits[i];
+                    if (nd > X + 1) {
+                        *p++ = '.';
+                        for (int i = X + 1; i < nd; i++)
+                            *p++ = digits[i];
+                    }
+                } else {
+                    *p++ = '0';
+                    *p++ = '.';
+                    for (int i = 0; i < -X - 1; i++)
+                        *p++ = '0';
+                    for (int i = 0; i < nd; i++)
+                        *p++ = digits[i];
+                }
+            } else {
+                *p++ = digits[0];
+                if (nd > 1) {
+                    *p++ = '.';
+                    for (int i = 1; i < nd; i++)
+                        *p++ = digits[i];
+                }
+                *p++ = 'e';
+                *p++ = X < 0 ? '-' : '+';
+                int x = X < 0 ? -X : X;
+                if (x >= 100)
+                    *p++ = (char)('0' + x / 100);
+                *p++ = (char)('0' + x / 10 % 10);
+                *p++ = (char)('0' + x % 10);
+            }
+            return (int)(p - dst);
+        }
+    }
+#endif
+    return snprintf(dst, 32, "%.17g", v);
+}
+
+/** Pick the delimiter from the first line and map columns to fields.
+ * Returns whether the line is a header (its first field is not a number).
+ * ----------------------------------------------------------------- */
+static bool detect_layout(const char* p, const char* end, Layout* L,
+                          const char* filename) {
+    L->delim = memchr(p, ',', (size_t)(end - p))    ? ','
+             : memchr(p, '\t', (size_t)(end - p))   ? '\t'
+                                                    : ' ';
+    const char* tok[MAX_COLS][2];
+    int n = split_line(p, end, L->delim, tok);
+    double v;
+    bool header = !parse_double(tok[0][0], tok[0][1], &v);
+
+    L->n_cols = 0;
+    int seen = 0;
+    for (int c = 0; c < n; c++) {
+        int f = -1;
+        if (header) {
+            size_t len = (size_t)(tok[c][1] - tok[c][0]);
+            for (int k = 0; k < N_FIELDS && f < 0; k++)
+                if (strlen(FIELD_NAMES[k]) == len &&
+                    strncmp(tok[c][0], FIELD_NAMES[k], len) == 0)
+                    f = k;
+            if (f >= 0 && (seen & (1 << f)))
+                f = -1;   /* a repeated name keeps the first column */
+        } else if (c < N_FIELDS) {
+            f = c;
+        }
+        L->field[c] = f;
+        if (f >= 0) {
+            seen |= 1 << f;
+            L->n_cols = c + 1;   /* later columns are never looked at */
+        }
+    }
+    for (int f = 0; f < N_FIELDS - 1; f++) {
+        if (!(seen & (1 << f))) {
+            fprintf(stderr, "Error: %s has no %s column.\n", filename,
+                    FIELD_NAMES[f]);
+            exit(1);
+        }
+    }
+    L->has_brightness = (seen & (1 << (N_FIELDS - 1))) != 0;
+    return header;
+}
@@ -0,0 +1,32 @@
+#ifndef CSV_H
+#define CSV_H
+
+#include "io.h"
+#include "types.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Delimited text particles: one particle per line, fields separated by
+ * commas, tabs or runs of blanks (detected from the first line). An
+ * optional header line names the columns (x, y, mass, vx, vy and
+ * optionally brightness, in any order; other columns are ignored);
+ * without one the columns are taken in that order. Blank lines and lines
+ * starting with '#' are skipped. */
+#define CSV_HEADER   "x,y,mass,vx,vy,brightness\n"
+#define CSV_LINE_MAX 160     /* longest line csv_format emits */
+
+// Whether the first bytes of an input look like text rather than records.
+bool csv_is_text(const unsigned char* p, size_t len);
+
+// Parse len bytes of text in parallel into arrays from alloc. N = 0 takes
+// every particle line; otherwise the first N are read.
+ParticleSystem csv_parse(const char* text, size_t len, int N,
+                         const char* filename, IoAllocator alloc);
+
+// Format particles [first, first + count) as lines of 17 significant
+// digits, enough to read back exactly. dst needs count * CSV_LINE_MAX
+// bytes; returns the bytes used.
+size_t csv_format(const ParticleSystem* sys, int first, int count,
+                  char* dst);
+
+#endif
@@ -0,0 +1,115 @@
+#include "external.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define EXTERNAL_MAX_PARAMS 4
+
+static const char* const KIND_NAMES[] = { "none", "point", "plummer", "log",
+                                          "bar" };
+
+/* Parameters each kind takes, and how many of them may be left out */
+static const int N_PARAMS[]   = { 0, 2, 2, 3, 4 };
+static const int N_OPTIONAL[] = { 0, 1, 0, 1, 0 };
+
+/** The kind name, then its comma-separated parameters in the order
+ * point:gm[,eps]  plummer:gm,a  log:v0,rc[,q]  bar:v0,rc,q,omega
+ * ----------------------------------------------------------------- */
+bool external_parse(const char* spec, ExternalPotential* ext) {
+    memset(ext, 0, sizeof(*ext));
+    ext->q     = 1.0;
+    ext->cos_t = 1.0;
+
+    const char* colon = strchr(spec, ':');
+    size_t name_len = colon ? (size_t)(colon - spec) : strlen(spec);
+    int kind = -1;
+    for (int k = 0; k <= EXTERNAL_BAR; k++)
+        if (strlen(KIND_NAMES[k]) == name_len &&
+            strncmp(spec, KIND_NAMES[k], name_len) == 0)
+            kind = k;
+    if (kind < 0) {
+        fprintf(stderr, "Unknown external potential: %s\n", spec);
+        return false;
+    }
+
+    double p[EXTERNAL_MAX_PARAMS];
+    int n = 0;
+    const char* s = colon ? colon + 1 : NULL;
+    while (s) {
+        char* end;
+        if (n == EXTERNAL_MAX_PARAMS) {   /* one too many */
+            n++;
+            break;
+        }
+        p[n++] = strtod(s, &end);
+        if (end == s || (*end != ',' && *end != '\0')) {
+            n = -1;
+            break;
+        }
+        s = *end == ',' ? end + 1 : NULL;
+    }
+    if (n < N_PARAMS[kind] - N_OPTIONAL[kind] || n > N_PARAMS[kind]) {
+        fprintf(stderr, "External potential %s takes %s%d parameters: %s\n",
+                KIND_NAMES[kind], N_OPTIONAL[kind] ? "up to " : "",
+                N_PARAMS[kind], spec);
+        return false;
+    }
+
+    ext->kind = (ExternalKind)kind;
+    switch (ext->kind) {
+    case EXTERNAL_POINT:
+    case EXTERNAL_PLUMMER:
+        ext->gm    = p[0];
+        ext->scale = n > 1 ? p[1] : 0.0;
+        break;
+    case EXTERNAL_LOG:
+    case EXTERNAL_BAR:
+        ext->v0    = p[0];
+        ext->scale = p[1];
+        ext->q     = n > 2 ? p[2] : 1.0;
+        ext->omega = n > 3 ? p[3] : 0.0;
+        break;
+    default:
+        break;
+    }
+    if (ext->scale < 0.0 || ext->q <= 0.0 ||
+        (ext->kind == EXTERNAL_PLUMMER && ext->scale <= 0.0) ||
+        (ext->kind >= EXTERNAL_LOG && ext->scale <= 0.0)) {
+        fprintf(stderr, "External potential needs positive radii and axis "
+                        "ratio: %s\n", spec);
+        return false;
+    }
+    return true;
+}
+
+void external_set_time(ExternalPotential* ext, double t) {
+    if (ext->kind != EXTERNAL_BAR)
+        return;
+    ext->cos_t = cos(ext->omega * t);
+    ext->sin_t = sin(ext->omega * t);
+}
+
+void external_describe(const ExternalPotential* ext, char* out, int size) {
+    switch (ext->kind) {
+    case EXTERNAL_POINT:
+    case EXTERNAL_PLUMMER:
+        snprintf(out, (size_t)size, "%s gm=%g %s=%g at (%g, %g)",
+                 KIND_NAMES[ext->kind], ext->gm,
+                 ext->kind == EXTERNAL_POINT ? "eps" : "a", ext->scale,
+                 ext->x0, ext->y0);
+        break;
+    case EXTERNAL_LOG:
+        snprintf(out, (size_t)size, "log v0=%g rc=%g q=%g at (%g, %g)",
+                 ext->v0, ext->scale, ext->q, ext->x0, ext->y0);
+        break;
+    case EXTERNAL_BAR:
+        snprintf(out, (size_t)size,
+                 "bar v0=%g rc=%g q=%g omega=%g at (%g, %g)", ext->v0,
+                 ext->scale, ext->q, ext->omega, ext->x0, ext->y0);
+        break;
+    default:
+        snprintf(out, (size_t)size, "none");
+        break;
+    }
+}
@@ -0,0 +1,113 @@
+#ifndef EXTERNAL_H
+#define EXTERNAL_H
+
+#include <math.h>
+#include <stdbool.h>
+
+/* Fixed analytic potential that every body feels on top of the N-body
+ * forces, in simulation units, about the centre (x0, y0):
+ *   point    Phi = -gm / sqrt(r^2 + scale^2)      (scale = softening)
+ *   plummer  Phi = -gm / sqrt(r^2 + scale^2)      (scale = Plummer radius)
+ *   log      Phi = v0^2 / 2 ln(scale^2 + x^2 + y^2 / q^2)
+ *   bar      the log form in a frame turning at omega: x, y are taken
+ *            along the bar, whose long axis starts on the x axis */
+
+typedef enum {
+    EXTERNAL_NONE,
+    EXTERNAL_POINT,
+    EXTERNAL_PLUMMER,
+    EXTERNAL_LOG,
+    EXTERNAL_BAR
+} ExternalKind;
+
+typedef struct {
+    ExternalKind kind;
+    double x0, y0;        /* centre */
+    double gm;            /* point, plummer: G times the mass */
+    double scale;         /* softening, Plummer radius or core radius */
+    double v0;            /* log, bar: asymptotic circular speed */
+    double q;             /* log, bar: axis ratio of the equipotentials */
+    double omega;         /* bar: pattern speed, counter-clockwise */
+    double cos_t, sin_t;  /* bar orientation, see external_set_time */
+} ExternalPotential;
+
+// Parse KIND[:p1,p2,...] (see the usage text) into ext, centred on the
+// origin; "none" turns the potential off. Returns false on a bad spec.
+bool external_parse(const char* spec, ExternalPotential* ext);
+
+// Orient a bar for time t; call before the kicks of that time.
+void external_set_time(ExternalPotential* ext, double t);
+
+// Human-readable description for the run header.
+void external_describe(const ExternalPotential* ext, char* out, int size);
+
+/* Acceleration at (x, y), added to *ax, *ay. The kind is the same for
+ * every body of a kick, so inside a kick loop the switch is invariant. */
+static inline void external_accel(const ExternalPotential* ext, double x,
+                                  double y, double* ax, double* ay) {
+    double dx = x - ext->x0, dy = y - ext->y0;
+    switch (ext->kind) {
+    case EXTERNAL_POINT:
+    case EXTERNAL_PLUMMER: {
+        double s2 = dx * dx + dy * dy + ext->scale * ext->scale;
+        if (s2 > 0.0) {
+            double f = ext->gm / (s2 * sqrt(s2));
+            *ax -= f * dx;
+            *ay -= f * dy;
+        }
+        break;
+    }
+    case EXTERNAL_LOG: {
+        double iq2 = 1.0 / (ext->q * ext->q);
+        double f = ext->v0 * ext->v0 /
+                   (ext->scale * ext->scale + dx * dx + dy * dy * iq2);
+        *ax -= f * dx;
+        *ay -= f * dy * iq2;
+        break;
+    }
+    case EXTERNAL_BAR: {
+        /* Into the bar frame, the log form there, and back */
+        double c = ext->cos_t, s = ext->sin_t;
+        double bx = c * dx + s * dy, by = c * dy - s * dx;
+        double iq2 = 1.0 / (ext->q * ext->q);
+        double f = ext->v0 * ext->v0 /
+                   (ext->scale * ext->scale + bx * bx + by * by * iq2);
+        double gx = -f * bx, gy = -f * by * iq2;
+        *ax += c * gx - s * gy;
+        *ay += s * gx + c * gy;
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+/* Potential at (x, y), for the energy in the analysis log. With a bar
+ * that energy is not conserved; the Jacobi integral is. */
+static inline double external_potential(const ExternalPotential* ext,
+                                        double x, double y) {
+    double dx = x - ext->x0, dy = y - ext->y0;
+    switch (ext->kind) {
+    case EXTERNAL_POINT:
+    case EXTERNAL_PLUMMER: {
+        double s2 = dx * dx + dy * dy + ext->scale * ext->scale;
+        return s2 > 0.0 ? -ext->gm / sqrt(s2) : 0.0;
+    }
+    case EXTERNAL_LOG:
+    case EXTERNAL_BAR: {
+        /* The log form is symmetric under the turn but for q */
+        double bx = dx, by = dy;
+        if (ext->kind == EXTERNAL_BAR) {
+            bx = ext->cos_t * dx + ext->sin_t * dy;
+            by = ext->cos_t * dy - ext->sin_t * dx;
+        }
+        return 0.5 * ext->v0 * ext->v0 *
+               log(ext->scale * ext->scale + bx * bx +
+                   by * by / (ext->q * ext->q));
+    }
+    default:
+        return 0.0;
+    }
+}
+
+#endif
@@ -0,0 +1,267 @@
+#include "fof.h"
+#include "async_io.h"
+#include "barnes_hut.h"
+#include "time_utils.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#define LINK_GROUP 32         /* consecutive particles sharing a query */
+#define ROW_BYTES  160        /* upper bound on one catalogue row */
+
+typedef struct {
+    int    root, count;
+    double mass, x, y, vx, vy;
+} Group;
+
+static FofConfig config;
+static int       enabled   = 0;
+static double    link_len  = 0.0;
+static int*      root      = NULL;
+static int*      slot      = NULL;   /* per root: count, then group slot */
+static int       root_cap  = 0;
+static Group*    groups    = NULL;
+static int       group_cap = 0;
+static int       n_catalogues = 0;
+static long      n_listed  = 0;
+static double    find_time = 0.0;
+
+static int  find_root(int* parent, int i);
+static void unite(int* parent, int a, int b);
+static int  by_size(const void* a, const void* b);
+
+bool fof_init(const FofConfig* cfg) {
+    config   = *cfg;
+    enabled  = cfg->every_steps > 0;
+    link_len = cfg->link;
+    if (!enabled)
+        return true;
+    return async_io_start();
+}
+
+/** Link, then collect the groups of at least min_members particles in
+ * two serial passes over the roots, and queue the catalogue.
+ * ----------------------------------------------------------------- */
+void fof_step(const ParticleSystem* sys, int step) {
+    if (!enabled || step % config.every_steps != 0)
+        return;
+    double t0 = sim_time_now();
+    int N = sys->N;
+    if (link_len <= 0.0) {
+        /* Mean separation over the tree domain, fixed from here on */
+        BHState bh;
+        barnes_hut_get_state(&bh);
+        link_len = 0.2 * (bh.x_max - bh.x_min) / sqrt((double)N);
+    }
+    if (root_cap < N) {
+        free(root);
+        free(slot);
+        root = malloc((size_t)N * sizeof(int));
+        slot = malloc((size_t)N * sizeof(int));
+        if (!root || !slot) {
+            fprintf(stderr, "Error: Memory allocation failed for groups.\n");
+            exit(1);
+        }
+        root_cap = N;
+    }
+    if (!fof_link(sys, link_len, root)) {
+        fprintf(stderr, "Warning: no tree for groups at step %d.\n", step);
+        return;
+    }
+
+    memset(slot, 0, (size_t)N * sizeof(int));
+    for (int i = 0; i < N; i++)
+        slot[root[i]]++;
+    int n_groups = 0;
+    for (int i = 0; i < N; i++) {
+        if (root[i] != i) continue;
+        if (slot[i] < config.min_members) {
+            slot[i] = -1;
+            continue;
+        }
+        if (n_groups == group_cap) {
+            group_cap = group_cap ? group_cap * 2 : 1024;
+            groups = realloc(groups, (size_t)group_cap * sizeof(Group));
+            if (!groups) {
+                fprintf(stderr, "Error: Memory allocation failed for "
+                                "groups.\n");
+                exit(1);
+            }
+        }
+        Group* g = &groups[n_groups];
+        memset(g, 0, sizeof(*g));
+        g->root = i;
+        slot[i] = n_groups++;
+    }
+    for (int i = 0; i < N; i++) {
+        int s = slot[root[i]];
+        if (s < 0) continue;
+        Group* g = &groups[s];
+        double m = sys->mass[i];
+        g->count++;
+        g->mass += m;
+        g->x    += m * sys->pos_x[i];
+        g->y    += m * sys->pos_y[i];
+        g->vx   += m * sys->vx[i];
+        g->vy   += m * sys->vy[i];
+    }
+    qsort(groups, (size_t)n_groups, sizeof(Group), by_size);
+
+    StageBuffer* buf = async_io_acquire(64 + (size_t)n_groups * ROW_BYTES);
+    char* p = (char*)buf->data;
+    p += sprintf(p, "group,count,mass,x,y,vx,vy\n");
+    for (int k = 0; k < n_groups; k++) {
+        const Group* g = &groups[k];
+        double inv = g->mass > 0.0 ? 1.0 / g->mass : 0.0;
+        p += sprintf(p, "%d,%d,%.9g,%.9g,%.9g,%.9g,%.9g\n", k, g->count,
+                     g->mass, g->x * inv, g->y * inv, g->vx * inv,
+                     g->vy * inv);
+    }
+    buf->len = (size_t)(p - (char*)buf->data);
+    snprintf(buf->path, sizeof(buf->path), "data/outputs/groups_%s_%06d.csv",
+             config.label, step);
+    async_io_submit(buf);
+    n_catalogues++;
+    n_listed += n_groups;
+    find_time += sim_time_now() - t0;
+}
+
+void fof_finish(void) {
+    if (!enabled)
+        return;
+    if (n_catalogues > 0)
+        printf("Groups: data/outputs/groups_%s_*.csv | link %.3g | "
+               "%d catalogues | %.1f groups each | %.2f ms/catalogue\n",
+               config.label, link_len, n_catalogues,
+               (double)n_listed / n_catalogues,
+               find_time * 1e3 / n_catalogues);
+    free(root);
+    free(slot);
+    free(groups);
+    root = slot = NULL;
+    groups = NULL;
+    root_cap = group_cap = 0;
+}
+
+/** Z-ordered neighbours share friends, so LINK_GROUP consecutive
+ * particles make one tree query for everything within link of their
+ * bounding box, then test their own distances against that candidate
+ * list and unite with friends of higher index. Particles merged into a
+ * coincident leaf start out hung under the leaf's owner, the only one
+ * of them the tree reports. Bodies in no leaf stay alone.
+ * Unions run concurrently on a lock-free forest (see unite).
+ * ----------------------------------------------------------------- */
+bool fof_link(const ParticleSystem* sys, double link, int* parent) {
+    int N = sys->N;
+    if (!barnes_hut_leaf_owners(sys, parent))
+        return false;
+    const double* x = sys->pos_x;
+    const double* y = sys->pos_y;
+    double link2 = link * link;
+    int n_groups = (N + LINK_GROUP - 1) / LINK_GROUP;
+
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
+    {
+        int  cap = 1024;
+        int* near = malloc((size_t)cap * sizeof(int));
+        if (!near) {
+            fprintf(stderr, "Error: Memory allocation failed for groups.\n");
+            exit(1);
+        }
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic, 4)
+#endif
+        for (int g = 0; g < n_groups; g++) {
+            int lo = g * LINK_GROUP;
+            int hi = lo + LINK_GROUP < N ? lo + LINK_GROUP : N;
+            double box[4] = { x[lo], x[lo], y[lo], y[lo] };
+            for (int i = lo + 1; i < hi; i++) {
+                if (x[i] < box[0]) box[0] = x[i];
+                if (x[i] > box[1]) box[1] = x[i];
+                if (y[i] < box[2]) box[2] = y[i];
+                if (y[i] > box[3]) box[3] = y[i];
+            }
+            int n = barnes_hut_within(sys, box, link, near, cap);
+            if (n > cap) {
+                cap = n * 2;
+                free(near);
+                near = malloc((size_t)cap * sizeof(int));
+                if (!near) {
+                    fprintf(stderr, "Error: Memory allocation failed for "
+                                    "groups.\n");
+                    exit(1);
+                }
+                n = barnes_hut_within(sys, box, link, near, cap);
+            }
+            for (int i = lo; i < hi; i++) {
+                if (__atomic_load_n(&parent[i], __ATOMIC_RELAXED) < 0)
+                    continue;   /* not in the tree */
+                double px = x[i], py = y[i];
+                for (int k = 0; k < n; k++) {
+                    int j = near[k];
+                    double dx = x[j] - px, dy = y[j] - py;
+                    if (j > i && dx * dx + dy * dy <= link2)
+                        unite(parent, i, j);
+                }
+            }
+        }
+        free(near);
+    }
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+    for (int i = 0; i < N; i++)
+        parent[i] = parent[i] < 0 ? i : find_root(parent, i);
+    return true;
+}
+
+/* Root of i with path halving. Parents only ever move towards the root,
+ * so a racing halving store still leaves an ancestor in place. */
+static int find_root(int* parent, int i) {
+    int p = __atomic_load_n(&parent[i], __ATOMIC_RELAXED);
+    while (p != i) {
+        int gp = __atomic_load_n(&parent[p], __ATOMIC_RELAXED);
+        if (gp != p)
+            __atomic_store_n(&parent[i], gp, __ATOMIC_RELAXED);
+        i = p;
+        p = gp;
+    }
+    return i;
+}
+
+/* Hang the larger root under the smaller with a compare-and-swap,
+ * retrying if another thread linked either root first. The smallest
+ * index always ends up as the root, whatever the order of unions. */
+static void unite(int* parent, int a, int b) {
+    for (;;) {
+        a = find_root(parent, a);
+        b = find_root(parent, b);
+        if (a == b)
+            return;
+        if (a < b) {
+            int t = a;
+            a = b;
+            b = t;
+        }
+        int expected = a;
+        if (__atomic_compare_exchange_n(&parent[a], &expected, b, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+            return;
+    }
+}
+
+/* Largest first; ties by root index so the order is reproducible */
+static int by_size(const void* a, const void* b) {
+    const Group* ga = (const Group*)a;
+    const Group* gb = (const Group*)b;
+    if (ga->count != gb->count)
+        return ga->count > gb->count ? -1 : 1;
+    return ga->root < gb->root ? -1 : ga->root > gb->root;
+}
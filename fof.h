@@ -0,0 +1,33 @@
+#ifndef FOF_H
+#define FOF_H
+
+#include "types.h"
+#include <stdbool.h>
+
+/* Friends-of-friends groups on the Barnes-Hut tree of the step. Every
+ * due step writes data/outputs/groups_<label>_<step>.csv with one row
+ * per group of at least min_members particles, largest first:
+ * group, count, mass, x, y, vx, vy (centre of mass and its velocity). */
+
+typedef struct {
+    int         every_steps;  /* find groups every K steps, 0 = off */
+    double      link;         /* linking length, 0 = 0.2 mean separation */
+    int         min_members;  /* smallest group listed */
+    const char* label;        /* run label used in file names */
+} FofConfig;
+
+// Start the background writer if group finding is enabled.
+bool fof_init(const FofConfig* cfg);
+
+// Called after each completed step; writes a catalogue if one is due.
+void fof_step(const ParticleSystem* sys, int step);
+
+// Print the group-finder summary; main stops the shared writer afterwards.
+void fof_finish(void);
+
+// Link every pair of particles closer than link in the last in-core tree
+// of sys; root[i] becomes the smallest index in i's group, and bodies
+// outside the tree (tracers, heavy bodies, outliers) are groups of one. Returns false when no tree matches sys.
+bool fof_link(const ParticleSystem* sys, double link, int* root);
+
+#endif
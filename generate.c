@@ -0,0 +1,356 @@
+#include "io.h"
+#include "time_utils.h"
+#include "types.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/* Native counterpart of generate_data.py. Every particle draws from its
+ * own counter-based stream (seed, index, draw), so the output does not
+ * depend on the thread count or on the order particles are generated. */
+
+typedef enum { MODEL_DISK, MODEL_RANDOM, MODEL_PLUMMER, MODEL_CLUSTERED,
+               MODEL_MERGER } Model;
+
+typedef struct {
+    double center_x, center_y;
+    double radius;
+    double drift_vx, drift_vy;
+} DiskParams;
+
+typedef struct {
+    Model      model;
+    uint64_t   seed;
+    DiskParams disk;
+    int        n_clusters;
+} GenConfig;
+
+/* Disk defaults, same as generate_disk() in generate_data.py */
+static const double G_SIM        = 1.0;
+static const double CENTRAL_MASS = 100.0;
+static const double R_MIN        = 0.05;
+static const double R_SOFT       = 0.05;
+static const double MASS_MIN     = 1e-3;
+static const double MASS_MAX     = 1e-2;
+static const double V_JITTER     = 0.01;
+
+/* Merger: two disks this many radii apart along x, each closing in at
+ * MERGER_CLOSING along x with MERGER_SPEED across it, so the centres
+ * pass about 1.3 radii apart and the disks overlap */
+static const double MERGER_SEPARATION = 3.0;
+static const double MERGER_SPEED      = 1.0;
+static const double MERGER_CLOSING    = 2.0;
+
+/* Clustered: blob centres within +-CLUSTER_SPAN, blob size CLUSTER_SIGMA */
+static const double CLUSTER_SPAN  = 1.0;
+static const double CLUSTER_SIGMA = 0.05;
+
+static const char* const MODEL_NAMES[] = { "disk", "random", "plummer",
+                                            "clustered", "merger" };
+
+static void generate(ParticleSystem* sys, const GenConfig* cfg);
+static int  parse_model(const char* name, Model* model);
+
+int main(int argc, char* argv[]) {
+    GenConfig cfg;
+    cfg.model = MODEL_DISK;
+    cfg.seed  = 12345;
+    cfg.disk  = (DiskParams){ 0.0, 0.0, 10.0, 0.0, 0.0 };
+    cfg.n_clusters = 16;
+    const char* format = "gal";
+
+    /* Pull --name value options out first, as nbody_simulate does */
+    int n_pos = 1;
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--", 2) != 0 || i + 1 >= argc) {
+            argv[n_pos++] = argv[i];
+            continue;
+        }
+        const char* name  = argv[i];
+        const char* value = argv[++i];
+        char* end = NULL;
+        bool valid;
+        if (strcmp(name, "--seed") == 0) {
+            cfg.seed = strtoull(value, &end, 10);
+            valid = end != value && *end == '\0' && value[0] != '-';
+        } else if (strcmp(name, "--clusters") == 0) {
+            long k = strtol(value, &end, 10);
+            valid = end != value && *end == '\0' && k > 0 && k <= 0x7fffffffL;
+            cfg.n_clusters = (int)k;
+        } else if (strcmp(name, "--format") == 0) {
+            format = value;
+            valid = strcmp(value, "gal") == 0 || strcmp(value, "gal2") == 0 ||
+                    strcmp(value, "gal2-f32") == 0 || strcmp(value, "csv") == 0;
+#ifdef _OPENMP
+        } else if (strcmp(name, "--threads") == 0) {
+            long t = strtol(value, &end, 10);
+            valid = end != value && *end == '\0' && t > 0 && t <= 0x7fffffffL;
+            if (valid) omp_set_num_threads((int)t);
+#endif
+        } else {
+            fprintf(stderr, "Unknown option %s\n", name);
+            return 1;
+        }
+        if (!valid) {
+            fprintf(stderr, "Invalid value for %s: %s\n", name, value);
+            return 1;
+        }
+    }
+    argc = n_pos;
+
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s <N> <output.gal|-> [model] [center_x center_y radius drift_vx drift_vy] [options]\n", argv[0]);
+        fprintf(stderr, "Models: disk (default), random, plummer, clustered, merger\n");
+        fprintf(stderr, "Disk parameters also apply to each merger galaxy; for plummer, radius is the\n");
+        fprintf(stderr, "scale radius (default 1).\n");
+        fprintf(stderr, "Options: --seed S  --clusters K  --format gal|gal2|gal2-f32|csv  --threads T\n");
+        return 1;
+    }
+
+    char* end = NULL;
+    long N = strtol(argv[1], &end, 10);
+    if (end == argv[1] || *end != '\0' || N <= 0 || N > 0x7fffffffL) {
+        fprintf(stderr, "N must be a positive integer.\n");
+        return 1;
+    }
+    const char* filename = argv[2];
+    if (strcmp(filename, "-") == 0)
+        io_redirect_stdout();   /* the particles go to stdout */
+    if (argc > 3 && !parse_model(argv[3], &cfg.model)) {
+        fprintf(stderr, "Unknown model: %s\n", argv[3]);
+        return 1;
+    }
+    double* disk_args[5] = { &cfg.disk.center_x, &cfg.disk.center_y,
+                             &cfg.disk.radius, &cfg.disk.drift_vx,
+                             &cfg.disk.drift_vy };
+    if (cfg.model == MODEL_PLUMMER)
+        cfg.disk.radius = 1.0;   /* scale radius, unless given below */
+    static const char* const DISK_ARG_NAMES[5] = {
+        "center_x", "center_y", "radius", "drift_vx", "drift_vy"
+    };
+    if (argc > 9) {
+        fprintf(stderr, "Too many arguments: %s\n", argv[9]);
+        return 1;
+    }
+    for (int a = 4; a < argc; a++) {
+        double v = strtod(argv[a], &end);
+        if (end == argv[a] || *end != '\0' || !isfinite(v) ||
+            (a == 6 && v <= 0.0)) {
+            fprintf(stderr, "Invalid %s: %s%s\n", DISK_ARG_NAMES[a - 4],
+                    argv[a], a == 6 ? " (must be positive)" : "");
+            return 1;
+        }
+        *disk_args[a - 4] = v;
+    }
+
+    double t0 = sim_time_now();
+    ParticleSystem sys = io_alloc_particles((int)N);
+    generate(&sys, &cfg);
+    double t_gen = sim_time_now() - t0;
+
+    t0 = sim_time_now();
+    bool ok;
+    if (strcmp(format, "gal") == 0) {
+        ok = io_write_result(filename, &sys);
+    } else if (strcmp(format, "csv") == 0) {
+        ok = io_write_csv(filename, &sys);
+    } else {
+        GalWriteOptions wopt;
+        memset(&wopt, 0, sizeof(wopt));
+        wopt.type = strcmp(format, "gal2-f32") == 0 ? GAL_FLOAT32
+                                                    : GAL_FLOAT64;
+        ok = io_write_gal2(filename, &sys, &wopt);
+    }
+    double t_write = sim_time_now() - t0;
+
+    printf("Generated %ld particles (%s) to %s | generate %.3fs | write %.3fs\n",
+           N, MODEL_NAMES[cfg.model], filename, t_gen, t_write);
+    io_free_particles(&sys);
+    return ok ? 0 : 1;
+}
+
+static int parse_model(const char* name, Model* model) {
+    for (int m = 0; m < 5; m++) {
+        if (strcmp(name, MODEL_NAMES[m]) == 0) {
+            *model = (Model)m;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* ---------------------------------------------------------------- */
+
+/** SplitMix64 finaliser; a good 64-bit bijective mixer.
+ * ----------------------------------------------------------------- */
+static inline uint64_t mix64(uint64_t z) {
+    z += 0x9e3779b97f4a7c15ULL;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+/* Uniform [0, 1) for draw k of particle i */
+static inline double u01(uint64_t seed, uint64_t i, uint64_t k) {
+    uint64_t h = mix64(mix64(seed ^ mix64(i)) + k);
+    return (double)(h >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static inline double uniform(uint64_t seed, uint64_t i, uint64_t k,
+                             double lo, double hi) {
+    return lo + (hi - lo) * u01(seed, i, k);
+}
+
+/* Standard normal via Box-Muller from draws k and k + 1 */
+static inline double normal(uint64_t seed, uint64_t i, uint64_t k) {
+    double u1 = 1.0 - u01(seed, i, k);   /* (0, 1] */
+    double u2 = u01(seed, i, k + 1);
+    return sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+}
+
+static inline void set_particle(ParticleSystem* sys, int i, double x,
+                                double y, double m, double vx, double vy,
+                                double brightness) {
+    sys->pos_x[i] = x;
+    sys->pos_y[i] = y;
+    sys->mass[i]  = m;
+    sys->vx[i]    = vx;
+    sys->vy[i]    = vy;
+    sys->fx[i]    = 0.0;
+    sys->fy[i]    = 0.0;
+    sys->brightness[i] = brightness;
+}
+
+/** Particle j of a disk: j = 0 is the central mass, the rest orbit it on
+ * a truncated exponential profile (generate_disk in generate_data.py).
+ * ----------------------------------------------------------------- */
+static void disk_particle(ParticleSystem* sys, int i, long j,
+                          const DiskParams* d, uint64_t seed) {
+    double brightness = uniform(seed, i, 0, 0.5, 1.5);
+    if (j == 0) {
+        set_particle(sys, i, d->center_x, d->center_y, CENTRAL_MASS,
+                     d->drift_vx, d->drift_vy, brightness);
+        return;
+    }
+
+    double r_scale = d->radius > 0.0 ? d->radius / 5.0 : 1.0;
+    double theta = uniform(seed, i, 1, 0.0, 2.0 * M_PI);
+    double r = R_MIN;
+    if (d->radius > R_MIN) {
+        double z = 1.0 - exp(-(d->radius - R_MIN) / r_scale);
+        r = R_MIN - r_scale * log(1.0 - u01(seed, i, 2) * z);
+    }
+
+    double v  = sqrt(G_SIM * CENTRAL_MASS / (r + R_SOFT));
+    double vx = -v * sin(theta) * (1.0 + uniform(seed, i, 3, -V_JITTER, V_JITTER));
+    double vy =  v * cos(theta) * (1.0 + uniform(seed, i, 4, -V_JITTER, V_JITTER));
+
+    set_particle(sys, i, d->center_x + r * cos(theta),
+                 d->center_y + r * sin(theta),
+                 uniform(seed, i, 5, MASS_MIN, MASS_MAX),
+                 vx + d->drift_vx, vy + d->drift_vy, brightness);
+}
+
+/** Plummer sphere of unit total mass and scale radius a, projected onto
+ * the plane; speeds by Aarseth-Henon-Wielen rejection sampling.
+ * The outer 1% of the mass (r > ~12a) is cut off.
+ * ----------------------------------------------------------------- */
+static void plummer_particle(ParticleSystem* sys, int i,
+                             const DiskParams* d, uint64_t seed, double m) {
+    double a  = d->radius > 0.0 ? d->radius : 1.0;
+    double mu = 0.99 * (1.0 - u01(seed, i, 0));   /* (0, 0.99] */
+    double r  = a / sqrt(pow(mu, -2.0 / 3.0) - 1.0);
+
+    /* Isotropic directions; only the x and y components are kept */
+    double cz = uniform(seed, i, 1, -1.0, 1.0);
+    double ph = uniform(seed, i, 2, 0.0, 2.0 * M_PI);
+    double sz = sqrt(1.0 - cz * cz);
+    double vz = uniform(seed, i, 3, -1.0, 1.0);
+    double vp = uniform(seed, i, 4, 0.0, 2.0 * M_PI);
+    double vs = sqrt(1.0 - vz * vz);
+
+    /* Rejection draws use their own range so they never collide */
+    double q = 0.0;
+    for (uint64_t k = 100;; k += 2) {
+        q = u01(seed, i, k);
+        double g = 0.1 * u01(seed, i, k + 1);
+        if (g < q * q * pow(1.0 - q * q, 3.5))
+            break;
+    }
+    double v = q * sqrt(2.0 * G_SIM / a) * pow(1.0 + (r * r) / (a * a), -0.25);
+
+    set_particle(sys, i, d->center_x + r * sz * cos(ph),
+                 d->center_y + r * sz * sin(ph), m,
+                 d->drift_vx + v * vs * cos(vp),
+                 d->drift_vy + v * vs * sin(vp),
+                 uniform(seed, i, 5, 0.5, 1.5));
+}
+
+static void generate(ParticleSystem* sys, const GenConfig* cfg) {
+    int N = sys->N;
+    uint64_t seed = cfg->seed;
+    const DiskParams* d = &cfg->disk;
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+    for (int i = 0; i < N; i++) {
+        switch (cfg->model) {
+        case MODEL_DISK:
+            disk_particle(sys, i, i, d, seed);
+            break;
+
+        case MODEL_RANDOM:
+            set_particle(sys, i, uniform(seed, i, 0, -1.0, 1.0),
+                         uniform(seed, i, 1, -1.0, 1.0),
+                         uniform(seed, i, 2, 0.1, 10.0),
+                         uniform(seed, i, 3, -0.05, 0.05),
+                         uniform(seed, i, 4, -0.05, 0.05),
+                         uniform(seed, i, 5, 0.5, 1.5));
+            break;
+
+        case MODEL_PLUMMER:
+            plummer_particle(sys, i, d, seed, 1.0 / N);
+            break;
+
+        case MODEL_CLUSTERED: {
+            /* Blob c's centre and bulk velocity come from stream -1 - c,
+             * so every member agrees on them without coordination. */
+            uint64_t c = (uint64_t)(u01(seed, i, 0) * cfg->n_clusters);
+            uint64_t cs = ~c;
+            double cx = uniform(seed, cs, 0, -CLUSTER_SPAN, CLUSTER_SPAN);
+            double cy = uniform(seed, cs, 1, -CLUSTER_SPAN, CLUSTER_SPAN);
+            double cvx = uniform(seed, cs, 2, -0.05, 0.05);
+            double cvy = uniform(seed, cs, 3, -0.05, 0.05);
+            set_particle(sys, i, cx + CLUSTER_SIGMA * normal(seed, i, 1),
+                         cy + CLUSTER_SIGMA * normal(seed, i, 3),
+                         uniform(seed, i, 5, 0.1, 10.0),
+                         cvx + 0.01 * normal(seed, i, 6),
+                         cvy + 0.01 * normal(seed, i, 8),
+                         uniform(seed, i, 10, 0.5, 1.5));
+            break;
+        }
+
+        case MODEL_MERGER: {
+            /* First half is galaxy A, second half galaxy B, each with its
+             * own central mass, offset along x and heading for the other
+             * on a closing, slightly off-centre course. */
+            int  half   = (N + 1) / 2;
+            int  second = i >= half;
+            long j      = second ? i - half : i;
+            double off  = 0.5 * MERGER_SEPARATION * d->radius;
+            DiskParams g = *d;
+            g.center_x += second ? off : -off;
+            g.drift_vx += second ? -MERGER_CLOSING : MERGER_CLOSING;
+            g.drift_vy += second ? -MERGER_SPEED : MERGER_SPEED;
+            disk_particle(sys, i, j, &g, seed);
+            break;
+        }
+        }
+    }
+}
@@ -0,0 +1,109 @@
+#include "ids.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void ids_init(ParticleSystem* sys) {
+    int N = sys->N;
+    if (!sys->id)
+        sys->id = malloc((size_t)N * sizeof(ParticleId));
+    if (!sys->index_of)
+        sys->index_of = malloc((size_t)N * sizeof(int));
+    if (!sys->id || !sys->index_of) {
+        fprintf(stderr, "Error: Memory allocation failed for particle ids.\n");
+        exit(1);
+    }
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+    for (int i = 0; i < N; i++) {
+        sys->id[i]       = (ParticleId)i;
+        sys->index_of[i] = i;
+    }
+}
+
+/** Scatter i into index_of[id[i]] in parallel, then check that every
+ * id got its own slot back; a duplicate loses to another write.
+ * ----------------------------------------------------------------- */
+bool ids_adopt(ParticleSystem* sys) {
+    int N = sys->N;
+    if (!sys->index_of)
+        sys->index_of = malloc((size_t)N * sizeof(int));
+    if (!sys->index_of) {
+        fprintf(stderr, "Error: Memory allocation failed for particle ids.\n");
+        exit(1);
+    }
+    int valid = 1;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) reduction(&& : valid)
+#endif
+    for (int i = 0; i < N; i++) {
+        if (sys->id[i] < (ParticleId)N)
+            sys->index_of[sys->id[i]] = i;
+        else
+            valid = 0;
+    }
+    if (valid) {
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) reduction(&& : valid)
+#endif
+        for (int i = 0; i < N; i++)
+            valid = valid && sys->index_of[sys->id[i]] == i;
+    }
+    return valid;
+}
+
+/** Gather the ids into the new order and scatter the inverse in the same
+ * pass; ids are distinct, so the scattered writes never collide.
+ * ----------------------------------------------------------------- */
+bool ids_permute(ParticleSystem* sys, const int* order) {
+    if (!sys->id)
+        return true;
+    int N = sys->N;
+    ParticleId* tmp = malloc((size_t)N * sizeof(ParticleId));
+    if (!tmp) {
+        fprintf(stderr, "Memory allocation failed for id reorder buffer.\n");
+        return false;
+    }
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+    for (int i = 0; i < N; i++) {
+        ParticleId id = sys->id[order[i]];
+        tmp[i] = id;
+        sys->index_of[id] = i;
+    }
+    memcpy(sys->id, tmp, (size_t)N * sizeof(ParticleId));
+    free(tmp);
+    return true;
+}
+
+bool ids_restore_order(ParticleSystem* sys) {
+    if (!sys->id)
+        return true;
+    int N = sys->N;
+    double* tmp = malloc((size_t)N * sizeof(double));
+    if (!tmp) {
+        fprintf(stderr, "Memory allocation failed for id reorder buffer.\n");
+        return false;
+    }
+    double* arrays[8] = { sys->pos_x, sys->pos_y, sys->mass, sys->vx,
+                          sys->vy, sys->fx, sys->fy, sys->brightness };
+    for (int a = 0; a < 8; a++) {
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+        for (int i = 0; i < N; i++)
+            tmp[sys->id[i]] = arrays[a][i];
+        memcpy(arrays[a], tmp, (size_t)N * sizeof(double));
+    }
+    free(tmp);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+    for (int i = 0; i < N; i++) {
+        sys->id[i]       = (ParticleId)i;
+        sys->index_of[i] = i;
+    }
+    return true;
+}
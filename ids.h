@@ -0,0 +1,35 @@
+#ifndef IDS_H
+#define IDS_H
+
+#include "types.h"
+#include <stdbool.h>
+
+/* Persistent particle ids: particle i of the first input gets id i, and
+ * files that carry ids (.gal v2, checkpoints) pass them on. The
+ * reorderings (z_order_sort, the k-means reorder) carry sys->id along
+ * and keep sys->index_of, the inverse, up to date, so finding a particle
+ * by id costs one lookup however often the arrays were permuted. Ids
+ * always number the particles 0..N-1. */
+
+// Number the particles 0..N-1 in their current order and build the
+// inverse map.
+void ids_init(ParticleSystem* sys);
+
+// Build index_of for ids loaded from a file; false unless they are a
+// permutation of 0..N-1.
+bool ids_adopt(ParticleSystem* sys);
+
+// Apply a reordering (order[new] = old index) to the ids and refresh
+// index_of. A no-op when the system keeps no ids.
+bool ids_permute(ParticleSystem* sys, const int* order);
+
+// Scatter every array back into id order, i.e. the order of the first
+// input; afterwards id[i] == i.
+bool ids_restore_order(ParticleSystem* sys);
+
+// Current index of particle id, or -1 if the system has no such id.
+static inline int ids_index(const ParticleSystem* sys, ParticleId id) {
+    return sys->index_of && id < (ParticleId)sys->N ? sys->index_of[id] : -1;
+}
+
+#endif
@@ -1,68 +1,461 @@
 #include "io.h"
+#include "csv.h"
+#include "ids.h"
+#include "ntc.h"
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
-ParticleSystem io_read_particles(const char* filename, int N) {
-    ParticleSystem sys;
-    sys.N = N;
-    sys.pos_x = malloc(N * sizeof(double));
-    sys.pos_y = malloc(N * sizeof(double));
-    sys.mass = malloc(N * sizeof(double));
-    sys.vx = malloc(N * sizeof(double));
-    sys.vy = malloc(N * sizeof(double));
-    sys.fx = malloc(N * sizeof(double));
-    sys.fy = malloc(N * sizeof(double));
+/* On-disk record: x, y, mass, vx, vy, brightness (6 native doubles) */
+#define RECORD_BYTES IO_RECORD_BYTES
 
-    if (!sys.pos_x || !sys.pos_y || !sys.mass || !sys.vx || !sys.vy ||
-        !sys.fx || !sys.fy) {
-        fprintf(stderr, "Error: Memory allocation failed for %d particles.\n",
-                N);
+/* Records per read() when the input cannot be mapped */
+#define READ_BLOCK_RECORDS (1 << 16)
+
+/* Field order of legacy records, also used for v2 column order; a v2
+ * file may add the integer id column after them */
+#define N_FIELDS 6
+#define ID_FIELD N_FIELDS
+static const char* const FIELD_NAMES[N_FIELDS + 1] = {
+    "x", "y", "mass", "vx", "vy", "brightness", "id"
+};
+#define ID_TYPE (sizeof(ParticleId) == 8 ? GAL_UINT64 : GAL_UINT32)
+
+/* Records per pwrite(); each writer owns one aligned buffer this size */
+#define WRITE_BLOCK_RECORDS (1 << 16)
+#define WRITE_ALIGN         4096
+
+/* Particles per thread and round when writing text */
+#define CSV_BLOCK_RECORDS (1 << 14)
+
+static void decode_records(ParticleSystem* sys, const unsigned char* src,
+                           int first, int count);
+static ParticleSystem read_gal2(const unsigned char* base, size_t bytes,
+                                int N, const char* filename, GalInfo* info,
+                                IoAllocator alloc);
+static ParticleSystem read_ntc(const unsigned char* base, size_t bytes,
+                               int N, const char* filename, GalInfo* info,
+                               IoAllocator alloc);
+static int  parse_gal2_header(GalHeader* h, uint64_t bytes, int N,
+                              const char* filename,
+                              const GalField* cols[N_FIELDS + 1]);
+static void finish_gal2(ParticleSystem* sys, const GalHeader* h,
+                        const GalField* const cols[N_FIELDS + 1],
+                        GalInfo* info);
+static ParticleSystem read_stream(int fd, int N, const char* filename,
+                                  GalInfo* info, IoAllocator alloc);
+static ParticleSystem read_gal2_stream(int fd, GalHeader* h, int N,
+                                       const char* filename, GalInfo* info,
+                                       IoAllocator alloc);
+static ParticleSystem read_records_stream(int fd, const unsigned char* prefix,
+                                          size_t prefix_len, int N,
+                                          const char* filename,
+                                          IoAllocator alloc);
+static size_t read_full(int fd, void* buf, size_t len, const char* filename);
+static unsigned char* read_all(int fd, const unsigned char* prefix,
+                               size_t prefix_len, size_t* len,
+                               const char* filename);
+static void decode_column(const unsigned char* src, uint32_t type, int swap,
+                          double* dst, int N);
+static void encode_column(const double* src, uint32_t type,
+                          unsigned char* dst, int count);
+static void decode_ids(const unsigned char* src, uint32_t type, int swap,
+                       ParticleId* dst, int N);
+static ParticleId* alloc_ids(int N);
+static double* field_array(const ParticleSystem* sys, int field);
+static void pack_range(const ParticleSystem* sys, int first, int count,
+                       unsigned char* dst);
+static bool pwrite_full(int fd, const unsigned char* buf, size_t len,
+                        off_t offset);
+static bool write_full(int fd, const unsigned char* buf, size_t len);
+static size_t fill_gal2_header(GalHeader* h, int N,
+                               const char* const* names, int n_fields,
+                               const GalWriteOptions* opt);
+static int  open_output(const char* filename, bool* stream);
+static bool close_output(int fd);
+static bool write_records_stream(int fd, const ParticleSystem* sys);
+static bool write_gal2_stream(int fd, const ParticleSystem* sys,
+                              const GalHeader* h, size_t column_span);
+
+/* Where "-" writes; io_redirect_stdout moves it off the console stream */
+static int stdout_fd = STDOUT_FILENO;
+
+ParticleSystem io_read_particles(const char* filename, int N, GalInfo* info) {
+    return io_read_particles_with(filename, N, info, io_alloc_particles);
+}
+
+ParticleSystem io_read_particles_with(const char* filename, int N,
+                                      GalInfo* info, IoAllocator alloc) {
+    GalInfo local;
+    if (!info)
+        info = &local;
+    memset(info, 0, sizeof(*info));
+    info->version = 1;
+
+    int fd = strcmp(filename, "-") == 0 ? STDIN_FILENO
+                                        : open(filename, O_RDONLY);
+    if (fd < 0) {
+        perror("Error opening input file");
         exit(1);
     }
 
-    FILE* f = fopen(filename, "rb");
-    if (!f) {
-        perror("Error opening input file");
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        perror("Error reading input file size");
         exit(1);
     }
 
-    for (int i = 0; i < N; i++) {
-        double x, y, m, vx, vy;
-        if (fread(&x, sizeof(double), 1, f) != 1 || fread(&y, sizeof(double), 1, f) != 1 ||
-            fread(&m, sizeof(double), 1, f) != 1 || fread(&vx, sizeof(double), 1, f) != 1 ||
-            fread(&vy, sizeof(double), 1, f) != 1) {
-            fprintf(stderr, "Error: Unexpected end of file at particle %d\n",
-                    i);
-            exit(1);
-        }
-        fseek(f, 8, SEEK_CUR);
+    /* Map the whole file and split it straight into the SoA arrays.
+     * Pipes, stdin and other unmappable inputs are read sequentially in
+     * large blocks instead. */
+    size_t file_bytes = S_ISREG(st.st_mode) ? (size_t)st.st_size : 0;
+    void* map = MAP_FAILED;
+    if (file_bytes > 0)
+        map = mmap(NULL, file_bytes, PROT_READ, MAP_PRIVATE, fd, 0);
 
-        sys.pos_x[i] = x;
-        sys.pos_y[i] = y;
-        sys.mass[i] = m;
-        sys.vx[i] = vx;
-        sys.vy[i] = vy;
-        sys.fx[i] = 0.0;
-        sys.fy[i] = 0.0;
+    ParticleSystem sys;
+    if (map != MAP_FAILED) {
+        madvise(map, file_bytes, MADV_WILLNEED);
+        const unsigned char* base = (const unsigned char*)map;
+        if (file_bytes >= sizeof(GalHeader) &&
+            memcmp(base, GAL2_MAGIC, 8) == 0) {
+            sys = read_gal2(base, file_bytes, N, filename, info, alloc);
+        } else if (file_bytes >= sizeof(NtcFileHeader) &&
+                   memcmp(base, NTC_FILE_MAGIC, 8) == 0) {
+            sys = read_ntc(base, file_bytes, N, filename, info, alloc);
+        } else if (csv_is_text(base, file_bytes)) {
+            sys = csv_parse((const char*)base, file_bytes, N, filename,
+                            alloc);
+            info->version = 0;
+        } else {
+            if (N == 0) {
+                if (file_bytes % RECORD_BYTES != 0) {
+                    fprintf(stderr, "Error: %s is not a whole number of "
+                                    "records; pass N explicitly.\n", filename);
+                    exit(1);
+                }
+                N = (int)(file_bytes / RECORD_BYTES);
+            }
+            if (file_bytes < (size_t)N * RECORD_BYTES) {
+                fprintf(stderr,
+                        "Error: %s holds %lld particles, expected %d\n",
+                        filename, (long long)(file_bytes / RECORD_BYTES), N);
+                exit(1);
+            }
+            sys = alloc(N);
+            decode_records(&sys, base, 0, N);
+        }
+        munmap(map, file_bytes);
+    } else {
+        sys = read_stream(fd, N, filename, info, alloc);
     }
 
-    fclose(f);
+    if (fd != STDIN_FILENO)
+        close(fd);
     return sys;
 }
 
-void io_write_result(const char* filename, ParticleSystem* sys) {
-    FILE* f = fopen(filename, "wb");
-    if (!f)
-        return;
+bool io_write_result(const char* filename, const ParticleSystem* sys) {
+    bool stream;
+    int fd = open_output(filename, &stream);
+    if (fd < 0)
+        return false;
+
+    int n_writers = 1;
+#ifdef _OPENMP
+    n_writers = omp_get_max_threads();
+#endif
+    bool ok = stream ? write_records_stream(fd, sys)
+                     : io_write_records(fd, 0, sys, n_writers);
+    if (!close_output(fd))
+        ok = false;
+    if (!ok)
+        fprintf(stderr, "Error: failed to write %s\n", filename);
+    return ok;
+}
+
+void io_pack_records(const ParticleSystem* sys, int first, int count,
+                     unsigned char* dst) {
+    int chunk = 4096;
+    int n_chunks = (count + chunk - 1) / chunk;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+    for (int c = 0; c < n_chunks; c++) {
+        int off = c * chunk;
+        int n   = count - off < chunk ? count - off : chunk;
+        pack_range(sys, first + off, n, dst + (size_t)off * RECORD_BYTES);
+    }
+}
+
+/** Write N records starting at offset in WRITE_BLOCK_RECORDS pieces.
+ * With one writer each block is packed in parallel and written by the
+ * caller; with several, every thread packs and pwrites its own blocks
+ * at disjoint offsets.
+ * ----------------------------------------------------------------- */
+bool io_write_records(int fd, off_t offset, const ParticleSystem* sys,
+                      int n_writers) {
+    int N = sys->N;
+    int n_blocks = (N + WRITE_BLOCK_RECORDS - 1) / WRITE_BLOCK_RECORDS;
+    size_t buf_bytes = (size_t)WRITE_BLOCK_RECORDS * RECORD_BYTES;
+    bool ok = true;
+
+    if (n_writers <= 1 || n_blocks <= 1) {
+        unsigned char* buf = NULL;
+        if (posix_memalign((void**)&buf, WRITE_ALIGN, buf_bytes) != 0)
+            return false;
+        for (int b = 0; b < n_blocks && ok; b++) {
+            int first = b * WRITE_BLOCK_RECORDS;
+            int count = N - first < WRITE_BLOCK_RECORDS ? N - first
+                                                        : WRITE_BLOCK_RECORDS;
+            io_pack_records(sys, first, count, buf);
+            ok = pwrite_full(fd, buf, (size_t)count * RECORD_BYTES,
+                             offset + (off_t)first * RECORD_BYTES);
+        }
+        free(buf);
+        return ok;
+    }
+
+#ifdef _OPENMP
+#pragma omp parallel num_threads(n_writers) reduction(&& : ok)
+#endif
+    {
+        unsigned char* buf = NULL;
+        if (posix_memalign((void**)&buf, WRITE_ALIGN, buf_bytes) != 0)
+            buf = NULL;
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+        for (int b = 0; b < n_blocks; b++) {
+            int first = b * WRITE_BLOCK_RECORDS;
+            int count = N - first < WRITE_BLOCK_RECORDS ? N - first
+                                                        : WRITE_BLOCK_RECORDS;
+            if (!buf) {
+                ok = false;
+                continue;
+            }
+            pack_range(sys, first, count, buf);
+            if (!pwrite_full(fd, buf, (size_t)count * RECORD_BYTES,
+                             offset + (off_t)first * RECORD_BYTES))
+                ok = false;
+        }
+        free(buf);
+    }
+    return ok;
+}
+
+/** Write a .gal v2 file: header, then each column in WRITE_BLOCK_RECORDS
+ * pieces, packed and pwritten by all threads at disjoint offsets.
+ * ----------------------------------------------------------------- */
+bool io_write_gal2(const char* filename, const ParticleSystem* sys,
+                   const GalWriteOptions* opt) {
+    int N = sys->N;
+    size_t elem = GAL_TYPE_BYTES(opt->type);
+
+    unsigned char* head = NULL;
+    if (posix_memalign((void**)&head, WRITE_ALIGN, GAL2_ALIGN) != 0)
+        return false;
+    memset(head, 0, GAL2_ALIGN);
+
+    GalHeader h;
+    size_t column_span = fill_gal2_header(&h, N, FIELD_NAMES,
+                                          sys->id ? N_FIELDS + 1 : N_FIELDS,
+                                          opt);
+    if (sys->id)
+        h.fields[ID_FIELD].type = ID_TYPE;
+    memcpy(head, &h, sizeof(h));
+
+    bool stream;
+    int fd = open_output(filename, &stream);
+    if (fd < 0) {
+        free(head);
+        return false;
+    }
+    if (stream) {
+        bool ok = write_full(fd, head, GAL2_ALIGN) &&
+                  write_gal2_stream(fd, sys, &h, column_span);
+        free(head);
+        if (!close_output(fd))
+            ok = false;
+        if (!ok)
+            fprintf(stderr, "Error: failed to write %s\n", filename);
+        return ok;
+    }
+    bool ok = pwrite_full(fd, head, GAL2_ALIGN, 0);
+    free(head);
+
+    int n_blocks = (N + WRITE_BLOCK_RECORDS - 1) / WRITE_BLOCK_RECORDS;
+#ifdef _OPENMP
+#pragma omp parallel reduction(&& : ok)
+#endif
+    {
+        unsigned char* buf = NULL;
+        if (posix_memalign((void**)&buf, WRITE_ALIGN,
+                           (size_t)WRITE_BLOCK_RECORDS * elem) != 0)
+            buf = NULL;
+#ifdef _OPENMP
+#pragma omp for collapse(2) schedule(static)
+#endif
+        for (int f = 0; f < N_FIELDS; f++) {
+            for (int b = 0; b < n_blocks; b++) {
+                int first = b * WRITE_BLOCK_RECORDS;
+                int count = N - first < WRITE_BLOCK_RECORDS
+                                ? N - first : WRITE_BLOCK_RECORDS;
+                if (!buf) {
+                    ok = false;
+                    continue;
+                }
+                encode_column(field_array(sys, f) + first, opt->type, buf,
+                              count);
+                if (!pwrite_full(fd, buf, (size_t)count * elem,
+                                 (off_t)h.fields[f].offset +
+                                     (off_t)first * (off_t)elem))
+                    ok = false;
+            }
+        }
+        free(buf);
+        /* Ids are written as they are, in native byte order */
+        if (sys->id) {
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+            for (int b = 0; b < n_blocks; b++) {
+                int first = b * WRITE_BLOCK_RECORDS;
+                int count = N - first < WRITE_BLOCK_RECORDS
+                                ? N - first : WRITE_BLOCK_RECORDS;
+                if (!pwrite_full(fd, (const unsigned char*)(sys->id + first),
+                                 (size_t)count * sizeof(ParticleId),
+                                 (off_t)h.fields[ID_FIELD].offset +
+                                     (off_t)first * (off_t)sizeof(ParticleId)))
+                    ok = false;
+            }
+        }
+    }
+
+    if (!close_output(fd))
+        ok = false;
+    if (!ok)
+        fprintf(stderr, "Error: failed to write %s\n", filename);
+    return ok;
+}
+
+/** Write delimited text. Rounds of one CSV_BLOCK_RECORDS block per
+ * thread are formatted in parallel; the block lengths then give each
+ * thread its pwrite offset, or the blocks go to a pipe in order.
+ * ----------------------------------------------------------------- */
+bool io_write_csv(const char* filename, const ParticleSystem* sys) {
+    bool stream;
+    int fd = open_output(filename, &stream);
+    if (fd < 0)
+        return false;
+
+    int T = 1;
+#ifdef _OPENMP
+    T = omp_get_max_threads();
+#endif
+    char**  bufs = calloc((size_t)T, sizeof(*bufs));
+    size_t* lens = calloc((size_t)T, sizeof(*lens));
+    off_t*  offs = calloc((size_t)T, sizeof(*offs));
+    bool ok = bufs && lens && offs;
+    for (int t = 0; ok && t < T; t++) {
+        bufs[t] = malloc((size_t)CSV_BLOCK_RECORDS * CSV_LINE_MAX);
+        ok = bufs[t] != NULL;
+    }
+
+    off_t pos = (off_t)strlen(CSV_HEADER);
+    if (ok)
+        ok = stream ? write_full(fd, (const unsigned char*)CSV_HEADER,
+                                 (size_t)pos)
+                    : pwrite_full(fd, (const unsigned char*)CSV_HEADER,
+                                  (size_t)pos, 0);
+
+    int N = sys->N;
+    for (int base = 0; ok && base < N; base += T * CSV_BLOCK_RECORDS) {
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(T) schedule(static, 1)
+#endif
+        for (int t = 0; t < T; t++) {
+            long long first = base + (long long)t * CSV_BLOCK_RECORDS;
+            int count = first >= N ? 0
+                      : N - first < CSV_BLOCK_RECORDS ? (int)(N - first)
+                                                      : CSV_BLOCK_RECORDS;
+            lens[t] = count ? csv_format(sys, (int)first, count, bufs[t])
+                            : 0;
+        }
+        for (int t = 0; t < T; t++) {
+            offs[t] = pos;
+            pos += (off_t)lens[t];
+        }
+        if (stream) {
+            for (int t = 0; ok && t < T; t++)
+                ok = write_full(fd, (const unsigned char*)bufs[t], lens[t]);
+            continue;
+        }
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(T) schedule(static, 1) reduction(&& : ok)
+#endif
+        for (int t = 0; t < T; t++)
+            if (!pwrite_full(fd, (const unsigned char*)bufs[t], lens[t],
+                             offs[t]))
+                ok = false;
+    }
+
+    for (int t = 0; bufs && t < T; t++)
+        free(bufs[t]);
+    free(bufs);
+    free(lens);
+    free(offs);
+    if (!close_output(fd))
+        ok = false;
+    if (!ok)
+        fprintf(stderr, "Error: failed to write %s\n", filename);
+    return ok;
+}
+
+size_t io_gal2_bytes(int N, int n_cols, GalType type) {
+    size_t elem = GAL_TYPE_BYTES(type);
+    size_t span = ((size_t)N * elem + GAL2_ALIGN - 1) / GAL2_ALIGN *
+                  GAL2_ALIGN;
+    return GAL2_ALIGN + (size_t)(n_cols - 1) * span + (size_t)N * elem;
+}
 
-    for (int i = 0; i < sys->N; i++) {
-        fwrite(&sys->pos_x[i], sizeof(double), 1, f);
-        fwrite(&sys->pos_y[i], sizeof(double), 1, f);
-        fwrite(&sys->mass[i], sizeof(double), 1, f);
-        fwrite(&sys->vx[i], sizeof(double), 1, f);
-        fwrite(&sys->vy[i], sizeof(double), 1, f);
+/** A v2 file image in memory, laid out exactly as io_write_gal2 writes
+ * one, for callers that stage files for the background writer.
+ * ----------------------------------------------------------------- */
+void io_pack_gal2(unsigned char* dst, int N, const GalColumn* cols,
+                  int n_cols, const GalWriteOptions* opt) {
+    const char* names[GAL2_MAX_FIELDS] = { NULL };
+    for (int f = 0; f < n_cols; f++)
+        names[f] = cols[f].name;
+    GalHeader h;
+    size_t column_span = fill_gal2_header(&h, N, names, n_cols, opt);
+
+    memset(dst, 0, io_gal2_bytes(N, n_cols, opt->type));
+    memcpy(dst, &h, sizeof(h));
+    for (int f = 0; f < n_cols; f++)
+        encode_column(cols[f].data, (uint32_t)opt->type,
+                      dst + GAL2_ALIGN + (size_t)f * column_span, N);
+}
+
+/** Keep stdout for particle data only: console output from here on goes
+ * to stderr, and "-" writes to a duplicate of the original stdout.
+ * ----------------------------------------------------------------- */
+void io_redirect_stdout(void) {
+    fflush(stdout);
+    int fd = dup(STDOUT_FILENO);
+    if (fd < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+        perror("Error redirecting stdout");
+        exit(1);
     }
-    fclose(f);
+    stdout_fd = fd;
 }
 
 void io_free_particles(ParticleSystem* sys) {
@@ -73,4 +466,672 @@ void io_free_particles(ParticleSystem* sys) {
     free(sys->vy);
     free(sys->fx);
     free(sys->fy);
+    free(sys->brightness);
+    free(sys->id);
+    free(sys->index_of);
+}
+
+/** Allocate the SoA arrays without touching them.
+ * Loaders write the pages first from a static parallel loop, so they
+ * land on the NUMA node of the thread that will later own that range.
+ * ----------------------------------------------------------------- */
+ParticleSystem io_alloc_particles(int N) {
+    ParticleSystem sys;
+    sys.N = N;
+    sys.pos_x = malloc((size_t)N * sizeof(double));
+    sys.pos_y = malloc((size_t)N * sizeof(double));
+    sys.mass = malloc((size_t)N * sizeof(double));
+    sys.vx = malloc((size_t)N * sizeof(double));
+    sys.vy = malloc((size_t)N * sizeof(double));
+    sys.fx = malloc((size_t)N * sizeof(double));
+    sys.fy = malloc((size_t)N * sizeof(double));
+    sys.brightness = malloc((size_t)N * sizeof(double));
+    sys.id = NULL;
+    sys.index_of = NULL;
+
+    if (!sys.pos_x || !sys.pos_y || !sys.mass || !sys.vx || !sys.vy ||
+        !sys.fx || !sys.fy || !sys.brightness) {
+        fprintf(stderr, "Error: Memory allocation failed for %d particles.\n",
+                N);
+        exit(1);
+    }
+    return sys;
+}
+
+/** Split count packed records into particles [first, first + count).
+ * Static scheduling matches the integrator loops in main.c, so each
+ * thread first-touches the slice of every array it later updates.
+ * ----------------------------------------------------------------- */
+static void decode_records(ParticleSystem* sys, const unsigned char* src,
+                           int first, int count) {
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+    for (int r = 0; r < count; r++) {
+        const unsigned char* rec = src + (size_t)r * RECORD_BYTES;
+        int i = first + r;
+        memcpy(&sys->pos_x[i], rec + 0 * sizeof(double), sizeof(double));
+        memcpy(&sys->pos_y[i], rec + 1 * sizeof(double), sizeof(double));
+        memcpy(&sys->mass[i],  rec + 2 * sizeof(double), sizeof(double));
+        memcpy(&sys->vx[i],    rec + 3 * sizeof(double), sizeof(double));
+        memcpy(&sys->vy[i],    rec + 4 * sizeof(double), sizeof(double));
+        memcpy(&sys->brightness[i], rec + 5 * sizeof(double),
+               sizeof(double));
+        sys->fx[i] = 0.0;
+        sys->fy[i] = 0.0;
+    }
+}
+
+/** Decode a mapped .gal v2 file.
+ * Only the known columns are touched, each in one static parallel pass;
+ * a missing brightness column defaults to 1.
+ * ----------------------------------------------------------------- */
+static ParticleSystem read_gal2(const unsigned char* base, size_t bytes,
+                                int N, const char* filename, GalInfo* info,
+                                IoAllocator alloc) {
+    GalHeader h;
+    memcpy(&h, base, sizeof(h));
+    const GalField* cols[N_FIELDS + 1] = { NULL };
+    int swap = parse_gal2_header(&h, bytes, N, filename, cols);
+    N = (int)h.N;
+
+    ParticleSystem sys = alloc(N);
+    for (int f = 0; f < N_FIELDS; f++)
+        if (cols[f])
+            decode_column(base + cols[f]->offset, cols[f]->type, swap,
+                          field_array(&sys, f), N);
+    if (cols[ID_FIELD]) {
+        sys.id = alloc_ids(N);
+        decode_ids(base + cols[ID_FIELD]->offset, cols[ID_FIELD]->type, swap,
+                   sys.id, N);
+    }
+    finish_gal2(&sys, &h, cols, info);
+    return sys;
+}
+
+/** Load the last frame of a .ntc container, e.g. an indexed snapshot.
+ * Its records are contiguous after the chunk table and in Z-order of the
+ * frame's key box, which is reported like a Morton-flagged v2 file.
+ * ----------------------------------------------------------------- */
+static ParticleSystem read_ntc(const unsigned char* base, size_t bytes,
+                               int N, const char* filename, GalInfo* info,
+                               IoAllocator alloc) {
+    NtcFileHeader fh;
+    memcpy(&fh, base, sizeof(fh));
+    NtcIndexEntry last;
+    NtcFrameHeader h;
+    if (fh.version != NTC_VERSION || fh.index_offset == 0 ||
+        fh.n_frames == 0 ||
+        fh.index_offset + fh.n_frames * sizeof(last) > bytes) {
+        fprintf(stderr, "Error: %s: no finished .ntc index to load a frame "
+                        "from.\n", filename);
+        exit(1);
+    }
+    memcpy(&last, base + fh.index_offset + (fh.n_frames - 1) * sizeof(last),
+           sizeof(last));
+    if (last.offset + sizeof(h) > bytes ||
+        (memcpy(&h, base + last.offset, sizeof(h)), h.N != last.N) ||
+        last.offset + ntc_frame_bytes(h.N) > bytes) {
+        fprintf(stderr, "Error: %s: corrupt .ntc frame.\n", filename);
+        exit(1);
+    }
+    if (N != 0 && N != h.N) {
+        fprintf(stderr, "Error: %s holds %d particles, expected %d\n",
+                filename, h.N, N);
+        exit(1);
+    }
+
+    ParticleSystem sys = alloc(h.N);
+    decode_records(&sys, base + last.offset + sizeof(h) +
+                             (size_t)h.n_chunks * sizeof(NtcChunk),
+                   0, h.N);
+    info->version       = 3;
+    info->morton_sorted = 1;
+    info->has_bbox      = 1;
+    memcpy(info->bbox, h.key_box, sizeof(info->bbox));
+    return sys;
+}
+
+/** Byte-swap a foreign header in place, check it against N and a file of
+ * the given size (UINT64_MAX for a stream) and find the known columns.
+ * Returns whether the column data needs swapping too.
+ * ----------------------------------------------------------------- */
+static int parse_gal2_header(GalHeader* h, uint64_t bytes, int N,
+                             const char* filename,
+                             const GalField* cols[N_FIELDS + 1]) {
+    int swap = 0;
+    if (h->endian == __builtin_bswap32(GAL2_ENDIAN_TAG)) {
+        swap = 1;
+        h->version  = __builtin_bswap32(h->version);
+        h->N        = __builtin_bswap64(h->N);
+        h->n_fields = __builtin_bswap32(h->n_fields);
+        h->flags    = __builtin_bswap32(h->flags);
+        for (int i = 0; i < 4; i++) {
+            uint64_t u;
+            memcpy(&u, &h->bbox[i], sizeof(u));
+            u = __builtin_bswap64(u);
+            memcpy(&h->bbox[i], &u, sizeof(u));
+        }
+        for (int f = 0; f < GAL2_MAX_FIELDS; f++) {
+            h->fields[f].type   = __builtin_bswap32(h->fields[f].type);
+            h->fields[f].offset = __builtin_bswap64(h->fields[f].offset);
+        }
+    } else if (h->endian != GAL2_ENDIAN_TAG) {
+        fprintf(stderr, "Error: %s has an unknown byte order.\n", filename);
+        exit(1);
+    }
+
+    if (h->version > GAL2_VERSION || h->n_fields > GAL2_MAX_FIELDS ||
+        h->N > 0x7fffffffULL) {
+        fprintf(stderr, "Error: %s: unsupported .gal v%u header.\n",
+                filename, h->version);
+        exit(1);
+    }
+    if (N != 0 && (uint64_t)N != h->N) {
+        fprintf(stderr, "Error: %s holds %llu particles, expected %d\n",
+                filename, (unsigned long long)h->N, N);
+        exit(1);
+    }
+
+    for (uint32_t i = 0; i < h->n_fields; i++) {
+        GalField* col = &h->fields[i];
+        col->name[sizeof(col->name) - 1] = '\0';
+        for (int f = 0; f <= ID_FIELD; f++) {
+            if (strcmp(col->name, FIELD_NAMES[f]) != 0)
+                continue;
+            int known = f == ID_FIELD ? col->type == GAL_UINT32 ||
+                                            col->type == GAL_UINT64
+                                      : col->type == GAL_FLOAT32 ||
+                                            col->type == GAL_FLOAT64;
+            if (!known || col->offset > bytes ||
+                (bytes - col->offset) / GAL_TYPE_BYTES(col->type) < h->N) {
+                fprintf(stderr, "Error: %s: bad or truncated column %s.\n",
+                        filename, col->name);
+                exit(1);
+            }
+            cols[f] = col;
+        }
+    }
+    /* Everything but brightness is required */
+    for (int f = 0; f < N_FIELDS - 1; f++) {
+        if (!cols[f]) {
+            fprintf(stderr, "Error: %s has no %s column.\n", filename,
+                    FIELD_NAMES[f]);
+            exit(1);
+        }
+    }
+    return swap;
+}
+
+/* Default a missing brightness column, clear forces, index the ids,
+ * report the header */
+static void finish_gal2(ParticleSystem* sys, const GalHeader* h,
+                        const GalField* const cols[N_FIELDS + 1],
+                        GalInfo* info) {
+    int N = sys->N;
+    if (sys->id && !ids_adopt(sys)) {
+        fprintf(stderr, "Error: the id column is not a numbering 0..%d of "
+                        "the particles.\n", N - 1);
+        exit(1);
+    }
+    if (!cols[N_FIELDS - 1]) {
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+        for (int i = 0; i < N; i++)
+            sys->brightness[i] = 1.0;
+    }
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+    for (int i = 0; i < N; i++) {
+        sys->fx[i] = 0.0;
+        sys->fy[i] = 0.0;
+    }
+
+    info->version       = 2;
+    info->morton_sorted = (h->flags & GAL2_FLAG_MORTON) != 0;
+    info->has_bbox      = (h->flags & GAL2_FLAG_BBOX) != 0;
+    memcpy(info->bbox, h->bbox, sizeof(info->bbox));
+}
+
+static void decode_column(const unsigned char* src, uint32_t type, int swap,
+                          double* dst, int N) {
+    if (type == GAL_FLOAT64 && !swap) {
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+        for (int i = 0; i < N; i++)
+            memcpy(&dst[i], src + (size_t)i * 8, 8);
+    } else if (type == GAL_FLOAT64) {
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+        for (int i = 0; i < N; i++) {
+            uint64_t u;
+            memcpy(&u, src + (size_t)i * 8, 8);
+            u = __builtin_bswap64(u);
+            memcpy(&dst[i], &u, 8);
+        }
+    } else {
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+        for (int i = 0; i < N; i++) {
+            uint32_t u;
+            float v;
+            memcpy(&u, src + (size_t)i * 4, 4);
+            if (swap)
+                u = __builtin_bswap32(u);
+            memcpy(&v, &u, 4);
+            dst[i] = v;
+        }
+    }
+}
+
+static void encode_column(const double* src, uint32_t type,
+                          unsigned char* dst, int count) {
+    if (type == GAL_FLOAT64) {
+        memcpy(dst, src, (size_t)count * sizeof(double));
+        return;
+    }
+    for (int i = 0; i < count; i++) {
+        float v = (float)src[i];
+        memcpy(dst + (size_t)i * 4, &v, 4);
+    }
+}
+
+/* Widen or narrow a uint32/uint64 id column into ParticleId; ids too
+ * large for ParticleId saturate and then fail ids_adopt */
+static void decode_ids(const unsigned char* src, uint32_t type, int swap,
+                       ParticleId* dst, int N) {
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+    for (int i = 0; i < N; i++) {
+        uint64_t v;
+        if (type == GAL_UINT64) {
+            memcpy(&v, src + (size_t)i * 8, 8);
+            if (swap) v = __builtin_bswap64(v);
+        } else {
+            uint32_t u;
+            memcpy(&u, src + (size_t)i * 4, 4);
+            v = swap ? __builtin_bswap32(u) : u;
+        }
+        dst[i] = v > (ParticleId)-1 ? (ParticleId)-1 : (ParticleId)v;
+    }
+}
+
+static ParticleId* alloc_ids(int N) {
+    ParticleId* ids = malloc((size_t)N * sizeof(ParticleId));
+    if (!ids) {
+        fprintf(stderr, "Error: Memory allocation failed for particle ids.\n");
+        exit(1);
+    }
+    return ids;
+}
+
+/* Array holding field number f of FIELD_NAMES */
+static double* field_array(const ParticleSystem* sys, int field) {
+    switch (field) {
+    case 0:  return sys->pos_x;
+    case 1:  return sys->pos_y;
+    case 2:  return sys->mass;
+    case 3:  return sys->vx;
+    case 4:  return sys->vy;
+    default: return sys->brightness;
+    }
+}
+
+/** Loader for pipes, stdin and other unmappable inputs: tell the format
+ * from the first bytes, then read sequentially in large blocks.
+ * ----------------------------------------------------------------- */
+static ParticleSystem read_stream(int fd, int N, const char* filename,
+                                  GalInfo* info, IoAllocator alloc) {
+    GalHeader h;
+    size_t got = read_full(fd, &h, sizeof(h), filename);
+    if (got >= 8 && memcmp(h.magic, GAL2_MAGIC, 8) == 0) {
+        if (got < sizeof(h)) {
+            fprintf(stderr, "Error: %s: truncated .gal v2 header.\n",
+                    filename);
+            exit(1);
+        }
+        return read_gal2_stream(fd, &h, N, filename, info, alloc);
+    }
+    if (csv_is_text((const unsigned char*)&h, got)) {
+        size_t len;
+        unsigned char* text = read_all(fd, (const unsigned char*)&h, got,
+                                       &len, filename);
+        ParticleSystem sys = csv_parse((const char*)text, len, N, filename,
+                                       alloc);
+        free(text);
+        info->version = 0;
+        return sys;
+    }
+    return read_records_stream(fd, (const unsigned char*)&h, got, N,
+                               filename, alloc);
+}
+
+/** Stream a .gal v2 file: visit the known columns in file order and skip
+ * the padding and unknown columns between them.
+ * ----------------------------------------------------------------- */
+static ParticleSystem read_gal2_stream(int fd, GalHeader* h, int N,
+                                       const char* filename, GalInfo* info,
+                                       IoAllocator alloc) {
+    const GalField* cols[N_FIELDS + 1] = { NULL };
+    int swap = parse_gal2_header(h, UINT64_MAX, N, filename, cols);
+    N = (int)h->N;
+    ParticleSystem sys = alloc(N);
+    if (cols[ID_FIELD])
+        sys.id = alloc_ids(N);
+
+    int order[N_FIELDS + 1], n_cols = 0;
+    for (int f = 0; f <= ID_FIELD; f++) {
+        if (!cols[f])
+            continue;
+        int k = n_cols++;
+        while (k > 0 && cols[order[k - 1]]->offset > cols[f]->offset) {
+            order[k] = order[k - 1];
+            k--;
+        }
+        order[k] = f;
+    }
+
+    size_t buf_bytes = (size_t)READ_BLOCK_RECORDS * sizeof(double);
+    unsigned char* buf = malloc(buf_bytes);
+    if (!buf) {
+        fprintf(stderr, "Error: Memory allocation failed for read buffer.\n");
+        exit(1);
+    }
+
+    uint64_t pos = sizeof(GalHeader);
+    for (int k = 0; k < n_cols; k++) {
+        const GalField* col = cols[order[k]];
+        if (col->offset < pos) {
+            fprintf(stderr, "Error: %s: overlapping columns cannot be "
+                            "streamed.\n", filename);
+            exit(1);
+        }
+        while (pos < col->offset) {
+            size_t skip = col->offset - pos < buf_bytes
+                              ? (size_t)(col->offset - pos) : buf_bytes;
+            if (read_full(fd, buf, skip, filename) != skip) {
+                fprintf(stderr, "Error: %s: truncated before column %s.\n",
+                        filename, col->name);
+                exit(1);
+            }
+            pos += skip;
+        }
+
+        for (int first = 0; first < N; first += READ_BLOCK_RECORDS) {
+            int count = N - first < READ_BLOCK_RECORDS ? N - first
+                                                       : READ_BLOCK_RECORDS;
+            size_t want = (size_t)count * GAL_TYPE_BYTES(col->type);
+            if (read_full(fd, buf, want, filename) != want) {
+                fprintf(stderr, "Error: %s: truncated column %s.\n",
+                        filename, col->name);
+                exit(1);
+            }
+            if (order[k] == ID_FIELD)
+                decode_ids(buf, col->type, swap, sys.id + first, count);
+            else
+                decode_column(buf, col->type, swap,
+                              field_array(&sys, order[k]) + first, count);
+            pos += want;
+        }
+    }
+    free(buf);
+
+    finish_gal2(&sys, h, cols, info);
+    return sys;
+}
+
+/** Stream legacy records, starting with the prefix_len bytes already
+ * consumed while detecting the format. Without N the whole stream is
+ * buffered first to count the records.
+ * ----------------------------------------------------------------- */
+static ParticleSystem read_records_stream(int fd, const unsigned char* prefix,
+                                          size_t prefix_len, int N,
+                                          const char* filename,
+                                          IoAllocator alloc) {
+    if (N == 0) {
+        size_t len;
+        unsigned char* all = read_all(fd, prefix, prefix_len, &len, filename);
+        if (len % RECORD_BYTES != 0 || len / RECORD_BYTES > 0x7fffffff) {
+            fprintf(stderr, "Error: %s is not a whole number of records; "
+                            "pass N explicitly.\n", filename);
+            exit(1);
+        }
+        N = (int)(len / RECORD_BYTES);
+        ParticleSystem sys = alloc(N);
+        decode_records(&sys, all, 0, N);
+        free(all);
+        return sys;
+    }
+
+    unsigned char* buf = malloc((size_t)READ_BLOCK_RECORDS * RECORD_BYTES);
+    if (!buf) {
+        fprintf(stderr, "Error: Memory allocation failed for read buffer.\n");
+        exit(1);
+    }
+
+    ParticleSystem sys = alloc(N);
+    for (int first = 0; first < N; first += READ_BLOCK_RECORDS) {
+        int count = N - first < READ_BLOCK_RECORDS ? N - first
+                                                   : READ_BLOCK_RECORDS;
+        size_t want = (size_t)count * RECORD_BYTES;
+        size_t got  = prefix_len < want ? prefix_len : want;
+        memcpy(buf, prefix, got);
+        prefix     += got;
+        prefix_len -= got;
+        got += read_full(fd, buf + got, want - got, filename);
+        if (got < want) {
+            fprintf(stderr,
+                    "Error: Unexpected end of file %s at particle %d\n",
+                    filename, first + (int)(got / RECORD_BYTES));
+            exit(1);
+        }
+        decode_records(&sys, buf, first, count);
+    }
+    free(buf);
+    return sys;
+}
+
+/* The prefix plus everything up to end of input, in one heap buffer */
+static unsigned char* read_all(int fd, const unsigned char* prefix,
+                               size_t prefix_len, size_t* len,
+                               const char* filename) {
+    size_t cap = (size_t)READ_BLOCK_RECORDS * RECORD_BYTES;
+    if (cap < prefix_len)
+        cap = prefix_len;
+    unsigned char* all = malloc(cap);
+    *len = prefix_len;
+    if (all)
+        memcpy(all, prefix, prefix_len);
+    while (all) {
+        *len += read_full(fd, all + *len, cap - *len, filename);
+        if (*len < cap)
+            break;
+        cap *= 2;
+        unsigned char* grown = realloc(all, cap);
+        if (!grown)
+            free(all);
+        all = grown;
+    }
+    if (!all) {
+        fprintf(stderr, "Error: Memory allocation failed for read buffer.\n");
+        exit(1);
+    }
+    return all;
+}
+
+/* read() until len bytes or end of input; returns the bytes read */
+static size_t read_full(int fd, void* buf, size_t len, const char* filename) {
+    unsigned char* p = buf;
+    size_t got = 0;
+    while (got < len) {
+        ssize_t n = read(fd, p + got, len - got);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0) {
+            fprintf(stderr, "Error reading %s: %s\n", filename,
+                    strerror(errno));
+            exit(1);
+        }
+        if (n == 0)
+            break;
+        got += (size_t)n;
+    }
+    return got;
+}
+
+/* Serial packer shared by io_pack_records and the per-thread writers */
+static void pack_range(const ParticleSystem* sys, int first, int count,
+                       unsigned char* dst) {
+    for (int r = 0; r < count; r++) {
+        unsigned char* rec = dst + (size_t)r * RECORD_BYTES;
+        int i = first + r;
+        memcpy(rec + 0 * sizeof(double), &sys->pos_x[i], sizeof(double));
+        memcpy(rec + 1 * sizeof(double), &sys->pos_y[i], sizeof(double));
+        memcpy(rec + 2 * sizeof(double), &sys->mass[i],  sizeof(double));
+        memcpy(rec + 3 * sizeof(double), &sys->vx[i],    sizeof(double));
+        memcpy(rec + 4 * sizeof(double), &sys->vy[i],    sizeof(double));
+        memcpy(rec + 5 * sizeof(double), &sys->brightness[i],
+               sizeof(double));
+    }
+}
+
+/* pwrite() until len bytes are written or an error occurs; a write of
+ * nothing is an error too, as retrying it would never finish */
+static bool pwrite_full(int fd, const unsigned char* buf, size_t len,
+                        off_t offset) {
+    while (len > 0) {
+        ssize_t n = pwrite(fd, buf, len, offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            if (n < 0) perror("Error writing output");
+            else       fprintf(stderr, "Error writing output: no progress\n");
+            return false;
+        }
+        buf    += n;
+        len    -= (size_t)n;
+        offset += n;
+    }
+    return true;
+}
+
+/** Header of a v2 file whose n_fields named columns, all of opt->type,
+ * follow the header page back to back. Returns the column stride.
+ * ----------------------------------------------------------------- */
+static size_t fill_gal2_header(GalHeader* h, int N,
+                               const char* const* names, int n_fields,
+                               const GalWriteOptions* opt) {
+    size_t column_span = ((size_t)N * GAL_TYPE_BYTES(opt->type) +
+                          GAL2_ALIGN - 1) / GAL2_ALIGN * GAL2_ALIGN;
+    memset(h, 0, sizeof(*h));
+    memcpy(h->magic, GAL2_MAGIC, 8);
+    h->version  = GAL2_VERSION;
+    h->endian   = GAL2_ENDIAN_TAG;
+    h->N        = (uint64_t)N;
+    h->n_fields = (uint32_t)n_fields;
+    h->flags    = (opt->morton_sorted ? GAL2_FLAG_MORTON : 0) |
+                  (opt->has_bbox ? GAL2_FLAG_BBOX : 0);
+    if (opt->has_bbox)
+        memcpy(h->bbox, opt->bbox, sizeof(h->bbox));
+    for (int f = 0; f < n_fields; f++) {
+        snprintf(h->fields[f].name, sizeof(h->fields[f].name), "%s",
+                 names[f]);
+        h->fields[f].type   = (uint32_t)opt->type;
+        h->fields[f].offset = GAL2_ALIGN + (uint64_t)f * column_span;
+    }
+    return column_span;
+}
+
+/* write() all of buf, retrying short writes */
+static bool write_full(int fd, const unsigned char* buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        buf += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+/* Open an output path ("-" = stdout); stream is set when the target
+ * cannot take positioned writes, e.g. a pipe or a terminal */
+static int open_output(const char* filename, bool* stream) {
+    int fd = strcmp(filename, "-") == 0
+                 ? stdout_fd
+                 : open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror("Error opening output file");
+        return -1;
+    }
+    struct stat st;
+    *stream = fstat(fd, &st) != 0 || !S_ISREG(st.st_mode);
+    return fd;
+}
+
+static bool close_output(int fd) {
+    return fd == stdout_fd || close(fd) == 0;
+}
+
+/** Sequential writer for pipes: pack WRITE_BLOCK_RECORDS records in
+ * parallel, then hand the block to the pipe in one write.
+ * ----------------------------------------------------------------- */
+static bool write_records_stream(int fd, const ParticleSystem* sys) {
+    unsigned char* buf = malloc((size_t)WRITE_BLOCK_RECORDS * RECORD_BYTES);
+    if (!buf)
+        return false;
+    bool ok = true;
+    for (int first = 0; first < sys->N && ok; first += WRITE_BLOCK_RECORDS) {
+        int count = sys->N - first < WRITE_BLOCK_RECORDS ? sys->N - first
+                                                         : WRITE_BLOCK_RECORDS;
+        io_pack_records(sys, first, count, buf);
+        ok = write_full(fd, buf, (size_t)count * RECORD_BYTES);
+    }
+    free(buf);
+    return ok;
+}
+
+/** Sequential .gal v2 body: the columns in order, zero-padded to
+ * column_span, so the bytes match a file written with pwrite.
+ * ----------------------------------------------------------------- */
+static bool write_gal2_stream(int fd, const ParticleSystem* sys,
+                              const GalHeader* h, size_t column_span) {
+    int N = sys->N;
+    uint32_t type = h->fields[0].type;
+    size_t elem = GAL_TYPE_BYTES(type);
+    size_t buf_bytes = (size_t)WRITE_BLOCK_RECORDS * elem;
+    unsigned char* buf = malloc(buf_bytes);
+    if (!buf)
+        return false;
+    bool ok = true;
+    for (int f = 0; f < N_FIELDS && ok; f++) {
+        for (int first = 0; first < N && ok; first += WRITE_BLOCK_RECORDS) {
+            int count = N - first < WRITE_BLOCK_RECORDS ? N - first
+                                                        : WRITE_BLOCK_RECORDS;
+            encode_column(field_array(sys, f) + first, type, buf, count);
+            ok = write_full(fd, buf, (size_t)count * elem);
+        }
+        /* The last column ends the file unpadded, as with pwrite */
+        size_t pad = f < (int)h->n_fields - 1 ? column_span - (size_t)N * elem
+                                              : 0;
+        memset(buf, 0, pad < buf_bytes ? pad : buf_bytes);
+        while (ok && pad > 0) {
+            size_t n = pad < buf_bytes ? pad : buf_bytes;
+            ok = write_full(fd, buf, n);
+            pad -= n;
+        }
+    }
+    free(buf);
+    if (ok && sys->id)
+        ok = write_full(fd, (const unsigned char*)sys->id,
+                        (size_t)N * sizeof(ParticleId));
+    return ok;
 }
@@ -2,9 +2,109 @@
 #define IO_H
 
 #include "types.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
 
-ParticleSystem io_read_particles(const char* filename, int N);
-void io_write_result(const char* filename, ParticleSystem* sys);
+/* Size of one packed particle record in a legacy (headerless) .gal file */
+#define IO_RECORD_BYTES (6 * sizeof(double))
+
+/* .gal v2: a GalHeader, then one GAL2_ALIGN-aligned column per field.
+ * Known fields are x, y, mass, vx, vy, brightness and the integer
+ * particle id (ids.h); readers ignore the rest. The endian tag is
+ * written natively so readers can detect and swap foreign byte order. */
+#define GAL2_MAGIC       "NBODYGAL"
+#define GAL2_VERSION     2
+#define GAL2_ENDIAN_TAG  0x01020304u
+#define GAL2_MAX_FIELDS  16
+#define GAL2_ALIGN       4096
+#define GAL2_FLAG_MORTON 0x1u  /* rows are in Z-order of the bbox */
+#define GAL2_FLAG_BBOX   0x2u  /* bbox is valid */
+
+typedef enum {
+    GAL_FLOAT32 = 4, GAL_FLOAT64 = 8,
+    GAL_UINT32 = 0x104, GAL_UINT64 = 0x108   /* unsigned integers */
+} GalType;
+#define GAL_TYPE_BYTES(t) ((t) & 0xffu)
+
+typedef struct {
+    char     name[16];
+    uint32_t type;      /* GalType; the low byte is the element size */
+    uint32_t reserved;
+    uint64_t offset;    /* absolute file offset of the column */
+} GalField;
+
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    uint32_t endian;
+    uint64_t N;
+    uint32_t n_fields;
+    uint32_t flags;
+    double   bbox[4];   /* x_min, x_max, y_min, y_max */
+    GalField fields[GAL2_MAX_FIELDS];
+} GalHeader;
+
+/* What the loader found out about its input */
+typedef struct {
+    int    version;        /* 1 = legacy headerless, 2 = .gal v2,
+                              0 = delimited text (csv.h), 3 = .ntc frame */
+    int    morton_sorted;
+    int    has_bbox;
+    double bbox[4];
+} GalInfo;
+
+/* Layout choices for io_write_gal2 */
+typedef struct {
+    GalType type;          /* element type of every column */
+    int     morton_sorted;
+    int     has_bbox;
+    double  bbox[4];
+} GalWriteOptions;
+
+/* A named column for io_pack_gal2 */
+typedef struct {
+    const char*   name;
+    const double* data;
+} GalColumn;
+
+/* Provides the arrays a loader fills, e.g. io_alloc_particles */
+typedef ParticleSystem (*IoAllocator)(int N);
+
+// Load a legacy or v2 .gal file, delimited text or the last frame of a
+// .ntc container (auto-detected). N = 0 takes the count from the header
+// or the file size; info may be NULL. "-" reads stdin;
+// pipes and other non-seekable inputs are streamed. A v2 id column
+// is loaded into sys->id and must number the particles 0..N-1.
+ParticleSystem io_read_particles(const char* filename, int N, GalInfo* info);
+// The same, decoding into arrays from alloc instead of the heap.
+ParticleSystem io_read_particles_with(const char* filename, int N,
+                                      GalInfo* info, IoAllocator alloc);
+ParticleSystem io_alloc_particles(int N);
+// Writers take "-" for stdout and write sequentially to pipes.
+// io_write_gal2 appends an id column when the system keeps ids.
+bool io_write_result(const char* filename, const ParticleSystem* sys);
+bool io_write_gal2(const char* filename, const ParticleSystem* sys,
+                   const GalWriteOptions* opt);
+// Size and in-memory image of a v2 file with arbitrary named columns
+// (at most GAL2_MAX_FIELDS), laid out as io_write_gal2 writes one.
+size_t io_gal2_bytes(int N, int n_cols, GalType type);
+void io_pack_gal2(unsigned char* dst, int N, const GalColumn* cols,
+                  int n_cols, const GalWriteOptions* opt);
+// Write a CSV_HEADER line and one text line per particle (see csv.h).
+bool io_write_csv(const char* filename, const ParticleSystem* sys);
 void io_free_particles(ParticleSystem* sys);
 
+// Reserve stdout for "-" output: console messages go to stderr instead.
+void io_redirect_stdout(void);
+
+// Pack particles [first, first + count) into dst as .gal records.
+void io_pack_records(const ParticleSystem* sys, int first, int count,
+                     unsigned char* dst);
+
+// Write all particles as .gal records at byte offset of fd.
+// n_writers > 1 lets that many threads pwrite disjoint blocks.
+bool io_write_records(int fd, off_t offset, const ParticleSystem* sys,
+                      int n_writers);
+
 #endif
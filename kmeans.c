@@ -1,5 +1,6 @@
 #include "kmeans.h"
 #include "ds.h"
+#include "ids.h"
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -103,7 +104,9 @@ static bool reorder_by_clusters(ParticleSystem* sys, const int* clustersP) {
            reorder_array(sys->vx, clustersP, N) &&
            reorder_array(sys->vy, clustersP, N) &&
            reorder_array(sys->fx, clustersP, N) &&
-           reorder_array(sys->fy, clustersP, N);
+           reorder_array(sys->fy, clustersP, N) &&
+           reorder_array(sys->brightness, clustersP, N) &&
+           ids_permute(sys, clustersP);
 }
 
 static bool converged(CNode* clusters, double* old_clusters_ctr_x,
@@ -0,0 +1,211 @@
+#include "live.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Columns are copied in pieces of this many doubles, split over threads */
+#define COPY_CHUNK (1 << 16)
+
+static unsigned char* ring       = NULL;
+static size_t         ring_bytes = 0;
+static char           ring_name[256];
+static uint64_t       n_published = 0;
+
+static size_t column_span(uint64_t capacity);
+static void   shm_path(const char* name, char* out, size_t len);
+
+bool live_open(const char* name, int n_slots, int N) {
+    shm_path(name, ring_name, sizeof(ring_name));
+    size_t span = column_span((uint64_t)N);
+    size_t slot_bytes = LIVE_ALIGN + LIVE_COLUMNS * span;
+    ring_bytes = LIVE_ALIGN + (size_t)n_slots * slot_bytes;
+
+    int fd = shm_open(ring_name, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror("Error creating shared-memory ring");
+        return false;
+    }
+    if (ftruncate(fd, (off_t)ring_bytes) != 0) {
+        perror("Error sizing shared-memory ring");
+        close(fd);
+        shm_unlink(ring_name);
+        return false;
+    }
+    void* base = mmap(NULL, ring_bytes, PROT_READ | PROT_WRITE, MAP_SHARED,
+                      fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        perror("Error mapping shared-memory ring");
+        shm_unlink(ring_name);
+        return false;
+    }
+    ring = (unsigned char*)base;
+
+    /* The object is zero-filled, so every slot starts at seq 0 */
+    LiveHeader* h = (LiveHeader*)ring;
+    memcpy(h->magic, LIVE_MAGIC, 8);
+    h->version    = LIVE_VERSION;
+    h->n_slots    = (uint32_t)n_slots;
+    h->capacity   = (uint64_t)N;
+    h->slot_bytes = slot_bytes;
+    n_published   = 0;
+    return true;
+}
+
+/** Seqlock write of one frame. The odd seq is stored before any data and
+ * the even one after all of it, so a reader that sees the same even seq
+ * on both sides of its copy has a consistent frame.
+ * ----------------------------------------------------------------- */
+void live_publish(const ParticleSystem* sys, int step, double sim_time,
+                  const double* bbox, int morton_sorted) {
+    if (!ring)
+        return;
+    LiveHeader* h = (LiveHeader*)ring;
+    uint64_t frame = ++n_published;
+    unsigned char* base = ring + LIVE_ALIGN +
+                          (size_t)((frame - 1) % h->n_slots) * h->slot_bytes;
+    LiveSlot* slot = (LiveSlot*)base;
+
+    __atomic_store_n(&slot->seq, 2 * frame - 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    slot->step          = step;
+    slot->time          = sim_time;
+    slot->N             = (uint64_t)sys->N;
+    slot->morton_sorted = morton_sorted && bbox;
+    slot->has_bbox      = bbox != NULL;
+    if (bbox)
+        memcpy(slot->bbox, bbox, sizeof(slot->bbox));
+
+    const double* columns[LIVE_COLUMNS] = { sys->pos_x, sys->pos_y,
+                                            sys->mass,  sys->vx,
+                                            sys->vy,    sys->brightness };
+    size_t span = column_span(h->capacity);
+    int chunks = (sys->N + COPY_CHUNK - 1) / COPY_CHUNK;
+#ifdef _OPENMP
+#pragma omp parallel for collapse(2) schedule(static)
+#endif
+    for (int a = 0; a < LIVE_COLUMNS; a++) {
+        for (int c = 0; c < chunks; c++) {
+            size_t first = (size_t)c * COPY_CHUNK;
+            size_t count = (size_t)sys->N - first < COPY_CHUNK
+                               ? (size_t)sys->N - first : COPY_CHUNK;
+            memcpy(base + LIVE_ALIGN + a * span + first * sizeof(double),
+                   columns[a] + first, count * sizeof(double));
+        }
+    }
+
+    __atomic_store_n(&slot->seq, 2 * frame, __ATOMIC_RELEASE);
+    __atomic_store_n(&h->latest, frame, __ATOMIC_RELEASE);
+}
+
+void live_close(void) {
+    if (!ring)
+        return;
+    LiveHeader* h = (LiveHeader*)ring;
+    __atomic_store_n(&h->finished, 1, __ATOMIC_RELEASE);
+    munmap(ring, ring_bytes);
+    shm_unlink(ring_name);
+    ring = NULL;
+}
+
+bool live_reader_open(const char* name, LiveReader* reader) {
+    char path[256];
+    shm_path(name, path, sizeof(path));
+    memset(reader, 0, sizeof(*reader));
+    int fd = shm_open(path, O_RDONLY, 0);
+    if (fd < 0) {
+        perror("Error opening shared-memory ring");
+        return false;
+    }
+    struct stat st;
+    LiveHeader h;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < LIVE_ALIGN ||
+        pread(fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h) ||
+        memcmp(h.magic, LIVE_MAGIC, 8) != 0 || h.version != LIVE_VERSION ||
+        (uint64_t)st.st_size < LIVE_ALIGN + h.n_slots * h.slot_bytes) {
+        fprintf(stderr, "Error: %s is not a live frame ring.\n", path);
+        close(fd);
+        return false;
+    }
+    void* base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        perror("Error mapping shared-memory ring");
+        return false;
+    }
+    reader->base   = (const unsigned char*)base;
+    reader->bytes  = (size_t)st.st_size;
+    reader->header = (const LiveHeader*)base;
+    return true;
+}
+
+/** Seqlock read: take the newest frame, copy it, and keep it only if its
+ * slot still holds that frame afterwards. A slot is overwritten only
+ * after the simulator has gone round the whole ring, so with a few slots
+ * a retry is rare.
+ * ----------------------------------------------------------------- */
+bool live_read_latest(const LiveReader* reader, ParticleSystem* sys,
+                      LiveFrame* frame) {
+    const LiveHeader* h = reader->header;
+    size_t span = column_span(h->capacity);
+    for (;;) {
+        uint64_t latest = __atomic_load_n(&h->latest, __ATOMIC_ACQUIRE);
+        if (latest == 0)
+            return false;
+        const unsigned char* base =
+            reader->base + LIVE_ALIGN +
+            (size_t)((latest - 1) % h->n_slots) * h->slot_bytes;
+        const LiveSlot* slot = (const LiveSlot*)base;
+        uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        if (seq != 2 * latest)
+            continue;
+
+        LiveSlot meta;
+        memcpy(&meta, slot, sizeof(meta));
+        if (meta.N > h->capacity)
+            continue;
+        double* columns[LIVE_COLUMNS] = { sys->pos_x, sys->pos_y,
+                                          sys->mass,  sys->vx,
+                                          sys->vy,    sys->brightness };
+        for (int a = 0; a < LIVE_COLUMNS; a++)
+            memcpy(columns[a], base + LIVE_ALIGN + a * span,
+                   (size_t)meta.N * sizeof(double));
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq)
+            continue;
+
+        sys->N = (int)meta.N;
+        if (frame) {
+            frame->frame         = latest;
+            frame->step          = meta.step;
+            frame->time          = meta.time;
+            frame->N             = (int)meta.N;
+            frame->morton_sorted = (int)meta.morton_sorted;
+            frame->has_bbox      = (int)meta.has_bbox;
+            memcpy(frame->bbox, meta.bbox, sizeof(frame->bbox));
+        }
+        return true;
+    }
+}
+
+void live_reader_close(LiveReader* reader) {
+    if (reader->base)
+        munmap((void*)reader->base, reader->bytes);
+    memset(reader, 0, sizeof(*reader));
+}
+
+/* Bytes per column slot, padded so every column starts page-aligned */
+static size_t column_span(uint64_t capacity) {
+    return (size_t)((capacity * sizeof(double) + LIVE_ALIGN - 1) /
+                    LIVE_ALIGN * LIVE_ALIGN);
+}
+
+/* shm_open wants one leading slash */
+static void shm_path(const char* name, char* out, size_t len) {
+    snprintf(out, len, "%s%s", name[0] == '/' ? "" : "/", name);
+}
@@ -0,0 +1,83 @@
+#ifndef LIVE_H
+#define LIVE_H
+
+#include "types.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Live frames for local consumers: a POSIX shared-memory object holding
+ * a LiveHeader page and a ring of n_slots frame slots. A slot is a
+ * LiveSlot page followed by the x, y, mass, vx, vy and brightness
+ * columns (native doubles, each padded to LIVE_ALIGN). Each slot is a
+ * seqlock: the simulator makes seq odd, copies the frame in and makes it
+ * even again, then publishes the frame number in latest. Readers never
+ * block the simulator; they retry when seq moved under them. */
+#define LIVE_MAGIC   "NBODYSHM"
+#define LIVE_VERSION 1
+#define LIVE_ALIGN   4096
+#define LIVE_COLUMNS 6
+
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    uint32_t n_slots;
+    uint64_t capacity;    /* particles per slot */
+    uint64_t slot_bytes;  /* stride between slots */
+    uint64_t latest;      /* newest complete frame number, 0 = none */
+    uint32_t finished;    /* set when the run has ended */
+    uint32_t reserved;
+} LiveHeader;
+
+typedef struct {
+    uint64_t seq;         /* 2 * frame, odd while being written */
+    int64_t  step;
+    double   time;
+    uint64_t N;
+    uint32_t morton_sorted;
+    uint32_t has_bbox;
+    double   bbox[4];     /* x_min, x_max, y_min, y_max */
+} LiveSlot;
+
+/* A consumer's read-only view of the ring */
+typedef struct {
+    const unsigned char* base;
+    size_t               bytes;
+    const LiveHeader*    header;
+} LiveReader;
+
+/* Frame metadata returned with a copy */
+typedef struct {
+    uint64_t frame;
+    int64_t  step;
+    double   time;
+    int      N;
+    int      morton_sorted;
+    int      has_bbox;
+    double   bbox[4];
+} LiveFrame;
+
+// Create the shared object name (e.g. "/nbody") with n_slots slots for
+// N particles and map it; false if that fails.
+bool live_open(const char* name, int n_slots, int N);
+
+// Copy the particles into the next slot and publish it. bbox may be
+// NULL; morton_sorted marks arrays in Z-order of bbox.
+void live_publish(const ParticleSystem* sys, int step, double sim_time,
+                  const double* bbox, int morton_sorted);
+
+// Mark the ring finished, unmap it and remove the name.
+void live_close(void);
+
+// Map an existing ring read-only.
+bool live_reader_open(const char* name, LiveReader* reader);
+
+// Copy the newest frame into sys, whose arrays must hold the ring
+// capacity (fx and fy are not touched). Returns false when nothing has
+// been published yet; retries while the simulator overwrites the slot.
+bool live_read_latest(const LiveReader* reader, ParticleSystem* sys,
+                      LiveFrame* frame);
+
+void live_reader_close(LiveReader* reader);
+
+#endif
@@ -1,17 +1,81 @@
+#include "analysis.h"
+#include "async_io.h"
+#include "barnes_hut.h"
+#include "checkpoint.h"
+#include "external.h"
+#include "fof.h"
+#include "ids.h"
 #include "io.h"
+#include "live.h"
+#include "ooc.h"
+#include "render.h"
+#include "snapshot.h"
 #include "time_utils.h"
+#include "track.h"
 #include "types.h"
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #ifdef _OPENMP
 #include <omp.h>
 #endif
 
 void compute_force_naive(ParticleSystem* sys, KernelConfig* config);
-void compute_force_barnes_hut(ParticleSystem* sys, KernelConfig* config);
 
-static void integrate_positions(ParticleSystem* sys, double dt);
-static void integrate_velocities(ParticleSystem* sys, double dt);
+/* Optional --name value settings, accepted anywhere on the command line */
+typedef struct {
+    int    snapshot_every;  /* steps between snapshots, 0 = off */
+    double snapshot_dt;     /* simulated time between snapshots, 0 = off */
+    SnapshotFormat snapshot_format;
+    double traj_error;      /* relative error bound for .ntz frames */
+    int    checkpoint_every; /* steps between checkpoints, 0 = off */
+    const char* output_format; /* gal, gal2, gal2-f32 or csv */
+    const char* restart;    /* checkpoint to resume from, NULL = none */
+    const char* out_of_core; /* working file, NULL = keep particles in RAM */
+    const char* output;     /* result path or "-", NULL = data/outputs */
+    int    lod_depth;       /* lod snapshot cut depth, 0 = no limit */
+    double lod_size;        /* lod snapshot cut cell side, 0 = no limit */
+    const char* track;      /* list of particle ids to record every step */
+    const char* output_order; /* run, input or ids */
+    const char* live;       /* shared-memory ring name, NULL = off */
+    int    live_every;      /* steps between live frames */
+    int    live_slots;      /* frames the ring holds */
+    RenderConfig render;    /* in-situ density images, every_steps 0 = off */
+    AnalysisConfig analysis; /* in-situ analysis log, every_steps 0 = off */
+    FofConfig fof;          /* group catalogues, every_steps 0 = off */
+    double tracer_mass;     /* bodies this light are tracers, 0 = massless */
+    double heavy_mass;      /* heavier bodies are summed directly, 0 = off */
+    double outlier_radius;  /* so are bodies farther out than this, 0 = off */
+    ExternalPotential external; /* analytic background field, kind NONE = off */
+} RunOptions;
+
+/* Set by SIGTERM; the time loop checkpoints and exits at the step end */
+static volatile sig_atomic_t term_requested = 0;
+
+/* External acceleration from the second kick of the last step, which the
+ * next first kick reuses: same positions, same time */
+static double* ext_ax = NULL;
+static double* ext_ay = NULL;
+static int     ext_cap = 0;
+static bool    ext_cached = false;
+
+static void on_sigterm(int sig);
+static int  parse_options(int argc, char* argv[], RunOptions* opt);
+static void compute_forces(int version_id, bool out_of_core,
+                           ParticleSystem* sys, KernelConfig* config);
+static bool save_checkpoint(const char* path, const ParticleSystem* sys,
+                            int version_id, int step, double dt,
+                            const KernelConfig* config,
+                            const ExternalPotential* ext, bool in_place);
+static void publish_live(const ParticleSystem* sys, int version_id,
+                         int step, const KernelConfig* config,
+                         bool out_of_core);
+static void report_io(void);
+static void integrate_positions(ParticleSystem* sys, double dt,
+                                const ExternalPotential* ext);
+static void integrate_velocities(ParticleSystem* sys, double dt,
+                                 const ExternalPotential* ext);
 
 static const int    DEFAULT_STEPS   = 200;
 static const double DEFAULT_DT      = 1e-5;
@@ -20,11 +84,72 @@ static const double DEFAULT_THETA   = 0.5;
 static const int    DEFAULT_K       = 0;
 
 int main(int argc, char* argv[]) {
+    /* Fields left out are zero, NULL or off */
+    RunOptions opt = {
+        .snapshot_format = SNAPSHOT_GAL,
+        .traj_error      = 1e-6,
+        .output_format   = "gal",
+        .lod_depth       = 6,
+        .output_order    = "run",
+        .live_every      = 1,
+        .live_slots      = 3,
+        .render   = { .width = 512, .height = 512, .format = RENDER_PNG,
+                      .log_scale = 1 },
+        .analysis = { .n_bins = 32 },
+        .fof      = { .min_members = 20 },
+        .external = { .kind = EXTERNAL_NONE, .q = 1.0, .cos_t = 1.0 },
+    };
+    argc = parse_options(argc, argv, &opt);
+
     if (argc != 4 && argc != 5 && argc != 6 && argc != 9) {
-        fprintf(stderr, "Usage: %s <version> N <input.gal> [nsteps] [n_threads]\n", argv[0]);
-        fprintf(stderr, "   or: %s <version> N <input.gal> nsteps dt n_threads theta k\n", argv[0]);
+        fprintf(stderr, "Usage: %s <version> N <input.gal|-> [nsteps] [n_threads] [options]\n", argv[0]);
+        fprintf(stderr, "   or: %s <version> N <input.gal|-> nsteps dt n_threads theta k [options]\n", argv[0]);
         fprintf(stderr, "Versions: 1=Naive  2=Barnes-Hut\n");
+        fprintf(stderr, "N: particle count, or 0 to take it from the file\n");
         fprintf(stderr, "k: locality strategy for version 2 (0=Morton, >0=k-means with k clusters)\n");
+        fprintf(stderr, "Options:\n");
+        fprintf(stderr, "  --snapshot-every K   write a snapshot every K steps\n");
+        fprintf(stderr, "  --snapshot-dt T      write a snapshot every T of simulated time\n");
+        fprintf(stderr, "  --snapshot-format F  gal (one file per snapshot), traj (compressed .ntz),\n"
+                        "                       ntc (indexed .ntc container) or indexed (one\n"
+                        "                       Morton-ordered, block-indexed .ntc per snapshot)\n"
+                        "                       or lod (tree cells as pseudo-particles, v2 only)\n");
+        fprintf(stderr, "  --lod-depth D        lod cut depth below the root, 0 = leaves (default 6)\n");
+        fprintf(stderr, "  --lod-size S         lod cut at cells of side S or smaller (default off)\n");
+        fprintf(stderr, "  --traj-error E       traj error bound relative to the domain (default 1e-6)\n");
+        fprintf(stderr, "  --checkpoint-every K write a restart checkpoint every K steps (also on SIGTERM)\n");
+        fprintf(stderr, "  --restart FILE       resume from a checkpoint instead of reading the input\n");
+        fprintf(stderr, "  --output-format F    gal (legacy records), gal2 or gal2-f32 (v2 with header),\n"
+                        "                       or csv (text)\n");
+        fprintf(stderr, "  --output FILE        result path, - for stdout (default data/outputs/result_<label>.gal)\n");
+        fprintf(stderr, "  --output-order O     run (last reordering), input (scattered back to input\n"
+                        "                       order by particle id) or ids (run order with ids,\n"
+                        "                       gal2 or gal2-f32 only)\n");
+        fprintf(stderr, "  --out-of-core FILE   keep particles in a mapped working file (v2, k=0)\n");
+        fprintf(stderr, "  --live NAME          publish frames to the shared-memory ring NAME (live.h)\n");
+        fprintf(stderr, "  --live-every K       steps between live frames (default 1)\n");
+        fprintf(stderr, "  --live-slots S       frames the live ring holds (default 3)\n");
+        fprintf(stderr, "  --render-every K     write a density image every K steps\n");
+        fprintf(stderr, "  --render-size WxH    image size (default 512x512)\n");
+        fprintf(stderr, "  --render-format F    png (default) or pgm\n");
+        fprintf(stderr, "  --render-scale S     log (default) or linear intensity\n");
+        fprintf(stderr, "  --render-weight W    mass (default) or brightness\n");
+        fprintf(stderr, "  --render-box X0,X1,Y0,Y1  fixed view (default: fitted to the first frame)\n");
+        fprintf(stderr, "  --analysis-every K   log energies, Lz and radial profiles every K steps\n");
+        fprintf(stderr, "  --analysis-bins B    radial profile bins (default 32)\n");
+        fprintf(stderr, "  --analysis-rmax R    profile radius (default: fitted to the first record)\n");
+        fprintf(stderr, "  --fof-every K        write a friends-of-friends group catalogue every K steps (v2 only)\n");
+        fprintf(stderr, "  --fof-link B         linking length (default 0.2 mean separation)\n");
+        fprintf(stderr, "  --fof-min M          smallest group listed (default 20)\n");
+        fprintf(stderr, "  --tracer-mass M      bodies of mass <= M feel gravity but do not source it\n"
+                        "                       (default 0: massless bodies only)\n");
+        fprintf(stderr, "  --heavy-mass M       bodies of mass > M act by direct summation, not the tree (v2)\n");
+        fprintf(stderr, "  --outlier-radius R   so do bodies farther than R from the centre of mass, and\n"
+                        "                       the tree domain ignores them (v2)\n");
+        fprintf(stderr, "  --external P         analytic external potential: point:GM[,eps], plummer:GM,a,\n"
+                        "                       log:v0,rc[,q] or bar:v0,rc,q,omega (rotating log bar)\n");
+        fprintf(stderr, "  --external-centre X,Y  centre of the external potential (default 0,0)\n");
+        fprintf(stderr, "  --track FILE         record the particles whose ids FILE lists after every step\n");
         return 1;
     }
 
@@ -36,7 +161,7 @@ int main(int argc, char* argv[]) {
     }
 
     int N = (int)strtol(argv[2], &end, 10);
-    if (end == argv[2] || *end != '\0' || N <= 0) return 1;
+    if (end == argv[2] || *end != '\0' || N < 0) return 1;
 
     const char* filename = argv[3];
     int    nsteps     = DEFAULT_STEPS;
@@ -49,7 +174,7 @@ int main(int argc, char* argv[]) {
         nsteps = (int)strtol(argv[4], &end, 10);
         if (end == argv[4] || *end != '\0' || nsteps <= 0) return 1;
     }
-    if (argc >= 6) {
+    if (argc == 6) {
         n_threads = (int)strtol(argv[5], &end, 10);
         if (end == argv[5] || *end != '\0' || n_threads <= 0) return 1;
     }
@@ -68,72 +193,595 @@ int main(int argc, char* argv[]) {
         fprintf(stderr, "k-means is only supported for version 2.\n");
         return 1;
     }
+    if (opt.out_of_core &&
+        (version_id != 2 || k_clusters != 0 || opt.checkpoint_every > 0 ||
+         (opt.restart && strcmp(opt.restart, opt.out_of_core) != 0))) {
+        fprintf(stderr, "--out-of-core needs version 2 with k=0, no "
+                        "--checkpoint-every, and resumes only from its own "
+                        "working file.\n");
+        return 1;
+    }
+
+    if (opt.snapshot_format == SNAPSHOT_LOD &&
+        (version_id != 2 || opt.out_of_core)) {
+        fprintf(stderr, "--snapshot-format lod needs version 2 in memory.\n");
+        return 1;
+    }
+
+    if (opt.fof.every_steps > 0 && (version_id != 2 || opt.out_of_core)) {
+        fprintf(stderr, "--fof-every needs version 2 in memory.\n");
+        return 1;
+    }
+
+    /* The naive kernel sums every pair directly already */
+    if (opt.heavy_mass > 0.0 && version_id != 2) {
+        fprintf(stderr, "--heavy-mass needs version 2.\n");
+        return 1;
+    }
+    if (opt.outlier_radius > 0.0 && version_id != 2) {
+        fprintf(stderr, "--outlier-radius needs version 2.\n");
+        return 1;
+    }
+
+    /* Only a v2 header can say the file carries an id column */
+    if (strcmp(opt.output_order, "ids") == 0 &&
+        strncmp(opt.output_format, "gal2", 4) != 0) {
+        fprintf(stderr, "--output-order ids needs --output-format gal2 or "
+                        "gal2-f32.\n");
+        return 1;
+    }
+
+    bool want_ids = opt.track || strcmp(opt.output_order, "run") != 0;
+    if (want_ids && opt.out_of_core) {
+        fprintf(stderr, "--track and --output-order need the particles in "
+                        "memory.\n");
+        return 1;
+    }
+
+    if (opt.output && strcmp(opt.output, "-") == 0)
+        io_redirect_stdout();   /* progress goes to stderr, particles to stdout */
 
 #ifdef _OPENMP
     omp_set_num_threads(n_threads);
 #endif
 
-    KernelConfig config = { theta, n_threads, k_clusters, 0.0 };
-    ParticleSystem sys = io_read_particles(filename, N);
+    ParticleSystem sys;
+    int start_step = 0;
+    double t_load = sim_time_now();
+    if (opt.restart) {
+        /* dt, theta, k, the tracer, heavy and outlier settings and the
+         * external potential come from the checkpoint so the run
+         * continues exactly; only the step target and thread count may
+         * change. */
+        CheckpointState ckpt;
+        if (opt.out_of_core) {
+            if (!ooc_resume(opt.out_of_core, &sys, &ckpt)) return 1;
+        } else if (!checkpoint_read(opt.restart, &sys, &ckpt)) {
+            return 1;
+        }
+        if (ckpt.version_id != version_id || (N != 0 && sys.N != N)) {
+            fprintf(stderr, "Checkpoint is for v%d with N=%d.\n",
+                    ckpt.version_id, sys.N);
+            return 1;
+        }
+        dt         = ckpt.dt;
+        theta      = ckpt.theta;
+        opt.tracer_mass = ckpt.tracer_mass;
+        opt.heavy_mass  = ckpt.heavy_mass;
+        opt.outlier_radius = ckpt.outlier_radius;
+        opt.external    = ckpt.external;
+        k_clusters = ckpt.k_clusters;
+        start_step = ckpt.step;
+        barnes_hut_set_state(&ckpt.bh);
+        if (want_ids && !sys.id) {
+            fprintf(stderr, "Checkpoint %s has no particle ids.\n",
+                    opt.restart);
+            return 1;
+        }
+    } else {
+        GalInfo info;
+        if (opt.out_of_core) {
+            if (!ooc_load(filename, N, opt.out_of_core, &sys, &info)) return 1;
+        } else {
+            sys = io_read_particles(filename, N, &info);
+        }
+        /* A Morton-flagged v2 input was sorted in this box; starting from
+         * it makes the first z_order_sort a no-op. */
+        if (version_id == 2 && k_clusters == 0 && info.morton_sorted &&
+            info.has_bbox) {
+            BHState bh = { 1, sys.N, info.bbox[0], info.bbox[1],
+                           info.bbox[2], info.bbox[3], -1.0 };
+            barnes_hut_set_state(&bh);
+        }
+        if (info.version == 2)
+            printf("Input: .gal v2%s\n",
+                   info.morton_sorted ? " (Morton-sorted)" : "");
+        else if (info.version == 0)
+            printf("Input: text\n");
+        else if (info.version == 3)
+            printf("Input: .ntc frame (Morton-sorted)\n");
+        if (sys.id)
+            printf("Input: particle ids\n");
+        else if (want_ids)
+            ids_init(&sys);
+    }
+    t_load = sim_time_now() - t_load;
+
+    KernelConfig config = { theta, n_threads, k_clusters, start_step * dt,
+                            NULL, opt.tracer_mass, opt.heavy_mass,
+                            opt.outlier_radius };
 
     printf("Running v%d | N=%d | Steps=%d | Threads=%d\n",
            version_id, sys.N, nsteps, n_threads);
     printf("dt=%.1e | theta=%.2f | k=%d\n", dt, theta, k_clusters);
+    int n_tracers = 0;
+    for (int i = 0; i < sys.N; i++)
+        if (sys.mass[i] <= config.tracer_mass) n_tracers++;
+    if (n_tracers > 0)
+        printf("Tracers: %d of %d bodies (mass <= %g) feel gravity only\n",
+               n_tracers, sys.N, config.tracer_mass);
+    if (opt.external.kind != EXTERNAL_NONE) {
+        char desc[160];
+        external_describe(&opt.external, desc, sizeof(desc));
+        printf("External potential: %s\n", desc);
+    }
+    if (version_id == 2 && config.heavy_mass > 0.0) {
+        int n_heavy = 0;
+        for (int i = 0; i < sys.N; i++)
+            if (sys.mass[i] > config.heavy_mass) n_heavy++;
+        printf("Direct: %d bodies (mass > %g) summed outside the tree\n",
+               n_heavy, config.heavy_mass);
+    }
+    if (version_id == 2 && config.outlier_radius > 0.0)
+        printf("Direct: bodies beyond %g of the centre of mass are summed "
+               "outside the tree\n", config.outlier_radius);
+    printf("Startup: load %.3fs\n", t_load);
+    if (opt.restart)
+        printf("Restarted from %s at step %d\n", opt.restart, start_step);
+
+    const char* label = (version_id == 1) ? "naive" : "barnes_hut";
+    SnapshotConfig snap_cfg = { opt.snapshot_every, opt.snapshot_dt, label,
+                                opt.snapshot_format, opt.traj_error,
+                                config.current_time, opt.lod_depth,
+                                opt.lod_size };
+    if (!snapshot_init(&snap_cfg)) return 1;
+    if (opt.track &&
+        !track_init(opt.track, label, &sys, opt.restart ? start_step : -1))
+        return 1;
+    if (opt.live && !live_open(opt.live, opt.live_slots, sys.N)) return 1;
+    opt.render.label = label;
+    if (!render_init(&opt.render)) return 1;
+    opt.analysis.label = label;
+    if (!analysis_init(&opt.analysis, opt.restart ? start_step : -1))
+        return 1;
+    opt.fof.label = label;
+    if (!fof_init(&opt.fof)) return 1;
 
-    /* Initial force computation */
-    if (version_id == 1) compute_force_naive(&sys, &config);
-    else                 compute_force_barnes_hut(&sys, &config);
+    /* Out of core, the working file itself becomes the checkpoint */
+    char ckpt_name[256];
+    snprintf(ckpt_name, sizeof(ckpt_name), "data/outputs/checkpoint_%s.chk",
+             label);
+    if (opt.out_of_core)
+        snprintf(ckpt_name, sizeof(ckpt_name), "%s", opt.out_of_core);
+    signal(SIGTERM, on_sigterm);
+
+    /* Initial force computation; a checkpoint already holds these forces */
+    if (!opt.restart) {
+        config.potential = analysis_potential(start_step, sys.N);
+        compute_forces(version_id, opt.out_of_core != NULL, &sys, &config);
+        external_set_time(&opt.external, config.current_time);
+        analysis_step(&sys, start_step, config.current_time, config.potential,
+                      &opt.external);
+    }
+    if (opt.live)
+        publish_live(&sys, version_id, start_step, &config,
+                     opt.out_of_core != NULL);
 
     double t_start = sim_time_now();
 
-    for (int step = 0; step < nsteps; step++) {
+    int  step;
+    int  term_step  = -1;      /* steps done when SIGTERM stopped the run */
+    bool term_saved = false;
+    for (step = start_step; step < nsteps; step++) {
         /* Velocity Verlet: half kick, full drift, recompute forces, half kick */
-        integrate_positions(&sys, dt);
+        external_set_time(&opt.external, step * dt);
+        integrate_positions(&sys, dt, &opt.external);
 
         config.current_time = (step + 1) * dt;
+        config.potential    = analysis_potential(step + 1, sys.N);
+
+        compute_forces(version_id, opt.out_of_core != NULL, &sys, &config);
+
+        external_set_time(&opt.external, config.current_time);
+        integrate_velocities(&sys, dt, &opt.external);
 
-        if (version_id == 1) compute_force_naive(&sys, &config);
-        else                 compute_force_barnes_hut(&sys, &config);
+        /* Stages a copy for the I/O thread; the loop does not wait on disk */
+        snapshot_step(&sys, step + 1, config.current_time);
+        track_step(&sys, step + 1, config.current_time);
+        render_step(&sys, step + 1);
+        analysis_step(&sys, step + 1, config.current_time, config.potential,
+                      &opt.external);
+        fof_step(&sys, step + 1);
+        if (opt.live && (step + 1) % opt.live_every == 0)
+            publish_live(&sys, version_id, step + 1, &config,
+                         opt.out_of_core != NULL);
 
-        integrate_velocities(&sys, dt);
+        /* Read the flag once: the handler may set it at any point */
+        if (term_requested) {
+            /* Wait for the write, so the exit message can vouch for it */
+            int failed = async_io_drain();
+            term_step  = step + 1;
+            term_saved = save_checkpoint(ckpt_name, &sys, version_id,
+                                         term_step, dt, &config,
+                                         &opt.external,
+                                         opt.out_of_core != NULL) &&
+                         async_io_drain() == failed;
+            break;
+        }
+        if (opt.checkpoint_every > 0 && (step + 1) % opt.checkpoint_every == 0)
+            save_checkpoint(ckpt_name, &sys, version_id, step + 1, dt, &config,
+                            &opt.external, opt.out_of_core != NULL);
 
         if (step % 50 == 0)
             printf("Step %d/%d\r", step, nsteps);
         fflush(stdout);
     }
 
+    if (term_step >= 0) {
+        if (term_saved)
+            printf("\nSIGTERM: checkpointed step %d to %s\n", term_step,
+                   ckpt_name);
+        else
+            fprintf(stderr, "\nSIGTERM: failed to checkpoint step %d to %s\n",
+                    term_step, ckpt_name);
+        snapshot_finish();
+        track_finish();
+        render_finish();
+        analysis_finish();
+        fof_finish();
+        live_close();
+        report_io();
+        if (opt.out_of_core) ooc_close(&sys);
+        else                 io_free_particles(&sys);
+        free(ext_ax);
+        free(ext_ay);
+        return 128 + SIGTERM;
+    }
+
     printf("\nSimulation Complete: %.2fs\n", sim_time_now() - t_start);
+    snapshot_finish();
+    track_finish();
+    render_finish();
+    analysis_finish();
+    fof_finish();
+    live_close();
+    report_io();
 
-    char out_name[64];
-    const char* label = (version_id == 1) ? "naive" : "barnes_hut";
-    snprintf(out_name, sizeof(out_name), "data/outputs/result_%s.gal", label);
-    io_write_result(out_name, &sys);
-    io_free_particles(&sys);
-    return 0;
+    char out_name[256];
+    if (opt.output)
+        snprintf(out_name, sizeof(out_name), "%s", opt.output);
+    else
+        snprintf(out_name, sizeof(out_name), "data/outputs/result_%s.gal",
+                 label);
+    bool in_input_order = strcmp(opt.output_order, "input") == 0;
+    if (in_input_order && !ids_restore_order(&sys)) return 1;
+    bool written;
+    if (strcmp(opt.output_format, "gal") == 0) {
+        written = io_write_result(out_name, &sys);
+    } else if (strcmp(opt.output_format, "csv") == 0) {
+        written = io_write_csv(out_name, &sys);
+    } else {
+        /* The arrays are still in the order of the last z_order_sort */
+        BHState bh;
+        barnes_hut_get_state(&bh);
+        GalWriteOptions wopt;
+        wopt.type = strcmp(opt.output_format, "gal2-f32") == 0 ? GAL_FLOAT32
+                                                               : GAL_FLOAT64;
+        wopt.morton_sorted = version_id == 2 && k_clusters == 0 &&
+                             !in_input_order;
+        wopt.has_bbox      = version_id == 2 && bh.domain_valid;
+        wopt.bbox[0] = bh.x_min;
+        wopt.bbox[1] = bh.x_max;
+        wopt.bbox[2] = bh.y_min;
+        wopt.bbox[3] = bh.y_max;
+        written = io_write_gal2(out_name, &sys, &wopt);
+    }
+    if (opt.out_of_core) {
+        /* Leave the working file as a checkpoint of the final state */
+        save_checkpoint(ckpt_name, &sys, version_id, step, dt, &config,
+                        &opt.external, true);
+        ooc_close(&sys);
+    } else {
+        io_free_particles(&sys);
+    }
+    free(ext_ax);
+    free(ext_ay);
+    return written ? 0 : 1;
+}
+
+/** Pull --name value options out of argv.
+ * Returns the number of remaining (positional) arguments, or 0 on error.
+ * ----------------------------------------------------------------- */
+static int parse_options(int argc, char* argv[], RunOptions* opt) {
+    int out = 1;
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--", 2) != 0) {
+            argv[out++] = argv[i];
+            continue;
+        }
+        if (i + 1 >= argc) {
+            fprintf(stderr, "Missing value for %s\n", argv[i]);
+            return 0;
+        }
+        const char* name  = argv[i];
+        const char* value = argv[++i];
+        char* end = NULL;
+        if (strcmp(name, "--snapshot-every") == 0) {
+            opt->snapshot_every = (int)strtol(value, &end, 10);
+            if (end == value || *end != '\0' || opt->snapshot_every < 0) return 0;
+        } else if (strcmp(name, "--snapshot-dt") == 0) {
+            opt->snapshot_dt = strtod(value, &end);
+            if (end == value || *end != '\0' || opt->snapshot_dt < 0.0) return 0;
+        } else if (strcmp(name, "--snapshot-format") == 0) {
+            if (strcmp(value, "gal") == 0)       opt->snapshot_format = SNAPSHOT_GAL;
+            else if (strcmp(value, "traj") == 0) opt->snapshot_format = SNAPSHOT_TRAJ;
+            else if (strcmp(value, "ntc") == 0)  opt->snapshot_format = SNAPSHOT_NTC;
+            else if (strcmp(value, "indexed") == 0)
+                opt->snapshot_format = SNAPSHOT_INDEXED;
+            else if (strcmp(value, "lod") == 0)  opt->snapshot_format = SNAPSHOT_LOD;
+            else return 0;
+        } else if (strcmp(name, "--checkpoint-every") == 0) {
+            opt->checkpoint_every = (int)strtol(value, &end, 10);
+            if (end == value || *end != '\0' || opt->checkpoint_every < 0) return 0;
+        } else if (strcmp(name, "--output-format") == 0) {
+            if (strcmp(value, "gal") != 0 && strcmp(value, "gal2") != 0 &&
+                strcmp(value, "gal2-f32") != 0 && strcmp(value, "csv") != 0)
+                return 0;
+            opt->output_format = value;
+        } else if (strcmp(name, "--restart") == 0) {
+            opt->restart = value;
+        } else if (strcmp(name, "--out-of-core") == 0) {
+            opt->out_of_core = value;
+        } else if (strcmp(name, "--output") == 0) {
+            opt->output = value;
+        } else if (strcmp(name, "--output-order") == 0) {
+            if (strcmp(value, "run") != 0 && strcmp(value, "input") != 0 &&
+                strcmp(value, "ids") != 0)
+                return 0;
+            opt->output_order = value;
+        } else if (strcmp(name, "--render-every") == 0) {
+            opt->render.every_steps = (int)strtol(value, &end, 10);
+            if (end == value || *end != '\0' || opt->render.every_steps < 0)
+                return 0;
+        } else if (strcmp(name, "--render-size") == 0) {
+            if (sscanf(value, "%dx%d", &opt->render.width,
+                       &opt->render.height) != 2 ||
+                opt->render.width <= 0 || opt->render.height <= 0 ||
+                opt->render.width > 16384 || opt->render.height > 16384)
+                return 0;
+        } else if (strcmp(name, "--render-format") == 0) {
+            if (strcmp(value, "png") == 0)      opt->render.format = RENDER_PNG;
+            else if (strcmp(value, "pgm") == 0) opt->render.format = RENDER_PGM;
+            else return 0;
+        } else if (strcmp(name, "--render-scale") == 0) {
+            if (strcmp(value, "log") == 0)         opt->render.log_scale = 1;
+            else if (strcmp(value, "linear") == 0) opt->render.log_scale = 0;
+            else return 0;
+        } else if (strcmp(name, "--render-weight") == 0) {
+            if (strcmp(value, "mass") == 0)  opt->render.use_brightness = 0;
+            else if (strcmp(value, "brightness") == 0)
+                opt->render.use_brightness = 1;
+            else return 0;
+        } else if (strcmp(name, "--render-box") == 0) {
+            double* b = opt->render.box;
+            if (sscanf(value, "%lf,%lf,%lf,%lf", &b[0], &b[1], &b[2],
+                       &b[3]) != 4 || !(b[1] > b[0]) || !(b[3] > b[2]))
+                return 0;
+            opt->render.has_box = 1;
+        } else if (strcmp(name, "--analysis-every") == 0) {
+            opt->analysis.every_steps = (int)strtol(value, &end, 10);
+            if (end == value || *end != '\0' || opt->analysis.every_steps < 0)
+                return 0;
+        } else if (strcmp(name, "--analysis-bins") == 0) {
+            opt->analysis.n_bins = (int)strtol(value, &end, 10);
+            if (end == value || *end != '\0' || opt->analysis.n_bins <= 0)
+                return 0;
+        } else if (strcmp(name, "--analysis-rmax") == 0) {
+            opt->analysis.r_max = strtod(value, &end);
+            if (end == value || *end != '\0' || opt->analysis.r_max < 0.0)
+                return 0;
+        } else if (strcmp(name, "--fof-every") == 0) {
+            opt->fof.every_steps = (int)strtol(value, &end, 10);
+            if (end == value || *end != '\0' || opt->fof.every_steps < 0)
+                return 0;
+        } else if (strcmp(name, "--fof-link") == 0) {
+            opt->fof.link = strtod(value, &end);
+            if (end == value || *end != '\0' || opt->fof.link < 0.0) return 0;
+        } else if (strcmp(name, "--fof-min") == 0) {
+            opt->fof.min_members = (int)strtol(value, &end, 10);
+            if (end == value || *end != '\0' || opt->fof.min_members < 1)
+                return 0;
+        } else if (strcmp(name, "--tracer-mass") == 0) {
+            opt->tracer_mass = strtod(value, &end);
+            if (end == value || *end != '\0' || opt->tracer_mass < 0.0)
+                return 0;
+        } else if (strcmp(name, "--heavy-mass") == 0) {
+            opt->heavy_mass = strtod(value, &end);
+            if (end == value || *end != '\0' || opt->heavy_mass < 0.0)
+                return 0;
+        } else if (strcmp(name, "--outlier-radius") == 0) {
+            opt->outlier_radius = strtod(value, &end);
+            if (end == value || *end != '\0' || opt->outlier_radius < 0.0)
+                return 0;
+        } else if (strcmp(name, "--external") == 0) {
+            double x0 = opt->external.x0, y0 = opt->external.y0;
+            if (!external_parse(value, &opt->external)) return 0;
+            opt->external.x0 = x0;
+            opt->external.y0 = y0;
+        } else if (strcmp(name, "--external-centre") == 0) {
+            if (sscanf(value, "%lf,%lf", &opt->external.x0,
+                       &opt->external.y0) != 2)
+                return 0;
+        } else if (strcmp(name, "--live") == 0) {
+            opt->live = value;
+        } else if (strcmp(name, "--live-every") == 0) {
+            opt->live_every = (int)strtol(value, &end, 10);
+            if (end == value || *end != '\0' || opt->live_every <= 0) return 0;
+        } else if (strcmp(name, "--live-slots") == 0) {
+            opt->live_slots = (int)strtol(value, &end, 10);
+            if (end == value || *end != '\0' || opt->live_slots < 2) return 0;
+        } else if (strcmp(name, "--track") == 0) {
+            opt->track = value;
+        } else if (strcmp(name, "--lod-depth") == 0) {
+            opt->lod_depth = (int)strtol(value, &end, 10);
+            if (end == value || *end != '\0' || opt->lod_depth < 0) return 0;
+        } else if (strcmp(name, "--lod-size") == 0) {
+            opt->lod_size = strtod(value, &end);
+            if (end == value || *end != '\0' || opt->lod_size < 0.0) return 0;
+        } else if (strcmp(name, "--traj-error") == 0) {
+            opt->traj_error = strtod(value, &end);
+            if (end == value || *end != '\0' || opt->traj_error <= 0.0) return 0;
+        } else {
+            fprintf(stderr, "Unknown option %s\n", name);
+            return 0;
+        }
+    }
+    return out;
+}
+
+static void on_sigterm(int sig) {
+    (void)sig;
+    term_requested = 1;
+}
+
+static void compute_forces(int version_id, bool out_of_core,
+                           ParticleSystem* sys, KernelConfig* config) {
+    if (version_id == 1)  compute_force_naive(sys, config);
+    else if (out_of_core) compute_force_barnes_hut_ooc(sys, config);
+    else                  compute_force_barnes_hut(sys, config);
+}
+
+/** Queue a checkpoint of the state after step completed steps, or with
+ * in_place stamp the out-of-core working file as one. Returns false when
+ * it could not be queued or stamped.
+ * ----------------------------------------------------------------- */
+static bool save_checkpoint(const char* path, const ParticleSystem* sys,
+                            int version_id, int step, double dt,
+                            const KernelConfig* config,
+                            const ExternalPotential* ext, bool in_place) {
+    CheckpointState state;
+    state.version_id   = version_id;
+    state.step         = step;
+    state.k_clusters   = config->k_clusters;
+    state.dt           = dt;
+    state.theta        = config->theta_max;
+    state.current_time = config->current_time;
+    state.tracer_mass  = config->tracer_mass;
+    state.heavy_mass   = config->heavy_mass;
+    state.outlier_radius = config->outlier_radius;
+    state.external     = *ext;
+    barnes_hut_get_state(&state.bh);
+
+    if (in_place)
+        return ooc_sync(sys, &state);
+    if (!async_io_start()) return false;
+    checkpoint_write_async(path, sys, &state);
+    return true;
+}
+
+/** Hand the state to live consumers. In memory with k=0, Barnes-Hut
+ * arrays are in Z-order of the tree domain, which the frame records.
+ * ----------------------------------------------------------------- */
+static void publish_live(const ParticleSystem* sys, int version_id,
+                         int step, const KernelConfig* config,
+                         bool out_of_core) {
+    BHState bh;
+    barnes_hut_get_state(&bh);
+    double box[4] = { bh.x_min, bh.x_max, bh.y_min, bh.y_max };
+    bool in_box = version_id == 2 && bh.domain_valid && bh.domain_N == sys->N;
+    live_publish(sys, step, config->current_time, in_box ? box : NULL,
+                 in_box && config->k_clusters == 0 && !out_of_core);
+}
+
+/** Stop the background writer and summarise what it did.
+ * ----------------------------------------------------------------- */
+static void report_io(void) {
+    AsyncIOStats st;
+    async_io_stop(&st);
+    if (st.files_written == 0 && st.write_errors == 0)
+        return;
+    printf("Background I/O: %d writes (%.2fs)", st.files_written,
+           st.write_time);
+    if (st.write_errors > 0)
+        printf(" | %d FAILED", st.write_errors);
+    printf("\n");
+    if (st.stalls > 0)
+        printf("I/O back-pressure: %d stalls, %.2fs waiting for the writer; "
+               "consider a longer cadence.\n", st.stalls, st.stall_time);
 }
 
 /** Velocity Verlet half-kick + full drift
- * Updates velocities by half a step then advances positions.
+ * Updates velocities by half a step then advances positions. Massless
+ * tracers carry their acceleration in fx, fy; the external field adds
+ * its acceleration at the same positions, oriented by the caller, or
+ * the one the last second kick cached there.
  * ----------------------------------------------------------------- */
-static void integrate_positions(ParticleSystem* sys, double dt) {
+static void integrate_positions(ParticleSystem* sys, double dt,
+                                const ExternalPotential* ext) {
     int N = sys->N;
+    bool cached = ext_cached;
+    ext_cached = false;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
     for (int i = 0; i < N; i++) {
-        double m_inv = 1.0 / sys->mass[i];
-        sys->vx[i] += 0.5 * dt * sys->fx[i] * m_inv;
-        sys->vy[i] += 0.5 * dt * sys->fy[i] * m_inv;
+        double m_inv = sys->mass[i] > 0.0 ? 1.0 / sys->mass[i] : 1.0;
+        double ax = 0.0, ay = 0.0;
+        if (cached) {
+            ax = ext_ax[i];
+            ay = ext_ay[i];
+        } else {
+            external_accel(ext, sys->pos_x[i], sys->pos_y[i], &ax, &ay);
+        }
+        sys->vx[i] += 0.5 * dt * sys->fx[i] * m_inv + 0.5 * dt * ax;
+        sys->vy[i] += 0.5 * dt * sys->fy[i] * m_inv + 0.5 * dt * ay;
         sys->pos_x[i] += dt * sys->vx[i];
         sys->pos_y[i] += dt * sys->vy[i];
     }
 }
 
 /** Velocity Verlet second half-kick
- * Completes the velocity update after new forces are computed.
+ * Completes the velocity update after new forces are computed, and keeps
+ * the external acceleration for the next step's first kick.
  * ----------------------------------------------------------------- */
-static void integrate_velocities(ParticleSystem* sys, double dt) {
+static void integrate_velocities(ParticleSystem* sys, double dt,
+                                 const ExternalPotential* ext) {
     int N = sys->N;
+    bool cache = ext->kind != EXTERNAL_NONE;
+    if (cache && ext_cap < N) {
+        free(ext_ax);
+        free(ext_ay);
+        ext_ax = malloc((size_t)N * sizeof(double));
+        ext_ay = malloc((size_t)N * sizeof(double));
+        if (!ext_ax || !ext_ay) {
+            fprintf(stderr, "Error: Memory allocation failed for the "
+                            "external field.\n");
+            exit(1);
+        }
+        ext_cap = N;
+    }
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
     for (int i = 0; i < N; i++) {
-        double m_inv = 1.0 / sys->mass[i];
-        sys->vx[i] += 0.5 * dt * sys->fx[i] * m_inv;
-        sys->vy[i] += 0.5 * dt * sys->fy[i] * m_inv;
+        double m_inv = sys->mass[i] > 0.0 ? 1.0 / sys->mass[i] : 1.0;
+        double ax = 0.0, ay = 0.0;
+        external_accel(ext, sys->pos_x[i], sys->pos_y[i], &ax, &ay);
+        if (cache) {
+            ext_ax[i] = ax;
+            ext_ay[i] = ay;
+        }
+        sys->vx[i] += 0.5 * dt * sys->fx[i] * m_inv + 0.5 * dt * ax;
+        sys->vy[i] += 0.5 * dt * sys->fy[i] * m_inv + 0.5 * dt * ay;
     }
 }
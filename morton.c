@@ -1,20 +1,9 @@
 #include "morton.h"
+#include "ids.h"
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
-/** Interleave x and y bits into a 64-bit Morton (Z-order) code.
- * ----------------------------------------------------------------- */
-static uint64_t morton_encode(unsigned int x, unsigned int y) {
-    uint64_t code = 0;
-    for (uint64_t i = 0; i < 32; i++) {
-        uint64_t x_bit = (x >> i) & 1;
-        uint64_t y_bit = (y >> i) & 1;
-        code |= (x_bit << (2 * i)) | (y_bit << (2 * i + 1));
-    }
-    return code;
-}
-
 typedef struct {
     int      index;
     uint64_t code;
@@ -28,6 +17,30 @@ static int compare_entries(const void* a, const void* b) {
     return 0;
 }
 
+/* Code first, then input index, for a stable order */
+static int compare_stable(const void* a, const void* b) {
+    int c = compare_entries(a, b);
+    if (c != 0) return c;
+    return ((SortEntry*)a)->index - ((SortEntry*)b)->index;
+}
+
+void morton_order(const double* x, const double* y, int n,
+                  const double box[4], int* order) {
+    SortEntry* entries = (SortEntry*)malloc((size_t)n * sizeof(SortEntry));
+    if (!entries) {
+        for (int i = 0; i < n; i++) order[i] = i;
+        return;
+    }
+    for (int i = 0; i < n; i++) {
+        entries[i].index = i;
+        entries[i].code  = morton_code(x[i], y[i], box[0], box[1], box[2],
+                                       box[3]);
+    }
+    qsort(entries, (size_t)n, sizeof(SortEntry), compare_stable);
+    for (int i = 0; i < n; i++) order[i] = entries[i].index;
+    free(entries);
+}
+
 /** Reorder all particle arrays by Z-order curve within the given bounding box.
  * Nearby particles in space end up nearby in memory after this sort.
  * ----------------------------------------------------------------- */
@@ -40,10 +53,20 @@ void z_order_sort(ParticleSystem* sys, double LB, double RB, double DB, double U
     double scale_y = (double)((1ULL << 32) - 1) / (UB - DB);
 
     for (int i = 0; i < N; i++) {
-        unsigned int ix = (unsigned int)((sys->pos_x[i] - LB) * scale_x);
-        unsigned int iy = (unsigned int)((sys->pos_y[i] - DB) * scale_y);
+        uint32_t ix = morton_cell(sys->pos_x[i], LB, scale_x);
+        uint32_t iy = morton_cell(sys->pos_y[i], DB, scale_y);
         entries[i].index = i;
-        entries[i].code  = morton_encode(ix, iy);
+        entries[i].code  = morton_spread(ix) | (morton_spread(iy) << 1);
+    }
+
+    /* Input that is already in Z-order (e.g. a Morton-flagged .gal v2
+     * file, or a step where nobody crossed a cell) needs no permutation */
+    int sorted = 1;
+    for (int i = 1; i < N && sorted; i++)
+        if (entries[i - 1].code > entries[i].code) sorted = 0;
+    if (sorted) {
+        free(entries);
+        return;
     }
 
     qsort(entries, N, sizeof(SortEntry), compare_entries);
@@ -73,6 +96,15 @@ void z_order_sort(ParticleSystem* sys, double LB, double RB, double DB, double U
     for (int i = 0; i < N; i++) temp[i] = sys->fy[entries[i].index];
     memcpy(sys->fy, temp, N * sizeof(double));
 
+    for (int i = 0; i < N; i++) temp[i] = sys->brightness[entries[i].index];
+    memcpy(sys->brightness, temp, N * sizeof(double));
+
+    if (sys->id) {
+        int* order = (int*)temp;
+        for (int i = 0; i < N; i++) order[i] = entries[i].index;
+        ids_permute(sys, order);
+    }
+
     free(temp);
     free(entries);
 }
@@ -2,9 +2,44 @@
 #define MORTON_H
 
 #include "types.h"
+#include <stdint.h>
 
 // Reorder particles by Morton code within the given bounding box.
 void z_order_sort(ParticleSystem* sys, double LB, double RB, double DB,
                   double UB);
 
+// order = the indices of the n points (x, y) sorted by Morton code within
+// the box x_min, x_max, y_min, y_max; ties keep their input order.
+void morton_order(const double* x, const double* y, int n,
+                  const double box[4], int* order);
+
+/* Spread the 32 bits of v over the even bits of a 64-bit word */
+static inline uint64_t morton_spread(uint32_t v) {
+    uint64_t x = v;
+    x = (x | (x << 16)) & 0x0000FFFF0000FFFFULL;
+    x = (x | (x << 8))  & 0x00FF00FF00FF00FFULL;
+    x = (x | (x << 4))  & 0x0F0F0F0F0F0F0F0FULL;
+    x = (x | (x << 2))  & 0x3333333333333333ULL;
+    x = (x | (x << 1))  & 0x5555555555555555ULL;
+    return x;
+}
+
+/* Grid coordinate of p on 2^32 cells over [lo, lo + 1/scale], clamped */
+static inline uint32_t morton_cell(double p, double lo, double scale) {
+    double c = (p - lo) * scale;
+    if (!(c > 0.0)) return 0;
+    if (c >= 4294967295.0) return 0xFFFFFFFFu;
+    return (uint32_t)c;
+}
+
+// Morton (Z-order) code of (x, y) on a 2^32 x 2^32 grid over the box;
+// points outside the box are clamped onto its edge.
+static inline uint64_t morton_code(double x, double y, double LB, double RB,
+                                   double DB, double UB) {
+    double sx = 4294967295.0 / (RB - LB);
+    double sy = 4294967295.0 / (UB - DB);
+    return morton_spread(morton_cell(x, LB, sx)) |
+           (morton_spread(morton_cell(y, DB, sy)) << 1);
+}
+
 #endif
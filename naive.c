@@ -4,9 +4,10 @@
 #define G_FACTOR 100.0
 #define EPSILON  1e-3
 
-/* Brute-force baseline, O(N^2) complexity. */
+/* Brute-force baseline, O(N^2) complexity. Tracers (mass at most
+ * config->tracer_mass) are skipped as sources; a massless one gets the
+ * force on a unit mass, its acceleration. */
 void compute_force_naive(ParticleSystem* sys, KernelConfig* config) {
-    (void)config;
     const int N = sys->N;
     const double G = G_FACTOR / N;
 
@@ -15,14 +16,18 @@ void compute_force_naive(ParticleSystem* sys, KernelConfig* config) {
     const double* m = sys->mass;
     double* fx_out = sys->fx;
     double* fy_out = sys->fy;
+    double* pot    = config->potential;
+    const double tracer = config->tracer_mass;
 
     for (int i = 0; i < N; i++) {
         double fx = 0.0;
         double fy = 0.0;
+        double phi = 0.0;
+        const double mi = m[i] > 0.0 ? m[i] : 1.0;
 
         // Direct all-pairs interaction: accumulate the force on particle i.
         for (int j = 0; j < N; j++) {
-            if (i == j)
+            if (i == j || m[j] <= tracer)
                 continue;
 
             const double dx = x[j] - x[i];
@@ -30,11 +35,14 @@ void compute_force_naive(ParticleSystem* sys, KernelConfig* config) {
             const double r = sqrt(dx * dx + dy * dy);
             const double denom = r + EPSILON;
 
-            const double f = G * m[i] * m[j] / (denom * denom * denom);
+            const double f = G * mi * m[j] / (denom * denom * denom);
             fx += f * dx;
             fy += f * dy;
+            if (pot)
+                phi -= G * m[j] * (r + denom) / (2.0 * denom * denom);
         }
         fx_out[i] = fx;
         fy_out[i] = fy;
+        if (pot) pot[i] = phi;
     }
 }
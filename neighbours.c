@@ -0,0 +1,383 @@
+#include "neighbours.h"
+#include "barnes_hut.h"
+#include "ds.h"
+#include "morton.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#define QUERY_GROUP 32   /* consecutive radius queries sharing a tree walk */
+#define KNN_CHUNK   64   /* kNN queries per scheduling chunk */
+
+/* Per-thread radius results before they are packed into rows */
+typedef struct {
+    int*    index;
+    double* dist;
+    size_t  len, cap;
+} Hits;
+
+/* Scratch shared by a batch, kept between calls */
+static int*    owner        = NULL;   /* see barnes_hut_leaf_owners */
+static int*    first_hidden = NULL;   /* per owner: first merged particle */
+static int*    next_hidden  = NULL;   /* per merged particle: the next one */
+static int     particle_cap = 0;
+static int     any_hidden   = 0;
+static int*    order        = NULL;   /* queries in processing order */
+static size_t* start        = NULL;   /* per query: first hit in its thread */
+static int     query_cap    = 0;
+
+static bool prepare(const ParticleSystem* sys, const double* qx,
+                    const double* qy, int n, bool exclude_self);
+static int  next_in_leaf(int o, int j);
+static void push_hit(Hits* h, int j, double d);
+static void heap_offer(int* hi, double* hd, int* count, int k, int j,
+                       double d2);
+static void* grow(void* p, size_t bytes);
+
+/** Every QUERY_GROUP queries in Morton order make one tree walk for all
+ * particles within r of their bounding box, then filter that list per
+ * query. Hits go to per-thread buffers; a second pass with the same
+ * static schedule copies them into the rows once the sizes are known.
+ * ----------------------------------------------------------------- */
+bool neighbours_radius(const ParticleSystem* sys, const double* qx,
+                       const double* qy, int n, double r, bool exclude_self,
+                       NeighbourList* out) {
+    if (!prepare(sys, qx, qy, n, exclude_self))
+        return false;
+    out->n_queries = n;
+    out->offset = grow(out->offset, ((size_t)n + 1) * sizeof(size_t));
+    out->offset[0] = 0;
+    double r2 = r * r;
+    int n_groups = (n + QUERY_GROUP - 1) / QUERY_GROUP;
+
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
+    {
+        Hits hits = { NULL, NULL, 0, 0 };
+        int  cap  = 1024;
+        int* near = grow(NULL, (size_t)cap * sizeof(int));
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+        for (int g = 0; g < n_groups; g++) {
+            int lo = g * QUERY_GROUP;
+            int hi = lo + QUERY_GROUP < n ? lo + QUERY_GROUP : n;
+            double box[4] = { qx[order[lo]], qx[order[lo]],
+                              qy[order[lo]], qy[order[lo]] };
+            for (int k = lo + 1; k < hi; k++) {
+                int q = order[k];
+                if (qx[q] < box[0]) box[0] = qx[q];
+                if (qx[q] > box[1]) box[1] = qx[q];
+                if (qy[q] < box[2]) box[2] = qy[q];
+                if (qy[q] > box[3]) box[3] = qy[q];
+            }
+            int m = barnes_hut_within(sys, box, r, near, cap);
+            if (m > cap) {
+                cap  = m * 2;
+                near = grow(near, (size_t)cap * sizeof(int));
+                m = barnes_hut_within(sys, box, r, near, cap);
+            }
+            for (int k = lo; k < hi; k++) {
+                int q = order[k];
+                int self = exclude_self ? q : -1;
+                start[q] = hits.len;
+                for (int c = 0; c < m; c++) {
+                    int o = near[c];
+                    for (int j = o; j >= 0; j = next_in_leaf(o, j)) {
+                        double dx = sys->pos_x[j] - qx[q];
+                        double dy = sys->pos_y[j] - qy[q];
+                        double d2 = dx * dx + dy * dy;
+                        if (j != self && d2 <= r2)
+                            push_hit(&hits, j, sqrt(d2));
+                    }
+                }
+                out->offset[q + 1] = hits.len - start[q];
+            }
+        }
+
+#ifdef _OPENMP
+#pragma omp single
+#endif
+        {
+            for (int q = 0; q < n; q++)
+                out->offset[q + 1] += out->offset[q];
+            size_t total = out->offset[n];
+            if (total > out->cap) {
+                out->index = grow(out->index, total * sizeof(int));
+                out->dist  = grow(out->dist, total * sizeof(double));
+                out->cap   = total;
+            }
+        }
+
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+        for (int g = 0; g < n_groups; g++) {
+            int lo = g * QUERY_GROUP;
+            int hi = lo + QUERY_GROUP < n ? lo + QUERY_GROUP : n;
+            for (int k = lo; k < hi; k++) {
+                int q = order[k];
+                size_t len = out->offset[q + 1] - out->offset[q];
+                memcpy(out->index + out->offset[q], hits.index + start[q],
+                       len * sizeof(int));
+                memcpy(out->dist + out->offset[q], hits.dist + start[q],
+                       len * sizeof(double));
+            }
+        }
+        free(hits.index);
+        free(hits.dist);
+        free(near);
+    }
+    return true;
+}
+
+/** Depth-first walk per query with a bounded max-heap of the k best.
+ * Queries come in Morton order, so the previous query's neighbours are
+ * close by: the k-th nearest of them bounds the search radius before
+ * the walk starts. Children are visited nearest first, and a cell is
+ * skipped once it lies beyond that bound or the heap's current top.
+ * ----------------------------------------------------------------- */
+bool neighbours_knn(const ParticleSystem* sys, const double* qx,
+                    const double* qy, int n, int k, bool exclude_self,
+                    int* index, double* dist) {
+    if (!prepare(sys, qx, qy, n, exclude_self))
+        return false;
+    const TNode* root = barnes_hut_tree(sys);
+    if (k <= 0)
+        return true;
+
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
+    {
+        int*    hi = grow(NULL, (size_t)k * sizeof(int));
+        double* hd = grow(NULL, (size_t)k * sizeof(double));
+        int prev = -1;
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic, KNN_CHUNK)
+#endif
+        for (int s = 0; s < n; s++) {
+            int q = order[s];
+            int self = exclude_self ? q : -1;
+            double px = qx[q], py = qy[q];
+            int count = 0;
+
+            /* Seed bound from the previous query's row (and that query
+             * itself when it is a particle). Only bodies in the tree can
+             * be neighbours, so a tracer, heavy body or outlier never
+             * seeds the bound */
+            double seed = INFINITY;
+            if (prev >= 0) {
+                const int* row = index + (size_t)prev * k;
+                for (int a = -1; a < k; a++) {
+                    int j = a < 0 ? (exclude_self ? prev : -1) : row[a];
+                    if (j < 0 || j == self || owner[j] < 0) continue;
+                    double dx = sys->pos_x[j] - px;
+                    double dy = sys->pos_y[j] - py;
+                    heap_offer(hi, hd, &count, k, j, dx * dx + dy * dy);
+                }
+                if (count == k) seed = hd[0];
+                count = 0;
+            }
+
+            const TNode* stack[256];
+            double       gap[256];
+            int sp = 0;
+            stack[sp] = root;
+            gap[sp++] = 0.0;
+            while (sp > 0) {
+                const TNode* node = stack[--sp];
+                double bound = count == k && hd[0] < seed ? hd[0] : seed;
+                if (gap[sp] > bound)
+                    continue;
+                int idx = node->particle_idx;
+                if (idx >= 0) {
+                    for (int j = idx; j >= 0; j = next_in_leaf(idx, j)) {
+                        if (j == self) continue;
+                        double dx = sys->pos_x[j] - px;
+                        double dy = sys->pos_y[j] - py;
+                        heap_offer(hi, hd, &count, k, j, dx * dx + dy * dy);
+                    }
+                    continue;
+                }
+                /* Push the children farthest first so the nearest pops
+                 * next. Their boxes are the quadrants of this one, so no
+                 * child is read before it is popped. */
+                double mx = (node->x_min + node->x_max) * 0.5;
+                double my = (node->y_min + node->y_max) * 0.5;
+                double gx[2], gy[2];   /* gap to the low and high halves */
+                gx[0] = px > mx ? px - mx : 0.0;
+                gx[1] = px < mx ? mx - px : 0.0;
+                gy[0] = py > my ? py - my : 0.0;
+                gy[1] = py < my ? my - py : 0.0;
+                double ox = px < node->x_min ? node->x_min - px
+                          : px > node->x_max ? px - node->x_max : 0.0;
+                double oy = py < node->y_min ? node->y_min - py
+                          : py > node->y_max ? py - node->y_max : 0.0;
+                const TNode* child[4];
+                double       cg[4];
+                int nc = 0;
+                for (int c = 0; c < 4; c++) {
+                    const TNode* ch = node->child[c];
+                    if (!ch) continue;
+                    double dx = gx[c & 1] > ox ? gx[c & 1] : ox;
+                    double dy = gy[c >> 1] > oy ? gy[c >> 1] : oy;
+                    double d2 = dx * dx + dy * dy;
+                    int p = nc++;
+                    while (p > 0 && cg[p - 1] < d2) {
+                        child[p] = child[p - 1];
+                        cg[p]    = cg[p - 1];
+                        p--;
+                    }
+                    child[p] = ch;
+                    cg[p]    = d2;
+                }
+                for (int c = 0; c < nc; c++) {
+                    if (cg[c] > bound) continue;
+                    stack[sp] = child[c];
+                    gap[sp++] = cg[c];
+                }
+            }
+
+            /* Pop the heap from the back: farthest goes last */
+            int*    row_i = index + (size_t)q * k;
+            double* row_d = dist + (size_t)q * k;
+            for (int j = count; j < k; j++) {
+                row_i[j] = -1;
+                row_d[j] = INFINITY;
+            }
+            for (int c = count; c > 0; c--) {
+                row_i[c - 1] = hi[0];
+                row_d[c - 1] = sqrt(hd[0]);
+                int last_i = hi[c - 1];
+                double last_d = hd[c - 1];
+                int m = c - 1;   /* heap size after removing the top */
+                int p = 0;
+                for (;;) {
+                    int ch = 2 * p + 1;
+                    if (ch >= m) break;
+                    if (ch + 1 < m && hd[ch + 1] > hd[ch]) ch++;
+                    if (hd[ch] <= last_d) break;
+                    hi[p] = hi[ch];
+                    hd[p] = hd[ch];
+                    p = ch;
+                }
+                hi[p] = last_i;
+                hd[p] = last_d;
+            }
+            prev = q;
+        }
+        free(hi);
+        free(hd);
+    }
+    return true;
+}
+
+void neighbours_free(NeighbourList* list) {
+    free(list->offset);
+    free(list->index);
+    free(list->dist);
+    memset(list, 0, sizeof(*list));
+}
+
+/** Leaf owners and the chains of particles merged into their leaves,
+ * and the processing order: particles are queried in array order,
+ * arbitrary points in Morton order of the tree domain.
+ * ----------------------------------------------------------------- */
+static bool prepare(const ParticleSystem* sys, const double* qx,
+                    const double* qy, int n, bool exclude_self) {
+    int N = sys->N;
+    if (!barnes_hut_tree(sys))
+        return false;
+    if (particle_cap < N) {
+        owner        = grow(owner, (size_t)N * sizeof(int));
+        first_hidden = grow(first_hidden, (size_t)N * sizeof(int));
+        next_hidden  = grow(next_hidden, (size_t)N * sizeof(int));
+        particle_cap = N;
+    }
+    if (query_cap < n) {
+        order = grow(order, (size_t)n * sizeof(int));
+        start = grow(start, (size_t)n * sizeof(size_t));
+        query_cap = n;
+    }
+    barnes_hut_leaf_owners(sys, owner);
+    any_hidden = 0;
+    for (int i = 0; i < N; i++)
+        first_hidden[i] = -1;
+    for (int i = N - 1; i >= 0; i--) {
+        if (owner[i] == i || owner[i] < 0) continue;
+        next_hidden[i] = first_hidden[owner[i]];
+        first_hidden[owner[i]] = i;
+        any_hidden = 1;
+    }
+
+    if (exclude_self) {
+        for (int q = 0; q < n; q++) order[q] = q;
+    } else {
+        BHState bh;
+        barnes_hut_get_state(&bh);
+        double box[4] = { bh.x_min, bh.x_max, bh.y_min, bh.y_max };
+        morton_order(qx, qy, n, box, order);
+    }
+    return true;
+}
+
+/* The particles of the leaf owned by o: o, then those merged into it */
+static int next_in_leaf(int o, int j) {
+    if (!any_hidden) return -1;
+    return j == o ? first_hidden[o] : next_hidden[j];
+}
+
+static void push_hit(Hits* h, int j, double d) {
+    if (h->len == h->cap) {
+        h->cap   = h->cap ? h->cap * 2 : 4096;
+        h->index = grow(h->index, h->cap * sizeof(int));
+        h->dist  = grow(h->dist, h->cap * sizeof(double));
+    }
+    h->index[h->len] = j;
+    h->dist[h->len]  = d;
+    h->len++;
+}
+
+/* Keep j if the heap has room or j is nearer than its top */
+static void heap_offer(int* hi, double* hd, int* count, int k, int j,
+                       double d2) {
+    int p;
+    if (*count < k) {
+        p = (*count)++;
+        while (p > 0 && hd[(p - 1) / 2] < d2) {
+            hi[p] = hi[(p - 1) / 2];
+            hd[p] = hd[(p - 1) / 2];
+            p = (p - 1) / 2;
+        }
+    } else {
+        if (d2 >= hd[0]) return;
+        p = 0;
+        for (;;) {
+            int ch = 2 * p + 1;
+            if (ch >= k) break;
+            if (ch + 1 < k && hd[ch + 1] > hd[ch]) ch++;
+            if (hd[ch] <= d2) break;
+            hi[p] = hi[ch];
+            hd[p] = hd[ch];
+            p = ch;
+        }
+    }
+    hi[p] = j;
+    hd[p] = d2;
+}
+
+static void* grow(void* p, size_t bytes) {
+    void* q = realloc(p, bytes ? bytes : 1);
+    if (!q) {
+        fprintf(stderr, "Error: Memory allocation failed for neighbour "
+                        "queries.\n");
+        exit(1);
+    }
+    return q;
+}
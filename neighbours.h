@@ -0,0 +1,43 @@
+#ifndef NEIGHBOURS_H
+#define NEIGHBOURS_H
+
+#include "types.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Neighbour queries on the Barnes-Hut tree of the last in-core force
+ * pass, for any batch of query points: pass sys->pos_x and sys->pos_y
+ * with n = sys->N and exclude_self to query every particle, leaving
+ * each one out of its own result. Queries run in parallel in Morton
+ * order of the tree domain. Results name particles by their index in
+ * sys, so they hold until the next force pass reorders the arrays.
+ * Tracers, heavy bodies and outliers are not in the tree: they may be
+ * queried but are never found. */
+
+/* Radius results in compressed rows: the neighbours of query q are
+ * index[offset[q] .. offset[q + 1]) with their distances in dist, in
+ * tree order, which for Z-ordered arrays is index order. */
+typedef struct {
+    int     n_queries;
+    size_t* offset;       /* n_queries + 1 entries */
+    int*    index;
+    double* dist;
+    size_t  cap;          /* entries allocated in index and dist */
+} NeighbourList;
+
+// Every particle within r of each query point. out may be reused across
+// calls; it starts zeroed. Returns false when no tree matches sys.
+bool neighbours_radius(const ParticleSystem* sys, const double* qx,
+                       const double* qy, int n, double r, bool exclude_self,
+                       NeighbourList* out);
+
+// The k nearest particles to each query point, nearest first, in
+// index[q * k + j] and dist[q * k + j]; -1 and INFINITY fill the row when
+// fewer than k particles qualify. Returns false when no tree matches sys.
+bool neighbours_knn(const ParticleSystem* sys, const double* qx,
+                    const double* qy, int n, int k, bool exclude_self,
+                    int* index, double* dist);
+
+void neighbours_free(NeighbourList* list);
+
+#endif
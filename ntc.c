@@ -0,0 +1,457 @@
+#include "ntc.h"
+#include "io.h"
+#include "morton.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static void   fill_file_header(NtcFileHeader* fh, uint64_t index_offset,
+                               uint64_t n_frames);
+static bool   write_file_header(int fd, uint64_t index_offset,
+                                uint64_t n_frames);
+static bool   pread_full(int fd, void* buf, size_t len, off_t offset);
+static int    compare_keys(const void* a, const void* b);
+static bool   overlaps(const double* a, const double* b);
+
+size_t ntc_frame_bytes(int N) {
+    size_t n_chunks = ((size_t)N + NTC_CHUNK - 1) / NTC_CHUNK;
+    return sizeof(NtcFrameHeader) + n_chunks * sizeof(NtcChunk) +
+           (size_t)N * IO_RECORD_BYTES;
+}
+
+bool ntc_writer_open(NtcWriter* w, const char* path, double resume_time) {
+    memset(w, 0, sizeof(*w));
+    snprintf(w->path, sizeof(w->path), "%s", path);
+    w->file_bytes = sizeof(NtcFileHeader);
+
+    /* On resume keep the frames up to the checkpoint and drop the index
+     * and any frames an interrupted run wrote past it. */
+    NtcReader r;
+    if (resume_time >= 0.0 && access(path, F_OK) == 0) {
+        if (!ntc_open(&r, path))
+            return false;
+        uint64_t keep = 0;
+        while (keep < r.n_frames &&
+               r.index[keep].time <= resume_time * (1.0 + 1e-12))
+            keep++;
+        if (keep > 0) {
+            w->index_cap = (size_t)keep * 2;
+            w->index = malloc(w->index_cap * sizeof(NtcIndexEntry));
+            if (!w->index) {
+                fprintf(stderr, "Error: Memory allocation failed for "
+                                "container index.\n");
+                exit(1);
+            }
+            memcpy(w->index, r.index, (size_t)keep * sizeof(NtcIndexEntry));
+            w->n_frames   = keep;
+            w->file_bytes = r.index[keep - 1].offset +
+                            ntc_frame_bytes(r.index[keep - 1].N);
+        }
+        ntc_close(&r);
+    }
+
+    int fd = open(path, O_WRONLY | O_CREAT, 0644);
+    if (fd < 0) {
+        perror("Error creating container file");
+        return false;
+    }
+    bool ok = ftruncate(fd, (off_t)w->file_bytes) == 0 &&
+              write_file_header(fd, 0, 0);
+    if (!ok)
+        perror("Error creating container file");
+    close(fd);
+    return ok;
+}
+
+/** Key, sort, chunk and pack one frame into dst.
+ * The keys are checked for order first: Barnes-Hut runs hand over arrays
+ * that are already in Z-order of their domain, so they skip the sort.
+ * ----------------------------------------------------------------- */
+void ntc_stage(NtcWriter* w, const ParticleSystem* sys, int step,
+               double time, const double* key_box, unsigned char* dst) {
+    int N = sys->N;
+    int n_chunks = (N + NTC_CHUNK - 1) / NTC_CHUNK;
+
+    if (w->keys_cap < N) {
+        free(w->keys);
+        w->keys = malloc((size_t)N * sizeof(NtcKey));
+        if (!w->keys) {
+            fprintf(stderr, "Error: Memory allocation failed for container "
+                            "keys.\n");
+            exit(1);
+        }
+        w->keys_cap = N;
+    }
+
+    NtcFrameHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, "NTCF", 4);
+    h.n_chunks = (uint32_t)n_chunks;
+    h.step     = step;
+    h.N        = N;
+    h.time     = time;
+
+    double x_min = 0.0, x_max = 0.0, y_min = 0.0, y_max = 0.0;
+    if (N > 0) {
+        x_min = x_max = sys->pos_x[0];
+        y_min = y_max = sys->pos_y[0];
+    }
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) \
+    reduction(min : x_min, y_min) reduction(max : x_max, y_max)
+#endif
+    for (int i = 0; i < N; i++) {
+        if (sys->pos_x[i] < x_min) x_min = sys->pos_x[i];
+        if (sys->pos_x[i] > x_max) x_max = sys->pos_x[i];
+        if (sys->pos_y[i] < y_min) y_min = sys->pos_y[i];
+        if (sys->pos_y[i] > y_max) y_max = sys->pos_y[i];
+    }
+    h.bbox[0] = x_min;
+    h.bbox[1] = x_max;
+    h.bbox[2] = y_min;
+    h.bbox[3] = y_max;
+    memcpy(h.key_box, key_box ? key_box : h.bbox, sizeof(h.key_box));
+    if (!(h.key_box[1] > h.key_box[0])) h.key_box[1] = h.key_box[0] + 1.0;
+    if (!(h.key_box[3] > h.key_box[2])) h.key_box[3] = h.key_box[2] + 1.0;
+
+    NtcKey* keys = w->keys;
+    int unsorted = 0;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+    for (int i = 0; i < N; i++) {
+        keys[i].key = morton_code(sys->pos_x[i], sys->pos_y[i], h.key_box[0],
+                                  h.key_box[1], h.key_box[2], h.key_box[3]);
+        keys[i].index = i;
+    }
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) reduction(+ : unsorted)
+#endif
+    for (int i = 1; i < N; i++)
+        unsorted += keys[i].key < keys[i - 1].key;
+    if (unsorted > 0)
+        qsort(keys, (size_t)N, sizeof(NtcKey), compare_keys);
+
+    memcpy(dst, &h, sizeof(h));
+    NtcChunk* table = (NtcChunk*)(dst + sizeof(h));
+    unsigned char* records = dst + sizeof(h) + (size_t)n_chunks * sizeof(NtcChunk);
+    uint64_t records_offset = w->file_bytes + (uint64_t)(records - dst);
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+    for (int c = 0; c < n_chunks; c++) {
+        int first = c * NTC_CHUNK;
+        int count = N - first < NTC_CHUNK ? N - first : NTC_CHUNK;
+        NtcChunk e;
+        memset(&e, 0, sizeof(e));
+        e.key_lo = keys[first].key;
+        e.key_hi = keys[first + count - 1].key;
+        e.offset = records_offset + (uint64_t)first * IO_RECORD_BYTES;
+        e.count  = (uint32_t)count;
+        e.bbox[0] = e.bbox[2] = 1e300;
+        e.bbox[1] = e.bbox[3] = -1e300;
+        for (int j = 0; j < count; j++) {
+            int i = keys[first + j].index;
+            double x = sys->pos_x[i], y = sys->pos_y[i];
+            if (x < e.bbox[0]) e.bbox[0] = x;
+            if (x > e.bbox[1]) e.bbox[1] = x;
+            if (y < e.bbox[2]) e.bbox[2] = y;
+            if (y > e.bbox[3]) e.bbox[3] = y;
+            unsigned char* rec = records + (size_t)(first + j) * IO_RECORD_BYTES;
+            memcpy(rec + 0 * sizeof(double), &sys->pos_x[i], sizeof(double));
+            memcpy(rec + 1 * sizeof(double), &sys->pos_y[i], sizeof(double));
+            memcpy(rec + 2 * sizeof(double), &sys->mass[i], sizeof(double));
+            memcpy(rec + 3 * sizeof(double), &sys->vx[i], sizeof(double));
+            memcpy(rec + 4 * sizeof(double), &sys->vy[i], sizeof(double));
+            memcpy(rec + 5 * sizeof(double), &sys->brightness[i],
+                   sizeof(double));
+        }
+        memcpy(&table[c], &e, sizeof(e));
+    }
+
+    if (w->n_frames == w->index_cap) {
+        w->index_cap = w->index_cap ? w->index_cap * 2 : 64;
+        w->index = realloc(w->index, w->index_cap * sizeof(NtcIndexEntry));
+        if (!w->index) {
+            fprintf(stderr, "Error: Memory allocation failed for container "
+                            "index.\n");
+            exit(1);
+        }
+    }
+    NtcIndexEntry* entry = &w->index[w->n_frames++];
+    entry->offset = w->file_bytes;
+    entry->time   = time;
+    entry->step   = step;
+    entry->N      = N;
+    w->file_bytes += ntc_frame_bytes(N);
+}
+
+size_t ntc_file_bytes(int N) {
+    return sizeof(NtcFileHeader) + ntc_frame_bytes(N) +
+           sizeof(NtcIndexEntry);
+}
+
+/** A one-frame container: the frame is staged as the first of an empty
+ * file, then its index entry and the finished header are added around it.
+ * ----------------------------------------------------------------- */
+void ntc_stage_file(NtcWriter* w, const ParticleSystem* sys, int step,
+                    double time, const double* key_box, unsigned char* dst) {
+    w->file_bytes = sizeof(NtcFileHeader);
+    w->n_frames   = 0;
+    ntc_stage(w, sys, step, time, key_box, dst + sizeof(NtcFileHeader));
+    memcpy(dst + w->file_bytes, &w->index[0], sizeof(NtcIndexEntry));
+
+    NtcFileHeader fh;
+    fill_file_header(&fh, w->file_bytes, 1);
+    memcpy(dst, &fh, sizeof(fh));
+}
+
+bool ntc_writer_close(NtcWriter* w) {
+    bool ok = false;
+    int fd = open(w->path, O_WRONLY);
+    if (fd >= 0) {
+        size_t bytes = (size_t)w->n_frames * sizeof(NtcIndexEntry);
+        ssize_t n = pwrite(fd, w->index, bytes, (off_t)w->file_bytes);
+        ok = n == (ssize_t)bytes &&
+             write_file_header(fd, w->file_bytes, w->n_frames);
+        ok = close(fd) == 0 && ok;
+    }
+    if (!ok)
+        perror("Error writing container index");
+    ntc_writer_free(w);
+    return ok;
+}
+
+void ntc_writer_free(NtcWriter* w) {
+    free(w->index);
+    free(w->keys);
+    memset(w, 0, sizeof(*w));
+}
+
+bool ntc_open(NtcReader* r, const char* path) {
+    memset(r, 0, sizeof(*r));
+    r->fd = open(path, O_RDONLY);
+    if (r->fd < 0) {
+        perror("Error opening container");
+        return false;
+    }
+
+    NtcFileHeader fh;
+    struct stat st;
+    if (fstat(r->fd, &st) != 0 || !pread_full(r->fd, &fh, sizeof(fh), 0) ||
+        memcmp(fh.magic, NTC_FILE_MAGIC, 8) != 0 ||
+        fh.version != NTC_VERSION || fh.chunk != NTC_CHUNK) {
+        fprintf(stderr, "Error: %s is not a .ntc container.\n", path);
+        ntc_close(r);
+        return false;
+    }
+    uint64_t file_size = (uint64_t)st.st_size;
+
+    if (fh.index_offset != 0) {
+        size_t bytes = (size_t)fh.n_frames * sizeof(NtcIndexEntry);
+        r->index = malloc(bytes ? bytes : 1);
+        if (!r->index || fh.index_offset + bytes > file_size ||
+            !pread_full(r->fd, r->index, bytes, (off_t)fh.index_offset)) {
+            fprintf(stderr, "Error: corrupt container index in %s.\n", path);
+            ntc_close(r);
+            return false;
+        }
+        r->n_frames = fh.n_frames;
+        r->indexed  = 1;
+        return true;
+    }
+
+    /* No index: walk the frame headers, dropping a truncated last frame */
+    size_t cap = 0;
+    uint64_t off = sizeof(NtcFileHeader);
+    NtcFrameHeader h;
+    while (off + sizeof(h) <= file_size &&
+           pread_full(r->fd, &h, sizeof(h), (off_t)off) &&
+           memcmp(h.magic, "NTCF", 4) == 0 && h.N >= 0 &&
+           off + ntc_frame_bytes(h.N) <= file_size) {
+        if (r->n_frames == cap) {
+            cap = cap ? cap * 2 : 64;
+            r->index = realloc(r->index, cap * sizeof(NtcIndexEntry));
+            if (!r->index) {
+                fprintf(stderr, "Error: Memory allocation failed for "
+                                "container index.\n");
+                exit(1);
+            }
+        }
+        NtcIndexEntry* e = &r->index[r->n_frames++];
+        e->offset = off;
+        e->time   = h.time;
+        e->step   = h.step;
+        e->N      = h.N;
+        off += ntc_frame_bytes(h.N);
+    }
+    return true;
+}
+
+void ntc_close(NtcReader* r) {
+    if (r->fd >= 0)
+        close(r->fd);
+    free(r->index);
+    memset(r, 0, sizeof(*r));
+    r->fd = -1;
+}
+
+int ntc_find_frame(const NtcReader* r, double t) {
+    int lo = 0, hi = (int)r->n_frames;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (r->index[mid].time <= t) lo = mid + 1;
+        else                         hi = mid;
+    }
+    return lo - 1;
+}
+
+/** Read only the chunks of a frame that overlap box, then keep the
+ * particles that lie inside it. Chunks are read concurrently.
+ * ----------------------------------------------------------------- */
+bool ntc_read_frame(const NtcReader* r, int frame, const double* box,
+                    ParticleSystem* out, int* chunks_read) {
+    if (frame < 0 || (uint64_t)frame >= r->n_frames)
+        return false;
+    uint64_t off = r->index[frame].offset;
+
+    NtcFrameHeader h;
+    if (!pread_full(r->fd, &h, sizeof(h), (off_t)off) ||
+        memcmp(h.magic, "NTCF", 4) != 0 || h.N != r->index[frame].N ||
+        h.n_chunks != (uint32_t)((h.N + NTC_CHUNK - 1) / NTC_CHUNK)) {
+        fprintf(stderr, "Error: corrupt container frame %d.\n", frame);
+        return false;
+    }
+
+    int n_chunks = (int)h.n_chunks;
+    NtcChunk* table = malloc((size_t)n_chunks * sizeof(NtcChunk) + 1);
+    int* selected   = malloc((size_t)n_chunks * sizeof(int) + 1);
+    size_t* first   = malloc((size_t)n_chunks * sizeof(size_t) + 1);
+    if (!table || !selected || !first) {
+        fprintf(stderr, "Error: Memory allocation failed for container "
+                        "frame.\n");
+        exit(1);
+    }
+    if (!pread_full(r->fd, table, (size_t)n_chunks * sizeof(NtcChunk),
+                    (off_t)(off + sizeof(h)))) {
+        fprintf(stderr, "Error: corrupt container frame %d.\n", frame);
+        free(table);
+        free(selected);
+        free(first);
+        return false;
+    }
+
+    int n_sel = 0;
+    size_t candidates = 0;
+    for (int c = 0; c < n_chunks; c++) {
+        if (box && !overlaps(table[c].bbox, box))
+            continue;
+        first[n_sel] = candidates;
+        selected[n_sel++] = c;
+        candidates += table[c].count;
+    }
+
+    unsigned char* records = malloc(candidates * IO_RECORD_BYTES + 1);
+    int* keep = malloc(candidates * sizeof(int) + 1);
+    if (!records || !keep) {
+        fprintf(stderr, "Error: Memory allocation failed for container "
+                        "frame.\n");
+        exit(1);
+    }
+
+    int failed = 0;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, 1) reduction(+ : failed)
+#endif
+    for (int s = 0; s < n_sel; s++) {
+        const NtcChunk* e = &table[selected[s]];
+        failed += !pread_full(r->fd, records + first[s] * IO_RECORD_BYTES,
+                              (size_t)e->count * IO_RECORD_BYTES,
+                              (off_t)e->offset);
+    }
+
+    size_t n_out = 0;
+    if (!failed) {
+        for (size_t p = 0; p < candidates; p++) {
+            double xy[2];
+            memcpy(xy, records + p * IO_RECORD_BYTES, sizeof(xy));
+            if (!box || (xy[0] >= box[0] && xy[0] <= box[1] &&
+                         xy[1] >= box[2] && xy[1] <= box[3]))
+                keep[n_out++] = (int)p;
+        }
+
+        *out = io_alloc_particles((int)n_out);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+        for (int i = 0; i < (int)n_out; i++) {
+            double v[6];
+            memcpy(v, records + (size_t)keep[i] * IO_RECORD_BYTES, sizeof(v));
+            out->pos_x[i]      = v[0];
+            out->pos_y[i]      = v[1];
+            out->mass[i]       = v[2];
+            out->vx[i]         = v[3];
+            out->vy[i]         = v[4];
+            out->brightness[i] = v[5];
+            out->fx[i] = out->fy[i] = 0.0;
+        }
+    } else {
+        fprintf(stderr, "Error: short read in container frame %d.\n", frame);
+    }
+    if (chunks_read)
+        *chunks_read = n_sel;
+
+    free(records);
+    free(keep);
+    free(table);
+    free(selected);
+    free(first);
+    return !failed;
+}
+
+static void fill_file_header(NtcFileHeader* fh, uint64_t index_offset,
+                             uint64_t n_frames) {
+    memset(fh, 0, sizeof(*fh));
+    memcpy(fh->magic, NTC_FILE_MAGIC, 8);
+    fh->version      = NTC_VERSION;
+    fh->chunk        = NTC_CHUNK;
+    fh->index_offset = index_offset;
+    fh->n_frames     = n_frames;
+}
+
+static bool write_file_header(int fd, uint64_t index_offset,
+                              uint64_t n_frames) {
+    NtcFileHeader fh;
+    fill_file_header(&fh, index_offset, n_frames);
+    return pwrite(fd, &fh, sizeof(fh), 0) == (ssize_t)sizeof(fh);
+}
+
+/* pread() until len bytes are read; false on error or end of file */
+static bool pread_full(int fd, void* buf, size_t len, off_t offset) {
+    unsigned char* p = buf;
+    while (len > 0) {
+        ssize_t n = pread(fd, p, len, offset);
+        if (n <= 0)
+            return false;
+        p      += n;
+        len    -= (size_t)n;
+        offset += n;
+    }
+    return true;
+}
+
+static int compare_keys(const void* a, const void* b) {
+    uint64_t ka = ((const NtcKey*)a)->key;
+    uint64_t kb = ((const NtcKey*)b)->key;
+    if (ka < kb) return -1;
+    if (ka > kb) return  1;
+    return ((const NtcKey*)a)->index - ((const NtcKey*)b)->index;
+}
+
+static bool overlaps(const double* a, const double* b) {
+    return a[0] <= b[1] && a[1] >= b[0] && a[2] <= b[3] && a[3] >= b[2];
+}
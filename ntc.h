@@ -0,0 +1,120 @@
+#ifndef NTC_H
+#define NTC_H
+
+#include "types.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Indexed trajectory container (.ntc): a file header, then frames, then a
+ * frame index written when the run finishes. A frame is a header, a chunk
+ * table and the particles as .gal records in Z-order of the frame's key
+ * box, cut into chunks of NTC_CHUNK particles. Each chunk records its
+ * Morton key range, bounding box and file offset, so a reader seeks to a
+ * frame through the index and reads only the chunks that overlap its
+ * query box. A file without an index (an interrupted run) is still
+ * readable: the frames are found by walking their headers. */
+#define NTC_FILE_MAGIC "NBTCON01"
+#define NTC_VERSION    1
+#define NTC_CHUNK      4096
+
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    uint32_t chunk;          /* particles per chunk */
+    uint64_t index_offset;   /* 0 until the index has been written */
+    uint64_t n_frames;
+} NtcFileHeader;
+
+typedef struct {
+    char     magic[4];       /* "NTCF" */
+    uint32_t n_chunks;
+    int32_t  step;
+    int32_t  N;
+    double   time;
+    double   bbox[4];        /* x_min, x_max, y_min, y_max of the frame */
+    double   key_box[4];     /* box the Morton keys are taken in */
+} NtcFrameHeader;
+
+typedef struct {
+    uint64_t key_lo, key_hi; /* Morton key range of the chunk */
+    double   bbox[4];
+    uint64_t offset;         /* absolute file offset of the records */
+    uint32_t count;
+    uint32_t reserved;
+} NtcChunk;
+
+typedef struct {
+    uint64_t offset;         /* absolute file offset of the frame header */
+    double   time;
+    int32_t  step;
+    int32_t  N;
+} NtcIndexEntry;
+
+/* Morton key of a particle, sorted by the writer */
+typedef struct {
+    uint64_t key;
+    int32_t  index;
+} NtcKey;
+
+typedef struct {
+    char           path[256];
+    uint64_t       file_bytes;   /* size once every staged frame is written */
+    uint64_t       n_frames;
+    NtcIndexEntry* index;
+    size_t         index_cap;
+    NtcKey*        keys;         /* per-particle scratch */
+    int            keys_cap;
+} NtcWriter;
+
+typedef struct {
+    int            fd;
+    uint64_t       n_frames;
+    NtcIndexEntry* index;
+    int            indexed;      /* index read from the file, not rebuilt */
+} NtcReader;
+
+// Create path, or when resume_time >= 0 reopen it and keep only frames up
+// to resume_time; new frames are appended after them.
+bool ntc_writer_open(NtcWriter* w, const char* path, double resume_time);
+
+// Encoded size of a frame of N particles.
+size_t ntc_frame_bytes(int N);
+
+// Sort, chunk and pack one frame into dst (ntc_frame_bytes(N) bytes) and
+// record it in the index. key_box may be NULL to use the frame's bbox; if
+// the particles are already in Z-order of key_box no sort is needed.
+// The caller appends dst to the file in staging order.
+void ntc_stage(NtcWriter* w, const ParticleSystem* sys, int step,
+               double time, const double* key_box, unsigned char* dst);
+
+// Size of a standalone one-frame container of N particles.
+size_t ntc_file_bytes(int N);
+
+// Pack a complete one-frame container (header, frame, index) into dst
+// (ntc_file_bytes(N) bytes), e.g. one spatially indexed snapshot file.
+// Only w's scratch is used; w must not also be writing a container.
+void ntc_stage_file(NtcWriter* w, const ParticleSystem* sys, int step,
+                    double time, const double* key_box, unsigned char* dst);
+
+// Append the frame index and finalize the header. Every staged frame must
+// already be on disk. The writer is released either way.
+bool ntc_writer_close(NtcWriter* w);
+
+// Release the writer's index and scratch without writing anything, e.g.
+// after ntc_stage_file or to abandon a container. Safe on a zeroed writer.
+void ntc_writer_free(NtcWriter* w);
+
+bool ntc_open(NtcReader* r, const char* path);
+void ntc_close(NtcReader* r);
+
+// Index of the last frame with time <= t, or -1 if there is none.
+int ntc_find_frame(const NtcReader* r, double t);
+
+// Read the particles of a frame that lie inside box (x_min, x_max, y_min,
+// y_max; NULL = all) into a fresh system, touching only the chunks whose
+// bbox overlaps it. chunks_read, if given, receives how many were read.
+bool ntc_read_frame(const NtcReader* r, int frame, const double* box,
+                    ParticleSystem* out, int* chunks_read);
+
+#endif
@@ -0,0 +1,257 @@
+#include "ooc.h"
+#include "morton.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+static CheckpointMap work = { NULL, 0, -1 };
+static char          work_path[256];
+
+static ParticleSystem alloc_mapped(int N);
+static ParticleSystem view(const ParticleSystem* sys, int first, int count);
+static void           sort_bucket(const ParticleSystem* out,
+                                  const ParticleSystem* scratch, int first,
+                                  int count, int shift, const double box[4]);
+
+bool ooc_load(const char* input, int N, const char* path,
+              ParticleSystem* sys, GalInfo* info) {
+    snprintf(work_path, sizeof(work_path), "%s", path);
+    *sys = io_read_particles_with(input, N, info, alloc_mapped);
+    /* The working file has no room for ids; out of core they are dropped */
+    free(sys->id);
+    free(sys->index_of);
+    sys->id       = NULL;
+    sys->index_of = NULL;
+    return work.base != NULL;
+}
+
+bool ooc_resume(const char* path, ParticleSystem* sys,
+                CheckpointState* state) {
+    snprintf(work_path, sizeof(work_path), "%s", path);
+    return checkpoint_map(path, 0, &work, sys, state);
+}
+
+bool ooc_sync(const ParticleSystem* sys, const CheckpointState* state) {
+    return checkpoint_map_sync(&work, sys, state);
+}
+
+void ooc_close(ParticleSystem* sys) {
+    checkpoint_unmap(&work);
+    memset(sys, 0, sizeof(*sys));
+}
+
+/** External bucket sort of the working file.
+ * Each thread histograms and then scatters its own static index range,
+ * so a bucket keeps the original order and the result does not depend
+ * on the thread count. Buckets are then sorted in place in the new file,
+ * which replaces the old one; the old one is scratch space for buckets
+ * too large to sort in memory.
+ * ----------------------------------------------------------------- */
+bool ooc_sort(ParticleSystem* sys, const double box[4]) {
+    int N = sys->N;
+    int B = 1 << OOC_SORT_BITS;
+    int shift = 64 - OOC_SORT_BITS;
+    int n_threads = 1;
+#ifdef _OPENMP
+    n_threads = omp_get_max_threads();
+#endif
+
+    char tmp_path[sizeof(work_path) + 8];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.sort", work_path);
+    CheckpointMap sorted_map;
+    ParticleSystem out;
+    if (!checkpoint_map(tmp_path, N, &sorted_map, &out, NULL))
+        return false;
+
+    size_t* hist  = calloc((size_t)n_threads * B, sizeof(size_t));
+    size_t* start = malloc(((size_t)B + 1) * sizeof(size_t));
+    if (!hist || !start) {
+        fprintf(stderr, "Error: Memory allocation failed for out-of-core "
+                        "sort.\n");
+        exit(1);
+    }
+
+    double* src[CHECKPOINT_ARRAYS];
+    double* dst[CHECKPOINT_ARRAYS];
+    checkpoint_array_list(sys, src);
+    checkpoint_array_list(&out, dst);
+
+#ifdef _OPENMP
+#pragma omp parallel num_threads(n_threads)
+#endif
+    {
+        int t = 0, T = 1;
+#ifdef _OPENMP
+        t = omp_get_thread_num();
+        T = omp_get_num_threads();
+#endif
+        int lo = (int)((long long)N * t / T);
+        int hi = (int)((long long)N * (t + 1) / T);
+        size_t* h = hist + (size_t)t * B;
+        for (int i = lo; i < hi; i++)
+            h[morton_code(sys->pos_x[i], sys->pos_y[i], box[0], box[1],
+                          box[2], box[3]) >> shift]++;
+
+#ifdef _OPENMP
+#pragma omp barrier
+#pragma omp single
+#endif
+        {
+            /* Bucket b holds thread 0's particles, then thread 1's, ... */
+            size_t pos = 0;
+            for (int b = 0; b < B; b++) {
+                start[b] = pos;
+                for (int u = 0; u < T; u++) {
+                    size_t c = hist[(size_t)u * B + b];
+                    hist[(size_t)u * B + b] = pos;
+                    pos += c;
+                }
+            }
+            start[B] = pos;
+        }
+
+        for (int i = lo; i < hi; i++) {
+            size_t d = h[morton_code(sys->pos_x[i], sys->pos_y[i], box[0],
+                                     box[1], box[2], box[3]) >> shift]++;
+            for (int a = 0; a < CHECKPOINT_ARRAYS; a++)
+                dst[a][d] = src[a][i];
+        }
+    }
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, 1)
+#endif
+    for (int b = 0; b < B; b++)
+        sort_bucket(&out, sys, (int)start[b], (int)(start[b + 1] - start[b]),
+                    shift, box);
+    free(hist);
+    free(start);
+
+    /* The sorted file takes the working file's place */
+    if (!checkpoint_map_sync(&sorted_map, &out, NULL) ||
+        rename(tmp_path, work_path) != 0) {
+        perror("Error replacing working file");
+        checkpoint_unmap(&sorted_map);
+        unlink(tmp_path);
+        return false;
+    }
+    checkpoint_unmap(&work);
+    work = sorted_map;
+    *sys = out;
+    return true;
+}
+
+void ooc_reorder(ParticleSystem* sys, const double box[4], int parity) {
+    int n_chunks = (sys->N + OOC_CHUNK - 1) / OOC_CHUNK;
+    int n_pairs  = (n_chunks - parity + 1) / 2;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, 1)
+#endif
+    for (int p = 0; p < n_pairs; p++) {
+        int first = (2 * p + parity) * OOC_CHUNK;
+        int count = sys->N - first < 2 * OOC_CHUNK ? sys->N - first
+                                                   : 2 * OOC_CHUNK;
+        ParticleSystem pair = view(sys, first, count);
+        z_order_sort(&pair, box[0], box[1], box[2], box[3]);
+    }
+}
+
+/** madvise() wants page-aligned ranges; widen each array slice to pages.
+ * ----------------------------------------------------------------- */
+void ooc_prefetch(const ParticleSystem* sys, int first, int count) {
+    long page = sysconf(_SC_PAGESIZE);
+    double* arrays[CHECKPOINT_ARRAYS];
+    checkpoint_array_list(sys, arrays);
+    for (int a = 0; a < CHECKPOINT_ARRAYS; a++) {
+        uintptr_t lo = (uintptr_t)(arrays[a] + first);
+        uintptr_t hi = (uintptr_t)(arrays[a] + first + count);
+        lo &= ~(uintptr_t)(page - 1);
+        madvise((void*)lo, hi - lo, MADV_WILLNEED);
+    }
+}
+
+/* Loader callback: the input is decoded straight into the working file */
+static ParticleSystem alloc_mapped(int N) {
+    ParticleSystem sys;
+    if (!checkpoint_map(work_path, N, &work, &sys, NULL))
+        exit(1);
+    return sys;
+}
+
+/** Sort particles [first, first + count) of out, all of which share the
+ * key bits above shift. A bucket too large for z_order_sort's memory is
+ * scattered by the next OOC_SORT_BITS bits into the same range of
+ * scratch, in order, copied back, and each part sorted the same way.
+ * Once the key bits run out the particles coincide on the grid and the
+ * bucket is sorted in memory regardless.
+ * ----------------------------------------------------------------- */
+static void sort_bucket(const ParticleSystem* out,
+                        const ParticleSystem* scratch, int first, int count,
+                        int shift, const double box[4]) {
+    ParticleSystem bucket = view(out, first, count);
+    if (count <= OOC_SORT_MAX || shift < OOC_SORT_BITS) {
+        if (count > 1)
+            z_order_sort(&bucket, box[0], box[1], box[2], box[3]);
+        return;
+    }
+    int B = 1 << OOC_SORT_BITS;
+    uint64_t mask = (uint64_t)B - 1;
+    shift -= OOC_SORT_BITS;
+    size_t* start = calloc((size_t)B + 1, sizeof(size_t));
+    size_t* fill  = malloc((size_t)B * sizeof(size_t));
+    if (!start || !fill) {
+        fprintf(stderr, "Error: Memory allocation failed for out-of-core "
+                        "sort.\n");
+        exit(1);
+    }
+    for (int i = 0; i < count; i++)
+        start[((morton_code(bucket.pos_x[i], bucket.pos_y[i], box[0], box[1],
+                            box[2], box[3]) >> shift) & mask) + 1]++;
+    for (int b = 0; b < B; b++) {
+        start[b + 1] += start[b];
+        fill[b] = start[b];
+    }
+
+    ParticleSystem part = view(scratch, first, count);
+    double* src[CHECKPOINT_ARRAYS];
+    double* dst[CHECKPOINT_ARRAYS];
+    checkpoint_array_list(&bucket, src);
+    checkpoint_array_list(&part, dst);
+    for (int i = 0; i < count; i++) {
+        size_t d = fill[(morton_code(src[0][i], src[1][i], box[0], box[1],
+                                     box[2], box[3]) >> shift) & mask]++;
+        for (int a = 0; a < CHECKPOINT_ARRAYS; a++)
+            dst[a][d] = src[a][i];
+    }
+    for (int a = 0; a < CHECKPOINT_ARRAYS; a++)
+        memcpy(src[a], dst[a], (size_t)count * sizeof(double));
+
+    for (int b = 0; b < B; b++)
+        sort_bucket(out, scratch, first + (int)start[b],
+                    (int)(start[b + 1] - start[b]), shift, box);
+    free(start);
+    free(fill);
+}
+
+/* Particles [first, first + count) as a system of their own */
+static ParticleSystem view(const ParticleSystem* sys, int first, int count) {
+    ParticleSystem v;
+    v.N          = count;
+    v.pos_x      = sys->pos_x + first;
+    v.pos_y      = sys->pos_y + first;
+    v.mass       = sys->mass + first;
+    v.vx         = sys->vx + first;
+    v.vy         = sys->vy + first;
+    v.fx         = sys->fx + first;
+    v.fy         = sys->fy + first;
+    v.brightness = sys->brightness + first;
+    v.id         = NULL;
+    v.index_of   = NULL;
+    return v;
+}
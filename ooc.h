@@ -0,0 +1,41 @@
+#ifndef OOC_H
+#define OOC_H
+
+#include "checkpoint.h"
+#include "io.h"
+#include "types.h"
+#include <stdbool.h>
+
+/* Out-of-core mode: the particle arrays live in a shared mapping of a
+ * working file in checkpoint layout, kept in Z-order and processed in
+ * spatial chunks of OOC_CHUNK consecutive particles. */
+#define OOC_CHUNK     (1 << 16)
+#define OOC_SORT_BITS 12        /* top key bits that pick a sort bucket */
+#define OOC_SORT_MAX  (1 << 20) /* larger buckets split on the next bits */
+
+// Create the working file at work_path and decode the input into it.
+bool ooc_load(const char* input, int N, const char* work_path,
+              ParticleSystem* sys, GalInfo* info);
+
+// Map a working file left by an earlier run (a checkpoint) in place.
+bool ooc_resume(const char* work_path, ParticleSystem* sys,
+                CheckpointState* state);
+
+// Flush the arrays and stamp the working file as a checkpoint of state.
+bool ooc_sync(const ParticleSystem* sys, const CheckpointState* state);
+
+void ooc_close(ParticleSystem* sys);
+
+// Sort the whole file into Z-order of box: bucket by the top key bits
+// into a second file, then sort each bucket in memory; a bucket of more
+// than OOC_SORT_MAX particles is bucketed again on the next key bits.
+bool ooc_sort(ParticleSystem* sys, const double box[4]);
+
+// Restore Z-order after a drift by sorting neighbouring chunk pairs;
+// the pairing alternates with parity so particles can cross chunks.
+void ooc_reorder(ParticleSystem* sys, const double box[4], int parity);
+
+// Ask the kernel to start reading particles [first, first + count).
+void ooc_prefetch(const ParticleSystem* sys, int first, int count);
+
+#endif
@@ -0,0 +1,256 @@
+#include "png.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define WINDOW    32768     /* deflate distance limit */
+#define HASH_BITS 15
+#define MIN_MATCH 3
+#define MAX_MATCH 258
+#define MAX_CHAIN 32        /* candidates tried per position */
+
+/* Deflate length and distance codes: base value and extra bits */
+static const int LEN_BASE[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const int LEN_EXTRA[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const int DIST_BASE[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289,
+    16385, 24577
+};
+static const int DIST_EXTRA[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+/* LSB-first bit output, as deflate packs it */
+typedef struct {
+    unsigned char* p;
+    uint64_t       bits;
+    int            n;
+} BitWriter;
+
+static void     put_bits(BitWriter* w, uint32_t v, int n);
+static void     put_code(BitWriter* w, uint32_t code, int len);
+static void     put_symbol(BitWriter* w, int sym);
+static void     put_match(BitWriter* w, int len, int dist);
+static void     deflate_fixed(const unsigned char* src, int n, BitWriter* w);
+static void     filter_rows(const unsigned char* pixels, int w, int h,
+                            unsigned char* raw);
+static uint32_t crc32_update(uint32_t crc, const unsigned char* p, size_t n);
+static void     put_u32(unsigned char* p, uint32_t v);
+
+size_t png_gray_bound(int w, int h) {
+    size_t raw = (size_t)h * ((size_t)w + 1);
+    return raw + raw / 8 + 128;
+}
+
+/** Signature, IHDR, one IDAT holding a zlib stream, IEND.
+ * ----------------------------------------------------------------- */
+size_t png_encode_gray(const unsigned char* pixels, int w, int h,
+                       unsigned char* dst) {
+    int raw_len = h * (w + 1);
+    unsigned char* raw = malloc((size_t)raw_len);
+    if (!raw) {
+        fprintf(stderr, "Error: Memory allocation failed for PNG rows.\n");
+        exit(1);
+    }
+    filter_rows(pixels, w, h, raw);
+
+    unsigned char* p = dst;
+    memcpy(p, "\x89PNG\r\n\x1a\n", 8);
+    p += 8;
+
+    unsigned char* chunk = p;
+    put_u32(p, 13);
+    memcpy(p + 4, "IHDR", 4);
+    put_u32(p + 8, (uint32_t)w);
+    put_u32(p + 12, (uint32_t)h);
+    p[16] = 8;     /* bit depth */
+    p[17] = 0;     /* grayscale */
+    p[18] = p[19] = p[20] = 0;
+    put_u32(p + 21, crc32_update(0, chunk + 4, 17));
+    p += 25;
+
+    chunk = p;
+    memcpy(p + 4, "IDAT", 4);
+    p += 8;
+    *p++ = 0x78;   /* deflate, 32K window */
+    *p++ = 0x01;
+    BitWriter bw = { p, 0, 0 };
+    deflate_fixed(raw, raw_len, &bw);
+    if (bw.n > 0)
+        put_bits(&bw, 0, 8 - bw.n);
+    p = bw.p;
+    uint32_t a = 1, b = 0;
+    for (int i = 0; i < raw_len; i++) {
+        a = (a + raw[i]) % 65521;
+        b = (b + a) % 65521;
+    }
+    put_u32(p, (b << 16) | a);
+    p += 4;
+    uint32_t idat_len = (uint32_t)(p - chunk - 8);
+    put_u32(chunk, idat_len);
+    put_u32(p, crc32_update(0, chunk + 4, idat_len + 4));
+    p += 4;
+
+    put_u32(p, 0);
+    memcpy(p + 4, "IEND", 4);
+    put_u32(p + 8, crc32_update(0, p + 4, 4));
+    p += 12;
+
+    free(raw);
+    return (size_t)(p - dst);
+}
+
+static void put_bits(BitWriter* w, uint32_t v, int n) {
+    w->bits |= (uint64_t)v << w->n;
+    w->n += n;
+    while (w->n >= 8) {
+        *w->p++ = (unsigned char)w->bits;
+        w->bits >>= 8;
+        w->n -= 8;
+    }
+}
+
+/* Huffman codes go out most significant bit first */
+static void put_code(BitWriter* w, uint32_t code, int len) {
+    uint32_t r = 0;
+    for (int i = 0; i < len; i++)
+        r |= ((code >> i) & 1u) << (len - 1 - i);
+    put_bits(w, r, len);
+}
+
+/* Literal/length symbol in the fixed Huffman code */
+static void put_symbol(BitWriter* w, int sym) {
+    if (sym < 144)      put_code(w, 0x30 + sym, 8);
+    else if (sym < 256) put_code(w, 0x190 + sym - 144, 9);
+    else if (sym < 280) put_code(w, sym - 256, 7);
+    else                put_code(w, 0xC0 + sym - 280, 8);
+}
+
+static void put_match(BitWriter* w, int len, int dist) {
+    int l = 28;
+    while (LEN_BASE[l] > len) l--;
+    put_symbol(w, 257 + l);
+    put_bits(w, (uint32_t)(len - LEN_BASE[l]), LEN_EXTRA[l]);
+    int d = 29;
+    while (DIST_BASE[d] > dist) d--;
+    put_code(w, (uint32_t)d, 5);
+    put_bits(w, (uint32_t)(dist - DIST_BASE[d]), DIST_EXTRA[d]);
+}
+
+/** One final fixed-Huffman block. Matches come from hash chains over
+ * three-byte prefixes, taking the longest of MAX_CHAIN candidates.
+ * ----------------------------------------------------------------- */
+static void deflate_fixed(const unsigned char* src, int n, BitWriter* w) {
+    int* head = malloc(((size_t)1 << HASH_BITS) * sizeof(int));
+    int* prev = malloc((size_t)(n > 0 ? n : 1) * sizeof(int));
+    if (!head || !prev) {
+        fprintf(stderr, "Error: Memory allocation failed for deflate.\n");
+        exit(1);
+    }
+    for (int i = 0; i < (1 << HASH_BITS); i++)
+        head[i] = -1;
+
+    put_bits(w, 1, 1);   /* BFINAL */
+    put_bits(w, 1, 2);   /* fixed Huffman codes */
+    int i = 0, inserted = 0;
+    while (i < n) {
+        int best_len = 0, best_dist = 0;
+        if (i + MIN_MATCH <= n) {
+            uint32_t h = ((uint32_t)src[i] << 16 | (uint32_t)src[i + 1] << 8 |
+                          src[i + 2]) * 2654435761u >> (32 - HASH_BITS);
+            int max = n - i < MAX_MATCH ? n - i : MAX_MATCH;
+            int chain = MAX_CHAIN;
+            for (int c = head[h]; c >= 0 && i - c <= WINDOW && chain-- > 0;
+                 c = prev[c]) {
+                int l = 0;
+                while (l < max && src[c + l] == src[i + l]) l++;
+                if (l > best_len) {
+                    best_len  = l;
+                    best_dist = i - c;
+                    if (l == max) break;
+                }
+            }
+        }
+        int step = 1;
+        if (best_len >= MIN_MATCH) {
+            put_match(w, best_len, best_dist);
+            step = best_len;
+        } else {
+            put_symbol(w, src[i]);
+        }
+        /* Index every position the output just covered */
+        for (i += step; inserted < i && inserted + MIN_MATCH <= n; inserted++) {
+            const unsigned char* q = src + inserted;
+            uint32_t h = ((uint32_t)q[0] << 16 | (uint32_t)q[1] << 8 | q[2]) *
+                         2654435761u >> (32 - HASH_BITS);
+            prev[inserted] = head[h];
+            head[h] = inserted;
+        }
+    }
+    put_symbol(w, 256);
+    free(head);
+    free(prev);
+}
+
+/* Per row, the filter with the smallest sum of |signed residual| */
+static void filter_rows(const unsigned char* pixels, int w, int h,
+                        unsigned char* raw) {
+    for (int y = 0; y < h; y++) {
+        const unsigned char* row = pixels + (size_t)y * w;
+        const unsigned char* up  = y > 0 ? row - w : NULL;
+        long cost[3] = { 0, 0, 0 };
+        for (int x = 0; x < w; x++) {
+            int sub = (unsigned char)(row[x] - (x > 0 ? row[x - 1] : 0));
+            int upd = (unsigned char)(row[x] - (up ? up[x] : 0));
+            cost[0] += row[x] < 128 ? row[x] : 256 - row[x];
+            cost[1] += sub < 128 ? sub : 256 - sub;
+            cost[2] += upd < 128 ? upd : 256 - upd;
+        }
+        int f = 0;
+        if (cost[1] < cost[f]) f = 1;
+        if (cost[2] < cost[f]) f = 2;
+
+        unsigned char* out = raw + (size_t)y * (w + 1);
+        out[0] = (unsigned char)f;
+        for (int x = 0; x < w; x++) {
+            int pred = f == 1 ? (x > 0 ? row[x - 1] : 0)
+                     : f == 2 ? (up ? up[x] : 0) : 0;
+            out[1 + x] = (unsigned char)(row[x] - pred);
+        }
+    }
+}
+
+static uint32_t crc32_update(uint32_t crc, const unsigned char* p, size_t n) {
+    static uint32_t table[256];
+    static int      ready = 0;
+    if (!ready) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++)
+                c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+        ready = 1;
+    }
+    crc = ~crc;
+    for (size_t i = 0; i < n; i++)
+        crc = table[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+/* Big-endian, as PNG stores every integer */
+static void put_u32(unsigned char* p, uint32_t v) {
+    p[0] = (unsigned char)(v >> 24);
+    p[1] = (unsigned char)(v >> 16);
+    p[2] = (unsigned char)(v >> 8);
+    p[3] = (unsigned char)v;
+}
@@ -0,0 +1,17 @@
+#ifndef PNG_H
+#define PNG_H
+
+#include <stddef.h>
+
+/* Minimal PNG writer for 8-bit grayscale images: each row gets the
+ * cheaper of the None, Sub and Up filters, and the rows are compressed
+ * as one deflate block with fixed Huffman codes and LZ77 matches. */
+
+// Upper bound on the encoded size of a w x h image.
+size_t png_gray_bound(int w, int h);
+
+// Encode w x h pixels (row 0 at the top) into dst; returns the bytes used.
+size_t png_encode_gray(const unsigned char* pixels, int w, int h,
+                       unsigned char* dst);
+
+#endif
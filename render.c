@@ -0,0 +1,199 @@
+#include "render.h"
+#include "async_io.h"
+#include "png.h"
+#include "time_utils.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/* Log scaling spans this ratio below the brightest pixel: 1e3, three decades */
+#define LOG_RANGE 1e3
+
+static RenderConfig   config;
+static int            enabled   = 0;
+static int            box_ready = 0;
+static double         view[4];
+static unsigned char* pixels    = NULL;
+static float*         grids     = NULL;   /* one width x height per thread */
+static int            grid_count = 0;
+static int            n_frames  = 0;
+static size_t         n_bytes   = 0;
+static double         render_time = 0.0;
+
+static void fit_view(const ParticleSystem* sys);
+
+bool render_init(const RenderConfig* cfg) {
+    config  = *cfg;
+    enabled = cfg->every_steps > 0;
+    if (!enabled)
+        return true;
+    if (cfg->has_box) {
+        memcpy(view, cfg->box, sizeof(view));
+        box_ready = 1;
+    }
+    pixels = malloc((size_t)cfg->width * cfg->height);
+    if (!pixels) {
+        fprintf(stderr, "Error: Memory allocation failed for render image.\n");
+        return false;
+    }
+    return async_io_start();
+}
+
+/** Render, encode and queue one frame. Encoding runs on the calling
+ * thread; only the file write is left to the I/O thread.
+ * ----------------------------------------------------------------- */
+void render_step(const ParticleSystem* sys, int step) {
+    if (!enabled || step % config.every_steps != 0)
+        return;
+    double t0 = sim_time_now();
+    if (!box_ready) {
+        fit_view(sys);
+        box_ready = 1;
+    }
+    render_image(sys, &config, view, pixels);
+
+    int W = config.width, H = config.height;
+    StageBuffer* slot;
+    if (config.format == RENDER_PNG) {
+        slot = async_io_acquire(png_gray_bound(W, H));
+        slot->len = png_encode_gray(pixels, W, H, slot->data);
+    } else {
+        char head[64];
+        int n = snprintf(head, sizeof(head), "P5\n%d %d\n255\n", W, H);
+        slot = async_io_acquire((size_t)n + (size_t)W * H);
+        memcpy(slot->data, head, (size_t)n);
+        memcpy(slot->data + n, pixels, (size_t)W * H);
+        slot->len = (size_t)n + (size_t)W * H;
+    }
+    snprintf(slot->path, sizeof(slot->path), "data/outputs/render_%s_%06d.%s",
+             config.label, step, config.format == RENDER_PNG ? "png" : "pgm");
+    n_frames++;
+    n_bytes += slot->len;
+    async_io_submit(slot);
+    render_time += sim_time_now() - t0;
+}
+
+void render_finish(void) {
+    if (!enabled)
+        return;
+    if (n_frames > 0)
+        printf("Rendered: data/outputs/render_%s_*.%s | %d frames | "
+               "%.1f KiB/frame | %.2f ms/frame\n",
+               config.label, config.format == RENDER_PNG ? "png" : "pgm",
+               n_frames, (double)n_bytes / 1024.0 / n_frames,
+               render_time * 1e3 / n_frames);
+    free(pixels);
+    free(grids);
+    pixels = NULL;
+    grids  = NULL;
+    grid_count = 0;
+}
+
+/** Each thread deposits its static share of particles into its own grid
+ * (nearest pixel), then the grids are summed pixel band by pixel band.
+ * Z-ordered arrays give each thread a compact region, so its grid
+ * writes stay mostly in cache.
+ * ----------------------------------------------------------------- */
+void render_image(const ParticleSystem* sys, const RenderConfig* cfg,
+                  const double box[4], unsigned char* out) {
+    int W = cfg->width, H = cfg->height;
+    size_t P = (size_t)W * H;
+    int T = 1;
+#ifdef _OPENMP
+    T = omp_get_max_threads();
+#endif
+    if (grid_count < T) {
+        free(grids);
+        grids = malloc((size_t)T * P * sizeof(float));
+        if (!grids) {
+            fprintf(stderr, "Error: Memory allocation failed for render "
+                            "grids.\n");
+            exit(1);
+        }
+        grid_count = T;
+    }
+
+    double sx = W / (box[1] - box[0]);
+    double sy = H / (box[3] - box[2]);
+    const double* weight = cfg->use_brightness ? sys->brightness : sys->mass;
+    int N = sys->N;
+    float peak = 0.0f;
+
+#ifdef _OPENMP
+#pragma omp parallel num_threads(T)
+#endif
+    {
+        int t = 0, n_threads = 1;
+#ifdef _OPENMP
+        t = omp_get_thread_num();
+        n_threads = omp_get_num_threads();
+#endif
+        float* g = grids + (size_t)t * P;
+        memset(g, 0, P * sizeof(float));
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+        for (int i = 0; i < N; i++) {
+            double fx = (sys->pos_x[i] - box[0]) * sx;
+            double fy = (box[3] - sys->pos_y[i]) * sy;
+            if (!(fx >= 0.0 && fx < W && fy >= 0.0 && fy < H))
+                continue;
+            g[(size_t)(int)fy * W + (int)fx] += (float)weight[i];
+        }
+#ifdef _OPENMP
+#pragma omp for schedule(static) reduction(max : peak)
+#endif
+        for (size_t p = 0; p < P; p++) {
+            float v = grids[p];
+            for (int u = 1; u < n_threads; u++)
+                v += grids[(size_t)u * P + p];
+            grids[p] = v;
+            if (v > peak) peak = v;
+        }
+
+        /* Gray levels: linear, or log scale over a LOG_RANGE ratio */
+        double lin = peak > 0.0f ? 255.0 / peak : 0.0;
+        double ref = peak / LOG_RANGE;
+        double lg  = peak > 0.0f ? 255.0 / log1p(LOG_RANGE) : 0.0;
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+        for (size_t p = 0; p < P; p++) {
+            double v = grids[p];
+            double level = peak <= 0.0f ? 0.0
+                         : cfg->log_scale ? lg * log1p(v / ref) : lin * v;
+            out[p] = (unsigned char)(level < 255.0 ? level + 0.5 : 255.0);
+        }
+    }
+}
+
+/* First-frame view: the particles' bounding box with a 5% margin on
+ * each side, widened to the image aspect ratio */
+static void fit_view(const ParticleSystem* sys) {
+    double x0 = INFINITY, x1 = -INFINITY, y0 = INFINITY, y1 = -INFINITY;
+    int N = sys->N;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) \
+    reduction(min : x0, y0) reduction(max : x1, y1)
+#endif
+    for (int i = 0; i < N; i++) {
+        if (sys->pos_x[i] < x0) x0 = sys->pos_x[i];
+        if (sys->pos_x[i] > x1) x1 = sys->pos_x[i];
+        if (sys->pos_y[i] < y0) y0 = sys->pos_y[i];
+        if (sys->pos_y[i] > y1) y1 = sys->pos_y[i];
+    }
+    double aspect = (double)config.width / config.height;
+    double w = (x1 - x0) * 1.1, h = (y1 - y0) * 1.1;
+    if (w < h * aspect) w = h * aspect;
+    if (w <= 0.0) w = 1.0;
+    h = w / aspect;
+    double cx = 0.5 * (x0 + x1), cy = 0.5 * (y0 + y1);
+    view[0] = cx - 0.5 * w;
+    view[1] = cx + 0.5 * w;
+    view[2] = cy - 0.5 * h;
+    view[3] = cy + 0.5 * h;
+}
@@ -0,0 +1,38 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include "types.h"
+#include <stdbool.h>
+
+typedef enum {
+    RENDER_PNG,   /* built-in encoder (png.h) */
+    RENDER_PGM    /* binary P5 graymap */
+} RenderFormat;
+
+typedef struct {
+    int          every_steps;     /* render every K steps, 0 = off */
+    int          width, height;
+    RenderFormat format;
+    int          log_scale;       /* log instead of linear intensity */
+    int          use_brightness;  /* weight by brightness, not mass */
+    int          has_box;         /* fixed view, else from the first frame */
+    double       box[4];          /* x_min, x_max, y_min, y_max */
+    const char*  label;           /* run label used in file names */
+} RenderConfig;
+
+// Start the background writer if rendering is enabled.
+bool render_init(const RenderConfig* cfg);
+
+// Called after each completed step; renders and queues a frame if due.
+void render_step(const ParticleSystem* sys, int step);
+
+// Print the render summary; main stops the shared writer afterwards.
+void render_finish(void);
+
+// Deposit the particles' weights onto a width x height grid over box
+// (row 0 at y_max) with one private grid per thread, then map the sums
+// to 8-bit gray levels in pixels.
+void render_image(const ParticleSystem* sys, const RenderConfig* cfg,
+                  const double box[4], unsigned char* pixels);
+
+#endif
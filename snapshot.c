@@ -0,0 +1,228 @@
+#include "snapshot.h"
+#include "async_io.h"
+#include "barnes_hut.h"
+#include "io.h"
+#include "ntc.h"
+#include "time_utils.h"
+#include "traj.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static SnapshotConfig config;
+static int         enabled   = 0;
+static double      next_time = 0.0;
+static TrajEncoder encoder;
+static NtcWriter   container;
+static char        traj_path[ASYNC_IO_PATH_MAX];
+static size_t      encoded_particles = 0, encoded_bytes = 0;
+static int         append_failed = 0;  /* set by the I/O thread */
+static double      encode_time = 0.0;
+static LodCut      lod;
+static size_t      lod_cells = 0;
+static int         lod_frames = 0;
+
+static void stage_lod(const ParticleSystem* sys, int step);
+
+bool snapshot_init(const SnapshotConfig* cfg) {
+    config  = *cfg;
+    enabled = cfg->every_steps > 0 || cfg->every_time > 0.0;
+    next_time = cfg->every_time;
+    if (cfg->every_time > 0.0 && cfg->start_time > 0.0)
+        next_time = cfg->every_time *
+                    (floor(cfg->start_time / cfg->every_time * (1.0 + 1e-12)) + 1.0);
+    if (!enabled)
+        return true;
+
+    if (config.format == SNAPSHOT_TRAJ) {
+        /* Frames are appended by the I/O thread; the magic goes first.
+         * A resumed run keeps the frames up to the checkpoint and drops
+         * any an interrupted run wrote past it, as ntc_writer_open does. */
+        snprintf(traj_path, sizeof(traj_path),
+                 "data/outputs/trajectory_%s.ntz", config.label);
+        FILE* f = cfg->start_time > 0.0 ? fopen(traj_path, "r+b") : NULL;
+        if (f && traj_check_magic(f)) {
+            uint64_t keep = traj_resume_bytes(f, cfg->start_time);
+            if (fflush(f) != 0 || ftruncate(fileno(f), (off_t)keep) != 0) {
+                perror("Error truncating trajectory file");
+                fclose(f);
+                return false;
+            }
+        } else {
+            if (f) fclose(f);
+            f = fopen(traj_path, "wb");
+            if (!f || fwrite(TRAJ_FILE_MAGIC, 1, 8, f) != 8) {
+                perror("Error creating trajectory file");
+                if (f) fclose(f);
+                return false;
+            }
+        }
+        fclose(f);
+    }
+    if (config.format == SNAPSHOT_NTC) {
+        snprintf(traj_path, sizeof(traj_path),
+                 "data/outputs/trajectory_%s.ntc", config.label);
+        if (!ntc_writer_open(&container, traj_path,
+                             cfg->start_time > 0.0 ? cfg->start_time : -1.0))
+            return false;
+    }
+    return async_io_start();
+}
+
+/** Pack the current state into a free staging slot and queue it.
+ * Packing runs on the compute threads; the file write does not.
+ * ----------------------------------------------------------------- */
+void snapshot_step(const ParticleSystem* sys, int step, double sim_time) {
+    if (!enabled)
+        return;
+
+    int due = 0;
+    if (config.every_steps > 0 && step % config.every_steps == 0)
+        due = 1;
+    if (config.every_time > 0.0 && sim_time >= next_time * (1.0 - 1e-12)) {
+        due = 1;
+        while (next_time <= sim_time * (1.0 + 1e-12))
+            next_time += config.every_time;
+    }
+    if (!due)
+        return;
+
+    size_t bytes = (size_t)sys->N * IO_RECORD_BYTES;
+    if (config.format == SNAPSHOT_TRAJ) {
+        double t0 = sim_time_now();
+        size_t frame_bytes = traj_encode(&encoder, sys, step, sim_time,
+                                         config.traj_error);
+        if (frame_bytes == 0) {
+            fprintf(stderr, "Warning: trajectory frame at step %d skipped\n",
+                    step);
+            return;
+        }
+        StageBuffer* slot = async_io_acquire(frame_bytes);
+        traj_emit(&encoder, slot->data);
+        encode_time += sim_time_now() - t0;
+        encoded_particles += (size_t)sys->N;
+        encoded_bytes     += frame_bytes;
+        slot->len    = frame_bytes;
+        slot->append = 1;
+        slot->failed = &append_failed;
+        snprintf(slot->path, sizeof(slot->path), "%s", traj_path);
+        async_io_submit(slot);
+        return;
+    }
+
+    if (config.format == SNAPSHOT_NTC || config.format == SNAPSHOT_INDEXED) {
+        /* Barnes-Hut leaves the arrays in Z-order of its domain; keying the
+         * frame in that box lets the writer skip the sort. */
+        BHState bh;
+        barnes_hut_get_state(&bh);
+        double box[4] = { bh.x_min, bh.x_max, bh.y_min, bh.y_max };
+        const double* key_box =
+            bh.domain_valid && bh.domain_N == sys->N ? box : NULL;
+        double t0 = sim_time_now();
+        StageBuffer* slot;
+        if (config.format == SNAPSHOT_NTC) {
+            slot = async_io_acquire(ntc_frame_bytes(sys->N));
+            ntc_stage(&container, sys, step, sim_time, key_box, slot->data);
+            slot->len    = ntc_frame_bytes(sys->N);
+            slot->append = 1;
+            slot->failed = &append_failed;
+            snprintf(slot->path, sizeof(slot->path), "%s", traj_path);
+        } else {
+            slot = async_io_acquire(ntc_file_bytes(sys->N));
+            ntc_stage_file(&container, sys, step, sim_time, key_box,
+                           slot->data);
+            slot->len = ntc_file_bytes(sys->N);
+            snprintf(slot->path, sizeof(slot->path),
+                     "data/outputs/snapshot_%s_%06d.ntc", config.label, step);
+        }
+        encode_time += sim_time_now() - t0;
+        encoded_particles += (size_t)sys->N;
+        async_io_submit(slot);
+        return;
+    }
+
+    if (config.format == SNAPSHOT_LOD) {
+        stage_lod(sys, step);
+        return;
+    }
+
+    StageBuffer* slot = async_io_acquire(bytes);
+    io_pack_records(sys, 0, sys->N, slot->data);
+    slot->len = bytes;
+    snprintf(slot->path, sizeof(slot->path),
+             "data/outputs/snapshot_%s_%06d.gal", config.label, step);
+    async_io_submit(slot);
+}
+
+void snapshot_finish(void) {
+    if (!enabled)
+        return;
+
+    /* A failed append stops the stream at its last whole frame */
+    if (config.format == SNAPSHOT_TRAJ || config.format == SNAPSHOT_NTC) {
+        async_io_drain();
+        if (append_failed)
+            fprintf(stderr, "Warning: %s stops at the last frame written "
+                            "before a write error\n", traj_path);
+    }
+    if (config.format == SNAPSHOT_TRAJ && encoded_bytes > 0)
+        printf("Trajectory: %s | %.2f bytes/particle/frame | encode %.3fs\n",
+               traj_path, (double)encoded_bytes / (double)encoded_particles,
+               encode_time);
+    if (config.format == SNAPSHOT_NTC && append_failed) {
+        /* The index would list frames that are not there; left without
+         * one, the container is read by walking its frames. */
+        ntc_writer_free(&container);
+    } else if (config.format == SNAPSHOT_NTC) {
+        /* The index goes after the last frame, drained above */
+        uint64_t n_frames = container.n_frames;
+        if (ntc_writer_close(&container))
+            printf("Container: %s | %llu frames | pack %.3fs\n", traj_path,
+                   (unsigned long long)n_frames, encode_time);
+    }
+    if (config.format == SNAPSHOT_INDEXED) {
+        if (encoded_particles > 0)
+            printf("Indexed snapshots: data/outputs/snapshot_%s_*.ntc | "
+                   "pack %.3fs\n", config.label, encode_time);
+        ntc_writer_free(&container);
+    }
+    if (config.format == SNAPSHOT_LOD && lod_frames > 0)
+        printf("LOD snapshots: data/outputs/lod_%s_*.gal | %.1f cells/snapshot "
+               "| cut %.3fs\n", config.label, (double)lod_cells / lod_frames,
+               encode_time);
+    barnes_hut_lod_free(&lod);
+    traj_encoder_free(&encoder);
+}
+
+/** Cut the current tree and stage its cells as a .gal v2 file.
+ * The columns start with the particle fields, so the file loads as a
+ * particle set; sigma, count and size follow as extra columns.
+ * ----------------------------------------------------------------- */
+static void stage_lod(const ParticleSystem* sys, int step) {
+    double t0 = sim_time_now();
+    if (!barnes_hut_lod(sys, config.lod_depth, config.lod_size, &lod)) {
+        fprintf(stderr, "Warning: no tree for the LOD snapshot at step %d\n",
+                step);
+        return;
+    }
+    const GalColumn cols[] = {
+        { "x", lod.pos_x },      { "y", lod.pos_y },   { "mass", lod.mass },
+        { "vx", lod.vx },        { "vy", lod.vy },
+        { "brightness", lod.brightness },
+        { "sigma", lod.sigma },  { "count", lod.count },
+        { "size", lod.size }
+    };
+    int n_cols = (int)(sizeof(cols) / sizeof(cols[0]));
+    GalWriteOptions opt = { GAL_FLOAT64, 0, 0, { 0.0, 0.0, 0.0, 0.0 } };
+    size_t bytes = io_gal2_bytes(lod.n, n_cols, opt.type);
+    StageBuffer* slot = async_io_acquire(bytes);
+    io_pack_gal2(slot->data, lod.n, cols, n_cols, &opt);
+    slot->len = bytes;
+    snprintf(slot->path, sizeof(slot->path),
+             "data/outputs/lod_%s_%06d.gal", config.label, step);
+    encode_time += sim_time_now() - t0;
+    lod_cells += (size_t)lod.n;
+    lod_frames++;
+    async_io_submit(slot);
+}
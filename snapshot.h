@@ -0,0 +1,36 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "types.h"
+#include <stdbool.h>
+
+typedef enum {
+    SNAPSHOT_GAL,   /* one .gal file per snapshot */
+    SNAPSHOT_TRAJ,  /* frames appended to one compressed .ntz trajectory */
+    SNAPSHOT_NTC,   /* frames appended to one indexed .ntc container */
+    SNAPSHOT_INDEXED, /* one Morton-ordered, block-indexed .ntc per snapshot */
+    SNAPSHOT_LOD    /* one .gal v2 of tree-cell pseudo-particles per snapshot */
+} SnapshotFormat;
+
+typedef struct {
+    int            every_steps;  /* write every K steps, 0 = off */
+    double         every_time;   /* write every T of simulated time, 0 = off */
+    const char*    label;        /* run label used in file names */
+    SnapshotFormat format;
+    double         traj_error;   /* SNAPSHOT_TRAJ error bound, relative */
+    double         start_time;   /* > 0 when resuming from a checkpoint */
+    int            lod_depth;    /* SNAPSHOT_LOD cut depth, 0 = no limit */
+    double         lod_size;     /* SNAPSHOT_LOD cut cell side, 0 = no limit */
+} SnapshotConfig;
+
+// Start the background writer if any cadence is enabled.
+bool snapshot_init(const SnapshotConfig* cfg);
+
+// Called after each completed step; stages the state if a snapshot is due.
+void snapshot_step(const ParticleSystem* sys, int step, double sim_time);
+
+// Finalize the .ntc index and print the snapshot summary; main stops the
+// shared writer afterwards.
+void snapshot_finish(void);
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef CHECK_H
+#define CHECK_H
+
+#include "io.h"
+#include "types.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* Shared pieces of the self-checks under tests/: a deterministic source
+ * of numbers and a small system that puts every kind of body the tree
+ * leaves out next to ordinary ones. Each check returns nonzero from main
+ * on the first mismatch, after printing it. */
+
+#define CHECK_SEED 12345u
+
+static inline double check_uniform(uint64_t* state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    z ^= z >> 31;
+    return (double)(z >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* Masses and radii of the mixed system, for KernelConfig */
+#define CHECK_TRACER_MASS  0.0    /* massless bodies are tracers */
+#define CHECK_HEAVY_MASS   1.0    /* the central body is heavier */
+#define CHECK_OUTLIER_R    10.0   /* the far bodies are beyond this */
+
+/** n bodies: a unit disk of light bodies, every fifth one a massless
+ * tracer, one heavy body at the centre and a handful of outliers, some
+ * of them massless, far outside CHECK_OUTLIER_R.
+ * ----------------------------------------------------------------- */
+static inline ParticleSystem check_mixed_system(int n) {
+    ParticleSystem sys = io_alloc_particles(n);
+    uint64_t rng = CHECK_SEED;
+    for (int i = 0; i < n; i++) {
+        double r = sqrt(check_uniform(&rng));
+        double a = 2.0 * M_PI * check_uniform(&rng);
+        sys.pos_x[i] = r * cos(a);
+        sys.pos_y[i] = r * sin(a);
+        sys.mass[i]  = i % 5 == 4 ? 0.0 : 1e-3 * (0.5 + check_uniform(&rng));
+        sys.vx[i] = sys.vy[i] = 0.0;
+        sys.fx[i] = sys.fy[i] = 0.0;
+    }
+    sys.pos_x[0] = sys.pos_y[0] = 0.0;
+    sys.mass[0] = 10.0;
+    for (int i = 1; i <= 6 && i < n; i++) {
+        double a = 2.0 * M_PI * check_uniform(&rng);
+        sys.pos_x[i] = 50.0 * i * cos(a);
+        sys.pos_y[i] = 50.0 * i * sin(a);
+        sys.mass[i]  = i % 2 ? 1e-3 : 0.0;
+    }
+    return sys;
+}
+
+/* Whether body i of check_mixed_system went into the tree */
+static inline int check_in_tree(const ParticleSystem* sys, int i) {
+    double m = sys->mass[i];
+    return m > CHECK_TRACER_MASS && m <= CHECK_HEAVY_MASS &&
+           sys->pos_x[i] * sys->pos_x[i] + sys->pos_y[i] * sys->pos_y[i] <
+               CHECK_OUTLIER_R * CHECK_OUTLIER_R;
+}
+
+static inline KernelConfig check_config(double theta) {
+    KernelConfig config = { theta, 1, 0, 0.0, NULL, CHECK_TRACER_MASS,
+                            CHECK_HEAVY_MASS, CHECK_OUTLIER_R };
+    return config;
+}
+
+#endif
@@ -0,0 +1,83 @@
+#include "barnes_hut.h"
+#include "check.h"
+#include <stdlib.h>
+
+/* barnes_hut_field at theta 0, where every cell is opened, against the
+ * naive sum. The probes join a copy of the system as massless tracers,
+ * whose naive force is their acceleration; the naive kernel scales G by
+ * 1 / N, so its results are rescaled to the system's own N. Tracers,
+ * the heavy body and the outliers check that the direct list is added. */
+
+/* naive.c, declared as main.c does */
+void compute_force_naive(ParticleSystem* sys, KernelConfig* config);
+
+#define N_BODIES 3000
+#define GRID     24
+#define TOL      1e-9
+
+int main(void) {
+    ParticleSystem sys = check_mixed_system(N_BODIES);
+    KernelConfig config = check_config(0.0);
+    compute_force_barnes_hut(&sys, &config);
+
+    int n = GRID * GRID;
+    double* px  = malloc((size_t)n * sizeof(double));
+    double* py  = malloc((size_t)n * sizeof(double));
+    double* ax  = malloc((size_t)n * sizeof(double));
+    double* ay  = malloc((size_t)n * sizeof(double));
+    double* pot = malloc((size_t)n * sizeof(double));
+    if (!px || !py || !ax || !ay || !pot) exit(1);
+    for (int q = 0; q < n; q++) {
+        px[q] = -2.0 + 4.0 * (q % GRID + 0.37) / GRID;
+        py[q] = -2.0 + 4.0 * (q / GRID + 0.61) / GRID;
+    }
+    if (!barnes_hut_field(&sys, px, py, n, ax, ay, pot)) {
+        fprintf(stderr, "check_field: no tree\n");
+        return 1;
+    }
+
+    ParticleSystem ref = io_alloc_particles(sys.N + n);
+    for (int i = 0; i < ref.N; i++) {
+        int p = i - sys.N;
+        ref.pos_x[i] = p < 0 ? sys.pos_x[i] : px[p];
+        ref.pos_y[i] = p < 0 ? sys.pos_y[i] : py[p];
+        ref.mass[i]  = p < 0 ? sys.mass[i] : 0.0;
+    }
+    double* ref_pot = malloc((size_t)ref.N * sizeof(double));
+    if (!ref_pot) exit(1);
+    KernelConfig naive = { 0.0, 1, 0, 0.0, ref_pot, CHECK_TRACER_MASS, 0.0,
+                           0.0 };
+    compute_force_naive(&ref, &naive);
+
+    double scale = (double)ref.N / sys.N;
+    int n_fail = 0;
+    for (int q = 0; q < n; q++) {
+        int i = sys.N + q;
+        double want[3] = { ref.fx[i] * scale, ref.fy[i] * scale,
+                           ref_pot[i] * scale };
+        double got[3]  = { ax[q], ay[q], pot[q] };
+        double norm = fabs(want[0]) + fabs(want[1]);
+        for (int c = 0; c < 3; c++) {
+            double tol = TOL * (c < 2 ? norm : fabs(want[2]));
+            if (fabs(got[c] - want[c]) > tol && n_fail++ < 10)
+                fprintf(stderr, "probe %d (%g, %g), component %d: %.17g, "
+                                "expected %.17g\n",
+                        q, px[q], py[q], c, got[c], want[c]);
+        }
+    }
+
+    io_free_particles(&sys);
+    io_free_particles(&ref);
+    free(px);
+    free(py);
+    free(ax);
+    free(ay);
+    free(pot);
+    free(ref_pot);
+    if (n_fail) {
+        fprintf(stderr, "check_field: %d mismatches\n", n_fail);
+        return 1;
+    }
+    printf("check_field: ok\n");
+    return 0;
+}
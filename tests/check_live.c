@@ -0,0 +1,113 @@
+#include "check.h"
+#include "live.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/* live_publish and live_read_latest round trip: one frame read back
+ * exactly, then a writer thread that publishes frames as fast as it can
+ * while the reader checks that every copy it gets is one whole frame.
+ * Frame f holds value f * FRAME_STRIDE + i in every column of particle
+ * i, so a torn copy shows as a mix of frames. */
+
+#define N_BODIES     1000
+#define N_SLOTS      3
+#define N_FRAMES     3000
+#define FRAME_STRIDE 1e6
+
+static int n_fail = 0;
+
+static void fill_frame(ParticleSystem* sys, int f) {
+    for (int i = 0; i < sys->N; i++) {
+        double v = f * FRAME_STRIDE + i;
+        sys->pos_x[i] = sys->pos_y[i] = sys->mass[i] = v;
+        sys->vx[i] = sys->vy[i] = sys->brightness[i] = v;
+    }
+}
+
+/* The frame a copy holds, or -1 when its values disagree */
+static int frame_of(const ParticleSystem* sys, int N) {
+    if (sys->N != N) return -1;
+    int f = (int)(sys->pos_x[0] / FRAME_STRIDE);
+    for (int i = 0; i < N; i++) {
+        double v = f * FRAME_STRIDE + i;
+        if (sys->pos_x[i] != v || sys->pos_y[i] != v || sys->mass[i] != v ||
+            sys->vx[i] != v || sys->vy[i] != v || sys->brightness[i] != v)
+            return -1;
+    }
+    return f;
+}
+
+static void* writer(void* arg) {
+    ParticleSystem* sys = arg;
+    for (int f = 2; f <= N_FRAMES; f++) {
+        fill_frame(sys, f);
+        live_publish(sys, f, 0.5 * f, NULL, 0);
+    }
+    return NULL;
+}
+
+int main(void) {
+    char name[64];
+    snprintf(name, sizeof(name), "/nbody_check_live_%ld", (long)getpid());
+    if (!live_open(name, N_SLOTS, N_BODIES)) {
+        fprintf(stderr, "check_live: cannot create %s\n", name);
+        return 1;
+    }
+    LiveReader reader;
+    if (!live_reader_open(name, &reader)) {
+        fprintf(stderr, "check_live: cannot map %s\n", name);
+        live_close();
+        return 1;
+    }
+
+    ParticleSystem out = io_alloc_particles(N_BODIES);
+    LiveFrame frame;
+    if (live_read_latest(&reader, &out, &frame)) {
+        fprintf(stderr, "check_live: a frame before any was published\n");
+        n_fail++;
+    }
+
+    /* One frame, with a box */
+    ParticleSystem sys = io_alloc_particles(N_BODIES);
+    double bbox[4] = { -1.0, 2.0, -3.0, 4.0 };
+    fill_frame(&sys, 1);
+    live_publish(&sys, 1, 0.5, bbox, 1);
+    if (!live_read_latest(&reader, &out, &frame) ||
+        frame_of(&out, N_BODIES) != 1 || frame.frame != 1 ||
+        frame.step != 1 || frame.time != 0.5 || frame.N != N_BODIES ||
+        !frame.morton_sorted || !frame.has_bbox ||
+        frame.bbox[0] != bbox[0] || frame.bbox[3] != bbox[3]) {
+        fprintf(stderr, "check_live: first frame not read back\n");
+        n_fail++;
+    }
+
+    /* Frames racing the reader: each copy whole, none going backwards */
+    pthread_t thread;
+    pthread_create(&thread, NULL, writer, &sys);
+    int last = 1, reads = 0;
+    while (last < N_FRAMES) {
+        if (!live_read_latest(&reader, &out, &frame)) continue;
+        int f = frame_of(&out, N_BODIES);
+        if (f < 0 || f < last || frame.step != f || frame.time != 0.5 * f) {
+            if (n_fail++ < 10)
+                fprintf(stderr, "check_live: torn or stale copy, frame %d "
+                                "after %d\n", f, last);
+            if (f < 0) break;
+        }
+        last = f > last ? f : last;
+        reads++;
+    }
+    pthread_join(thread, NULL);
+
+    live_reader_close(&reader);
+    live_close();
+    io_free_particles(&sys);
+    io_free_particles(&out);
+    if (n_fail) {
+        fprintf(stderr, "check_live: %d failures\n", n_fail);
+        return 1;
+    }
+    printf("check_live: ok (%d reads)\n", reads);
+    return 0;
+}
@@ -0,0 +1,168 @@
+#include "barnes_hut.h"
+#include "check.h"
+#include "neighbours.h"
+#include <stdlib.h>
+
+/* neighbours_radius and neighbours_knn against brute force over the
+ * bodies in the tree: every particle as a query (leaving itself out) and
+ * a grid of points. One system has tracers, a heavy body and outliers;
+ * a small one has coincident particles, which share a leaf, and fewer
+ * particles than k. */
+
+#define N_BODIES 4000
+#define K        12
+#define RADIUS   0.05
+
+static int n_fail = 0;
+
+static void fail(const char* what, int q, int j, double got, double want) {
+    if (n_fail++ < 10)
+        fprintf(stderr, "%s: query %d, entry %d: %g, expected %g\n", what, q,
+                j, got, want);
+}
+
+static double dist(const ParticleSystem* sys, int j, double x, double y) {
+    double dx = sys->pos_x[j] - x, dy = sys->pos_y[j] - y;
+    return sqrt(dx * dx + dy * dy);
+}
+
+static int cmp_int(const void* a, const void* b) {
+    int x = *(const int*)a, y = *(const int*)b;
+    return (x > y) - (x < y);
+}
+
+/* Which bodies went into the tree, for the brute force */
+static unsigned char* in_tree = NULL;
+
+static void mark_in_tree(const ParticleSystem* sys, int mixed) {
+    free(in_tree);
+    in_tree = malloc((size_t)sys->N);
+    if (!in_tree) exit(1);
+    for (int i = 0; i < sys->N; i++)
+        in_tree[i] = mixed ? (unsigned char)check_in_tree(sys, i) : 1;
+}
+
+static void check_knn(const ParticleSystem* sys, const double* qx,
+                      const double* qy, int n, int self) {
+    int*    index = malloc((size_t)n * K * sizeof(int));
+    double* d     = malloc((size_t)n * K * sizeof(double));
+    double* best  = malloc(K * sizeof(double));
+    if (!index || !d || !best) exit(1);
+    if (!neighbours_knn(sys, qx, qy, n, K, self, index, d)) {
+        fail("knn returned false", 0, 0, 0.0, 1.0);
+        return;
+    }
+    for (int q = 0; q < n; q++) {
+        /* The k smallest distances by insertion */
+        for (int a = 0; a < K; a++) best[a] = INFINITY;
+        for (int j = 0; j < sys->N; j++) {
+            if (!in_tree[j] || (self && j == q)) continue;
+            double dj = dist(sys, j, qx[q], qy[q]);
+            if (dj >= best[K - 1]) continue;
+            int a = K - 1;
+            while (a > 0 && best[a - 1] > dj) {
+                best[a] = best[a - 1];
+                a--;
+            }
+            best[a] = dj;
+        }
+        for (int a = 0; a < K; a++) {
+            int j = index[(size_t)q * K + a];
+            double got = d[(size_t)q * K + a];
+            if (isinf(best[a])) {
+                /* Fewer than k qualify: the row is padded */
+                if (j != -1 || !isinf(got))
+                    fail("knn padding", q, a, got, best[a]);
+            } else if (fabs(got - best[a]) > 1e-12) {
+                fail("knn distance", q, a, got, best[a]);
+            } else if (j < 0 || !in_tree[j] ||
+                       fabs(dist(sys, j, qx[q], qy[q]) - got) > 1e-12) {
+                fail("knn index", q, a, j, best[a]);
+            }
+        }
+    }
+    free(index);
+    free(d);
+    free(best);
+}
+
+static void check_radius(const ParticleSystem* sys, const double* qx,
+                         const double* qy, int n, int self) {
+    NeighbourList list = { 0 };
+    int* want = malloc((size_t)sys->N * sizeof(int));
+    int* got  = malloc((size_t)sys->N * sizeof(int));
+    if (!want || !got) exit(1);
+    if (!neighbours_radius(sys, qx, qy, n, RADIUS, self, &list)) {
+        fail("radius returned false", 0, 0, 0.0, 1.0);
+        return;
+    }
+    for (int q = 0; q < n; q++) {
+        int n_want = 0;
+        for (int j = 0; j < sys->N; j++)
+            if (in_tree[j] && !(self && j == q) &&
+                dist(sys, j, qx[q], qy[q]) <= RADIUS)
+                want[n_want++] = j;
+        int n_got = (int)(list.offset[q + 1] - list.offset[q]);
+        for (int a = 0; a < n_got; a++)
+            got[a] = list.index[list.offset[q] + a];
+        qsort(got, (size_t)n_got, sizeof(int), cmp_int);
+        if (n_got != n_want) {
+            fail("radius count", q, 0, n_got, n_want);
+            continue;
+        }
+        for (int a = 0; a < n_got; a++)
+            if (got[a] != want[a]) fail("radius index", q, a, got[a], want[a]);
+    }
+    neighbours_free(&list);
+    free(want);
+    free(got);
+}
+
+static void check_grid(const ParticleSystem* sys) {
+    enum { G = 40 };
+    double gx[G * G], gy[G * G];
+    for (int i = 0; i < G * G; i++) {
+        gx[i] = -1.5 + 3.0 * (i % G + 0.5) / G;
+        gy[i] = -1.5 + 3.0 * (i / G + 0.5) / G;
+    }
+    check_knn(sys, gx, gy, G * G, 0);
+    check_radius(sys, gx, gy, G * G, 0);
+}
+
+int main(void) {
+    ParticleSystem sys = check_mixed_system(N_BODIES);
+    KernelConfig config = check_config(0.5);
+    compute_force_barnes_hut(&sys, &config);
+    mark_in_tree(&sys, 1);
+    check_knn(&sys, sys.pos_x, sys.pos_y, sys.N, 1);
+    check_radius(&sys, sys.pos_x, sys.pos_y, sys.N, 1);
+    check_grid(&sys);
+    io_free_particles(&sys);
+
+    /* Nine bodies, three of them on one spot and two on another */
+    static const double xs[9] = { 0.5, 0.5, 0.5, 0.3, 0.3, 0.0, 0.1, -0.2,
+                                  0.04 };
+    static const double ys[9] = { 0.2, 0.2, 0.2, -0.1, -0.1, 0.0, 0.3, -0.4,
+                                  0.03 };
+    sys = check_mixed_system(9);
+    for (int i = 0; i < sys.N; i++) {
+        sys.pos_x[i] = xs[i];
+        sys.pos_y[i] = ys[i];
+        sys.mass[i]  = 1e-3;
+    }
+    KernelConfig plain = { 0.5, 1, 0, 0.0, NULL, 0.0, 0.0, 0.0 };
+    compute_force_barnes_hut(&sys, &plain);
+    mark_in_tree(&sys, 0);
+    check_knn(&sys, sys.pos_x, sys.pos_y, sys.N, 1);
+    check_radius(&sys, sys.pos_x, sys.pos_y, sys.N, 1);
+    check_grid(&sys);
+    io_free_particles(&sys);
+    free(in_tree);
+
+    if (n_fail) {
+        fprintf(stderr, "check_neighbours: %d mismatches\n", n_fail);
+        return 1;
+    }
+    printf("check_neighbours: ok\n");
+    return 0;
+}
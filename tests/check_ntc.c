@@ -0,0 +1,155 @@
+#include "check.h"
+#include "ntc.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* .ntc index lookup: a container written frame by frame and closed, then
+ * ntc_find_frame at, between and beyond the frame times, whole frames
+ * and box queries read back record for record, and the same lookups on
+ * a container an interrupted run left without an index and with a last
+ * frame cut short. A particle's mass carries its index in the frame. */
+
+#define N_BODIES 10000
+#define N_FRAMES 5
+
+static int n_fail = 0;
+
+static void fill(ParticleSystem* sys, int f) {
+    uint64_t rng = CHECK_SEED + (uint64_t)f;
+    for (int i = 0; i < sys->N; i++) {
+        sys->pos_x[i] = 2.0 * check_uniform(&rng) - 1.0;
+        sys->pos_y[i] = 2.0 * check_uniform(&rng) - 1.0;
+        sys->mass[i]  = i;
+        sys->vx[i] = sys->vy[i] = 0.1 * f;
+        sys->brightness[i] = 1.0;
+    }
+}
+
+/* Stage n_frames frames and append them; close writes the index */
+static bool write_container(const char* path, int n_frames, bool close) {
+    NtcWriter w;
+    if (!ntc_writer_open(&w, path, -1.0))
+        return false;
+    FILE* f = fopen(path, "ab");
+    if (!f) {
+        ntc_writer_free(&w);
+        return false;
+    }
+    ParticleSystem sys = io_alloc_particles(N_BODIES);
+    unsigned char* buf = malloc(ntc_frame_bytes(N_BODIES));
+    if (!buf) exit(1);
+    bool ok = true;
+    for (int fr = 0; fr < n_frames && ok; fr++) {
+        fill(&sys, fr);
+        ntc_stage(&w, &sys, 10 * fr, 0.1 * fr, NULL, buf);
+        ok = fwrite(buf, 1, ntc_frame_bytes(N_BODIES), f) ==
+             ntc_frame_bytes(N_BODIES);
+    }
+    ok = fclose(f) == 0 && ok;
+    if (close) ok = ntc_writer_close(&w) && ok;
+    else       ntc_writer_free(&w);
+    free(buf);
+    io_free_particles(&sys);
+    return ok;
+}
+
+/* Frame fr, or the part of it in box, against what fill wrote */
+static void check_frame(const NtcReader* r, int fr, const double* box) {
+    ParticleSystem want = io_alloc_particles(N_BODIES);
+    ParticleSystem got;
+    int chunks = 0;
+    fill(&want, fr);
+    if (!ntc_read_frame(r, fr, box, &got, &chunks)) {
+        fprintf(stderr, "frame %d not read\n", fr);
+        n_fail++;
+        io_free_particles(&want);
+        return;
+    }
+    int n_want = 0;
+    for (int i = 0; i < N_BODIES; i++)
+        n_want += !box || (want.pos_x[i] >= box[0] &&
+                           want.pos_x[i] <= box[1] &&
+                           want.pos_y[i] >= box[2] && want.pos_y[i] <= box[3]);
+    int n_chunks = (N_BODIES + NTC_CHUNK - 1) / NTC_CHUNK;
+    if (got.N != n_want || (box && chunks >= n_chunks)) {
+        fprintf(stderr, "frame %d: %d particles from %d chunks, expected "
+                        "%d\n", fr, got.N, chunks, n_want);
+        n_fail++;
+    }
+    for (int p = 0; p < got.N; p++) {
+        int i = (int)got.mass[p];
+        if (i < 0 || i >= N_BODIES || got.mass[p] != i ||
+            got.pos_x[p] != want.pos_x[i] || got.pos_y[p] != want.pos_y[i] ||
+            got.vx[p] != want.vx[i] || got.vy[p] != want.vy[i]) {
+            if (n_fail++ < 10)
+                fprintf(stderr, "frame %d, record %d does not match\n", fr,
+                        p);
+        }
+    }
+    io_free_particles(&want);
+    io_free_particles(&got);
+}
+
+static void check_lookup(const char* path, int n_frames, int indexed) {
+    NtcReader r;
+    if (!ntc_open(&r, path)) {
+        fprintf(stderr, "cannot open %s\n", path);
+        n_fail++;
+        return;
+    }
+    if ((int)r.n_frames != n_frames || r.indexed != indexed) {
+        fprintf(stderr, "%s: %d frames (indexed %d), expected %d (%d)\n",
+                path, (int)r.n_frames, r.indexed, n_frames, indexed);
+        n_fail++;
+    }
+    /* Before the first frame, on each frame, just after it */
+    if (ntc_find_frame(&r, -0.05) != -1) {
+        fprintf(stderr, "%s: a frame before the first\n", path);
+        n_fail++;
+    }
+    for (int fr = 0; fr < n_frames; fr++) {
+        if (ntc_find_frame(&r, 0.1 * fr) != fr ||
+            ntc_find_frame(&r, 0.1 * fr + 0.05) != fr) {
+            fprintf(stderr, "%s: frame %d not found at its time\n", path, fr);
+            n_fail++;
+        }
+        if (r.index[fr].step != 10 * fr || r.index[fr].N != N_BODIES) {
+            fprintf(stderr, "%s: index entry %d is wrong\n", path, fr);
+            n_fail++;
+        }
+    }
+    double box[4] = { -0.2, 0.3, 0.1, 0.45 };
+    check_frame(&r, n_frames - 1, NULL);
+    check_frame(&r, n_frames / 2, box);
+    ntc_close(&r);
+}
+
+int main(void) {
+    char path[64];
+    snprintf(path, sizeof(path), "check_ntc_%ld.ntc", (long)getpid());
+
+    if (!write_container(path, N_FRAMES, true)) {
+        fprintf(stderr, "check_ntc: cannot write %s\n", path);
+        return 1;
+    }
+    check_lookup(path, N_FRAMES, 1);
+
+    /* No index, and the last frame cut short */
+    if (!write_container(path, 3, false) ||
+        truncate(path, (off_t)(sizeof(NtcFileHeader) +
+                               3 * ntc_frame_bytes(N_BODIES) - 100)) != 0) {
+        fprintf(stderr, "check_ntc: cannot write %s\n", path);
+        unlink(path);
+        return 1;
+    }
+    check_lookup(path, 2, 0);
+    unlink(path);
+
+    if (n_fail) {
+        fprintf(stderr, "check_ntc: %d failures\n", n_fail);
+        return 1;
+    }
+    printf("check_ntc: ok\n");
+    return 0;
+}
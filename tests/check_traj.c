@@ -0,0 +1,188 @@
+#include "check.h"
+#include "traj.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* .ntz round trip: frames encoded with traj_encode and traj_emit, read
+ * back with traj_read_frame, every value within rel_error of the field
+ * extent. The frames span several blocks, a lone particle, an empty
+ * frame and a far outlier at fine error bounds, which forces long Rice
+ * codes and escapes; the finest is below the 2^-49 floor on the error.
+ * traj_resume_bytes must then find frame boundaries. A frame with a NaN
+ * is refused, and headers whose payload size cannot hold the block size
+ * table, or runs past the end of the file, are rejected when read. */
+
+#define N_FRAMES 6
+
+typedef struct {
+    int    N;
+    double rel_error;
+    double outlier;   /* distance of particle 0, 0 = in the disk */
+} FrameSpec;
+
+static const FrameSpec SPECS[N_FRAMES] = {
+    { 3 * TRAJ_BLOCK + 17, 1e-6, 0.0 },
+    { 3 * TRAJ_BLOCK + 17, 1e-3, 0.0 },
+    { 1, 1e-6, 0.0 },
+    { 0, 1e-6, 0.0 },
+    { 2 * TRAJ_BLOCK, 1e-12, 1e6 },
+    { TRAJ_BLOCK, 1e-18, 1e6 },    /* finer than the coarsest quantum */
+};
+
+static int n_fail = 0;
+
+static void fill(ParticleSystem* sys, const FrameSpec* spec, int f) {
+    uint64_t rng = CHECK_SEED + (uint64_t)f;
+    for (int i = 0; i < sys->N; i++) {
+        double r = sqrt(check_uniform(&rng));
+        double a = 2.0 * M_PI * check_uniform(&rng);
+        sys->pos_x[i] = r * cos(a);
+        sys->pos_y[i] = r * sin(a);
+        sys->vx[i] = -0.3 * sin(a) + 0.01 * check_uniform(&rng);
+        sys->vy[i] =  0.3 * cos(a) + 0.01 * check_uniform(&rng);
+    }
+    if (sys->N > 0 && spec->outlier > 0.0)
+        sys->pos_x[0] = spec->outlier;
+}
+
+static double extent(const double* a, const double* b, int N) {
+    double a_lo = INFINITY, a_hi = -INFINITY, b_lo = INFINITY, b_hi = -INFINITY;
+    for (int i = 0; i < N; i++) {
+        a_lo = fmin(a_lo, a[i]);
+        a_hi = fmax(a_hi, a[i]);
+        b_lo = fmin(b_lo, b[i]);
+        b_hi = fmax(b_hi, b[i]);
+    }
+    return N > 0 ? fmax(a_hi - a_lo, b_hi - b_lo) : 0.0;
+}
+
+static void compare(const ParticleSystem* sys, const TrajFrame* fr,
+                    const FrameSpec* spec, int f) {
+    const double* want[TRAJ_FIELDS] = { sys->pos_x, sys->pos_y, sys->vx,
+                                        sys->vy };
+    const double* got[TRAJ_FIELDS]  = { fr->pos_x, fr->pos_y, fr->vx,
+                                        fr->vy };
+    double ext[2] = { extent(sys->pos_x, sys->pos_y, sys->N),
+                      extent(sys->vx, sys->vy, sys->N) };
+    if (fr->header.N != sys->N || fr->header.step != 10 * f ||
+        fr->header.time != 0.1 * f) {
+        fprintf(stderr, "frame %d: header N %d step %d time %g\n", f,
+                fr->header.N, fr->header.step, fr->header.time);
+        n_fail++;
+        return;
+    }
+    for (int c = 0; c < TRAJ_FIELDS; c++) {
+        /* The bound, plus the rounding of origin + u * quantum */
+        double rel = fmax(spec->rel_error, ldexp(1.0, -49));
+        double tol = rel * ext[c / 2] * (1.0 + 1e-6) +
+                     1e-15 * (fabs(fr->header.origin[c]) + ext[c / 2]);
+        for (int i = 0; i < sys->N; i++)
+            if (fabs(got[c][i] - want[c][i]) > tol && n_fail++ < 10)
+                fprintf(stderr, "frame %d, field %d, particle %d: %.17g, "
+                                "expected %.17g\n",
+                        f, c, i, got[c][i], want[c][i]);
+    }
+}
+
+int main(void) {
+    FILE* file = tmpfile();
+    if (!file || fwrite(TRAJ_FILE_MAGIC, 1, 8, file) != 8) {
+        fprintf(stderr, "check_traj: cannot create a temporary file\n");
+        return 1;
+    }
+
+    TrajEncoder enc;
+    memset(&enc, 0, sizeof(enc));
+    ParticleSystem sys[N_FRAMES];
+    long end_of[N_FRAMES];
+    for (int f = 0; f < N_FRAMES; f++) {
+        sys[f] = io_alloc_particles(SPECS[f].N);
+        fill(&sys[f], &SPECS[f], f);
+        size_t bytes = traj_encode(&enc, &sys[f], 10 * f, 0.1 * f,
+                                   SPECS[f].rel_error);
+        unsigned char* buf = malloc(bytes);
+        if (!buf) exit(1);
+        traj_emit(&enc, buf);
+        if (fwrite(buf, 1, bytes, file) != bytes) exit(1);
+        free(buf);
+        end_of[f] = ftell(file);
+    }
+    ParticleSystem bad = io_alloc_particles(TRAJ_BLOCK);
+    fill(&bad, &SPECS[0], 0);
+    bad.vy[7] = NAN;
+    if (traj_encode(&enc, &bad, 0, 0.0, 1e-6) != 0) {
+        fprintf(stderr, "check_traj: a frame with a NaN was encoded\n");
+        n_fail++;
+    }
+    io_free_particles(&bad);
+    traj_encoder_free(&enc);
+
+    rewind(file);
+    if (!traj_check_magic(file)) {
+        fprintf(stderr, "check_traj: magic not read back\n");
+        n_fail++;
+    }
+    for (int f = 0; f < N_FRAMES && !n_fail; f++) {
+        TrajFrame fr;
+        if (!traj_read_frame(file, &fr)) {
+            fprintf(stderr, "check_traj: frame %d not read back\n", f);
+            n_fail++;
+            break;
+        }
+        compare(&sys[f], &fr, &SPECS[f], f);
+        traj_free_frame(&fr);
+    }
+    TrajFrame extra;
+    if (!n_fail && traj_read_frame(file, &extra)) {
+        fprintf(stderr, "check_traj: a frame past the end\n");
+        traj_free_frame(&extra);
+        n_fail++;
+    }
+
+    /* Resume points: before any frame, on a frame, between frames */
+    static const double resume[3]  = { 0.05, 0.2, 0.25 };
+    static const int    keep[3]    = { 1, 3, 3 };
+    for (int r = 0; r < 3; r++) {
+        fseek(file, 8, SEEK_SET);
+        uint64_t bytes = traj_resume_bytes(file, resume[r]);
+        if (bytes != (uint64_t)end_of[keep[r] - 1]) {
+            fprintf(stderr, "check_traj: resume at %g keeps %llu bytes, "
+                            "expected %ld\n", resume[r],
+                    (unsigned long long)bytes, end_of[keep[r] - 1]);
+            n_fail++;
+        }
+    }
+
+    /* The first frame's header, its payload size made too small, then
+     * too large for the file */
+    TrajFrameHeader h;
+    fseek(file, 8, SEEK_SET);
+    if (fread(&h, sizeof(h), 1, file) != 1) exit(1);
+    fclose(file);
+    static const uint64_t bogus[2] = { 4, 1ull << 40 };
+    for (int b = 0; b < 2; b++) {
+        FILE* cut = tmpfile();
+        h.payload_bytes = bogus[b];
+        if (!cut || fwrite(&h, sizeof(h), 1, cut) != 1 ||
+            fwrite(TRAJ_FILE_MAGIC, 1, 8, cut) != 8)
+            exit(1);
+        rewind(cut);
+        TrajFrame fr;
+        if (traj_read_frame(cut, &fr)) {
+            fprintf(stderr, "check_traj: payload of %llu bytes accepted\n",
+                    (unsigned long long)bogus[b]);
+            traj_free_frame(&fr);
+            n_fail++;
+        }
+        fclose(cut);
+    }
+
+    for (int f = 0; f < N_FRAMES; f++)
+        io_free_particles(&sys[f]);
+    if (n_fail) {
+        fprintf(stderr, "check_traj: %d failures\n", n_fail);
+        return 1;
+    }
+    printf("check_traj: ok\n");
+    return 0;
+}
@@ -0,0 +1,228 @@
+#include "track.h"
+#include "async_io.h"
+#include "ids.h"
+#include "time_utils.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static ParticleId*    tracked   = NULL;
+static uint32_t       n_tracked = 0;
+static unsigned char* buffer    = NULL;
+static size_t         buffered  = 0, buffer_cap = 0;
+static uint64_t       n_frames  = 0;
+static double         record_time = 0.0;
+static char           track_path[ASYNC_IO_PATH_MAX];
+
+static bool read_id_list(const char* list_path, int N);
+static bool resume_file(int resume_step);
+static void flush_frames(void);
+
+bool track_init(const char* list_path, const char* label,
+                ParticleSystem* sys, int resume_step) {
+    if (!read_id_list(list_path, sys->N))
+        return false;
+    if (!sys->id)
+        ids_init(sys);
+
+    size_t frame = (size_t)track_frame_bytes(n_tracked);
+    buffer_cap = frame > TRACK_BUFFER_BYTES
+                     ? frame
+                     : TRACK_BUFFER_BYTES / frame * frame;
+    buffer = malloc(buffer_cap);
+    if (!buffer) {
+        fprintf(stderr, "Error: Memory allocation failed for track buffer.\n");
+        exit(1);
+    }
+
+    /* Header and id list go out now; frames are appended by the I/O thread */
+    snprintf(track_path, sizeof(track_path), "data/outputs/tracks_%s.trk",
+             label);
+    if (resume_step >= 0 && resume_file(resume_step))
+        return async_io_start();
+    FILE* f = fopen(track_path, "wb");
+    if (!f) {
+        perror("Error creating track file");
+        return false;
+    }
+    TrackHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, TRACK_MAGIC, 8);
+    h.version   = 1;
+    h.n_tracked = n_tracked;
+    bool ok = fwrite(&h, sizeof(h), 1, f) == 1;
+    for (uint32_t j = 0; j < n_tracked && ok; j++) {
+        uint64_t id = tracked[j];
+        ok = fwrite(&id, sizeof(id), 1, f) == 1;
+    }
+    if (fclose(f) != 0 || !ok) {
+        perror("Error writing track file");
+        return false;
+    }
+    return async_io_start();
+}
+
+/** One lookup per tracked particle through the id index; the cost does
+ * not depend on N or on how the last reordering moved the arrays.
+ * ----------------------------------------------------------------- */
+void track_step(const ParticleSystem* sys, int step, double sim_time) {
+    if (!tracked)
+        return;
+    double t0 = sim_time_now();
+    size_t frame = (size_t)track_frame_bytes(n_tracked);
+    if (buffered + frame > buffer_cap)
+        flush_frames();
+
+    unsigned char* p = buffer + buffered;
+    int64_t s = step;
+    memcpy(p, &s, 8);
+    memcpy(p + 8, &sim_time, 8);
+    double* rec = (double*)(p + 16);   /* frames are multiples of 8 bytes */
+    for (uint32_t j = 0; j < n_tracked; j++) {
+        int i = sys->index_of[tracked[j]];
+        rec[4 * j + 0] = sys->pos_x[i];
+        rec[4 * j + 1] = sys->pos_y[i];
+        rec[4 * j + 2] = sys->vx[i];
+        rec[4 * j + 3] = sys->vy[i];
+    }
+    buffered += frame;
+    n_frames++;
+    record_time += sim_time_now() - t0;
+}
+
+void track_finish(void) {
+    if (!tracked)
+        return;
+    flush_frames();
+    printf("Tracked: %s | %u particles | %llu frames | record %.1fus/step\n",
+           track_path, n_tracked, (unsigned long long)n_frames,
+           n_frames ? record_time * 1e6 / (double)n_frames : 0.0);
+    free(tracked);
+    free(buffer);
+    tracked = NULL;
+    buffer  = NULL;
+}
+
+/** Cut an earlier run's track file back to resume_step so the frames
+ * continue without a gap or a repeat. Steps are consecutive, so the
+ * frame count follows from the step of the first frame.
+ * ----------------------------------------------------------------- */
+static bool resume_file(int resume_step) {
+    FILE* f = fopen(track_path, "r+b");
+    if (!f)
+        return false;
+    TrackHeader h;
+    bool same = fread(&h, sizeof(h), 1, f) == 1 &&
+                memcmp(h.magic, TRACK_MAGIC, 8) == 0 &&
+                h.n_tracked == n_tracked;
+    for (uint32_t j = 0; j < n_tracked && same; j++) {
+        uint64_t id;
+        same = fread(&id, sizeof(id), 1, f) == 1 && id == tracked[j];
+    }
+    int64_t first_step = resume_step + 1;
+    if (same && fread(&first_step, sizeof(first_step), 1, f) != 1)
+        first_step = resume_step + 1;
+    uint64_t keep = first_step <= resume_step
+                        ? (uint64_t)(resume_step - first_step + 1) : 0;
+    /* Never extend a file that stops short of the checkpoint */
+    long size = same && fseek(f, 0, SEEK_END) == 0 ? ftell(f) : 0;
+    uint64_t present = (uint64_t)size > track_frame_offset(n_tracked, 0)
+        ? ((uint64_t)size - track_frame_offset(n_tracked, 0)) /
+              track_frame_bytes(n_tracked)
+        : 0;
+    if (keep > present)
+        keep = present;
+    bool ok = same && fflush(f) == 0 &&
+              ftruncate(fileno(f), (off_t)track_frame_offset(n_tracked,
+                                                             keep)) == 0;
+    fclose(f);
+    if (same && !ok)
+        perror("Error truncating track file");
+    return ok;
+}
+
+/* Hand the buffered frames to the I/O thread */
+static void flush_frames(void) {
+    if (buffered == 0)
+        return;
+    StageBuffer* slot = async_io_acquire(buffered);
+    memcpy(slot->data, buffer, buffered);
+    slot->len    = buffered;
+    slot->append = 1;
+    snprintf(slot->path, sizeof(slot->path), "%s", track_path);
+    async_io_submit(slot);
+    buffered = 0;
+}
+
+/** Parse the id list; every id must name one of the N particles.
+ * ----------------------------------------------------------------- */
+static bool read_id_list(const char* list_path, int N) {
+    FILE* f = fopen(list_path, "r");
+    if (!f) {
+        perror("Error opening track list");
+        return false;
+    }
+    size_t len = 0, text_cap = 4096;
+    char* text = malloc(text_cap);
+    size_t got;
+    while (text && (got = fread(text + len, 1, text_cap - 1 - len, f)) > 0) {
+        len += got;
+        if (len == text_cap - 1) {
+            text_cap *= 2;
+            char* grown = realloc(text, text_cap);
+            if (!grown) free(text);
+            text = grown;
+        }
+    }
+    fclose(f);
+
+    size_t cap = 1024;
+    tracked = text ? malloc(cap * sizeof(ParticleId)) : NULL;
+    if (!tracked) {
+        fprintf(stderr, "Error: Memory allocation failed for track list.\n");
+        exit(1);
+    }
+    text[len] = '\0';
+    for (char* p = text; *p;) {
+        if (isspace((unsigned char)*p)) {
+            p++;
+            continue;
+        }
+        if (*p == '#') {
+            while (*p && *p != '\n') p++;
+            continue;
+        }
+        char* end = NULL;
+        unsigned long long id = strtoull(p, &end, 10);
+        if (end == p || (*end && !isspace((unsigned char)*end) && *end != '#') ||
+            *p == '-' || id >= (unsigned long long)N) {
+            fprintf(stderr, "Error: %s: \"%.20s\" is not a particle id below "
+                            "%d.\n", list_path, p, N);
+            free(text);
+            free(tracked);
+            tracked = NULL;
+            return false;
+        }
+        if (n_tracked == cap) {
+            cap *= 2;
+            tracked = realloc(tracked, cap * sizeof(ParticleId));
+            if (!tracked) {
+                fprintf(stderr, "Error: Memory allocation failed for track "
+                                "list.\n");
+                exit(1);
+            }
+        }
+        tracked[n_tracked++] = (ParticleId)id;
+        p = end;
+    }
+    free(text);
+    if (n_tracked == 0) {
+        fprintf(stderr, "Error: %s lists no particle ids.\n", list_path);
+        free(tracked);
+        tracked = NULL;
+        return false;
+    }
+    return true;
+}
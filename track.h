@@ -0,0 +1,45 @@
+#ifndef TRACK_H
+#define TRACK_H
+
+#include "types.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Tracked particles: the state of a chosen set of particle ids, appended
+ * after every step to data/outputs/tracks_<label>.trk. The file is a
+ * TrackHeader, n_tracked ids as uint64, then fixed-size frames of
+ * int64 step, double time and x, y, vx, vy per tracked particle in list
+ * order, so frame f starts at track_frame_offset(n, f). */
+#define TRACK_MAGIC        "NBODYTRK"
+#define TRACK_BUFFER_BYTES (1 << 20)   /* frames kept before a write */
+
+typedef struct {
+    char     magic[8];
+    uint32_t version;     /* 1 */
+    uint32_t n_tracked;
+} TrackHeader;
+
+static inline uint64_t track_frame_bytes(uint32_t n_tracked) {
+    return 16 + 32 * (uint64_t)n_tracked;
+}
+
+static inline uint64_t track_frame_offset(uint32_t n_tracked, uint64_t f) {
+    return sizeof(TrackHeader) + 8 * (uint64_t)n_tracked +
+           f * track_frame_bytes(n_tracked);
+}
+
+// Read the ids to track from list_path (whitespace-separated, '#' starts
+// a comment), give sys persistent ids and create the track file. A run
+// resumed at resume_step (-1 = fresh run) keeps the frames up to that
+// step of an existing track file for the same ids.
+bool track_init(const char* list_path, const char* label,
+                ParticleSystem* sys, int resume_step);
+
+// Record the tracked particles after a completed step.
+void track_step(const ParticleSystem* sys, int step, double sim_time);
+
+// Queue the buffered frames and print the summary; main stops the
+// shared writer afterwards.
+void track_finish(void);
+
+#endif
@@ -0,0 +1,442 @@
+#include "traj.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Quotients at or above this are escaped to a raw 64-bit value */
+#define RICE_ESCAPE 24
+#define RICE_K_MAX  40
+
+/* Quanta are at least 2^-QUANTUM_BITS of the field extent. Finer steps
+ * would be below what doubles resolve anyway, and the bound keeps every
+ * quantized value under 2^48, so deltas, zigzag codes and their block
+ * sums stay far inside 64 bits. */
+#define QUANTUM_BITS 48
+
+/* Per field in a block: 1 byte Rice parameter + 4 byte stream length */
+#define FIELD_HEADER_BYTES 5
+
+/* Upper bound on one encoded block */
+#define BLOCK_WORST_BYTES \
+    (TRAJ_FIELDS * (FIELD_HEADER_BYTES + (TRAJ_BLOCK * (RICE_ESCAPE + 64) + 7) / 8 + 8))
+
+typedef struct {
+    unsigned char* p;
+    uint64_t acc;
+    int n;
+} BitWriter;
+
+typedef struct {
+    const unsigned char* p;
+    const unsigned char* end;
+    uint64_t acc;
+    int n;
+} BitReader;
+
+static size_t encode_block(const ParticleSystem* sys, int first, int count,
+                           const TrajFrameHeader* h, unsigned char* dst);
+static bool   decode_block(const unsigned char* src, size_t len, int first,
+                           int count, const TrajFrameHeader* h,
+                           TrajFrame* frame);
+static bool   field_extent(const double* a, const double* b, int N,
+                           double* min_a, double* min_b, double* extent);
+
+size_t traj_encode(TrajEncoder* enc, const ParticleSystem* sys, int step,
+                   double time, double rel_error) {
+    int N = sys->N;
+    int n_blocks = (N + TRAJ_BLOCK - 1) / TRAJ_BLOCK;
+
+    if (enc->blocks_cap < n_blocks) {
+        free(enc->scratch);
+        free(enc->block_bytes);
+        free(enc->block_offset);
+        enc->scratch_cap  = (size_t)n_blocks * BLOCK_WORST_BYTES;
+        enc->scratch      = malloc(enc->scratch_cap);
+        enc->block_bytes  = malloc((size_t)n_blocks * sizeof(uint32_t));
+        enc->block_offset = malloc((size_t)n_blocks * sizeof(size_t));
+        if (!enc->scratch || !enc->block_bytes || !enc->block_offset) {
+            fprintf(stderr, "Error: Memory allocation failed for trajectory "
+                            "encoder.\n");
+            exit(1);
+        }
+        enc->blocks_cap = n_blocks;
+    }
+
+    /* Positions share one quantum, velocities another, so the error bound
+     * is relative to the domain rather than to each axis separately. */
+    TrajFrameHeader* h = &enc->header;
+    double pos_extent, vel_extent;
+    if (!field_extent(sys->pos_x, sys->pos_y, N, &h->origin[0],
+                      &h->origin[1], &pos_extent) ||
+        !field_extent(sys->vx, sys->vy, N, &h->origin[2], &h->origin[3],
+                      &vel_extent)) {
+        fprintf(stderr, "Error: non-finite position or velocity in the "
+                        "trajectory frame at step %d.\n", step);
+        return 0;
+    }
+    double q_pos = fmax(2.0 * rel_error, ldexp(1.0, -QUANTUM_BITS)) *
+                   pos_extent;
+    double q_vel = fmax(2.0 * rel_error, ldexp(1.0, -QUANTUM_BITS)) *
+                   vel_extent;
+    if (!(q_pos > 0.0)) q_pos = 1.0;
+    if (!(q_vel > 0.0)) q_vel = 1.0;
+
+    memcpy(h->magic, "NTZF", 4);
+    h->n_blocks   = (uint32_t)n_blocks;
+    h->step       = step;
+    h->N          = N;
+    h->time       = time;
+    h->quantum[0] = h->quantum[1] = q_pos;
+    h->quantum[2] = h->quantum[3] = q_vel;
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, 1)
+#endif
+    for (int b = 0; b < n_blocks; b++) {
+        int first = b * TRAJ_BLOCK;
+        int count = N - first < TRAJ_BLOCK ? N - first : TRAJ_BLOCK;
+        enc->block_bytes[b] = (uint32_t)encode_block(
+            sys, first, count, h,
+            enc->scratch + (size_t)b * BLOCK_WORST_BYTES);
+    }
+
+    size_t payload = (size_t)n_blocks * sizeof(uint32_t);
+    for (int b = 0; b < n_blocks; b++) {
+        enc->block_offset[b] = sizeof(TrajFrameHeader) + payload;
+        payload += enc->block_bytes[b];
+    }
+    h->payload_bytes = payload;
+    return sizeof(TrajFrameHeader) + payload;
+}
+
+/** Copy the header, size table and compacted blocks of the last frame.
+ * ----------------------------------------------------------------- */
+void traj_emit(const TrajEncoder* enc, unsigned char* dst) {
+    int n_blocks = (int)enc->header.n_blocks;
+    memcpy(dst, &enc->header, sizeof(TrajFrameHeader));
+    memcpy(dst + sizeof(TrajFrameHeader), enc->block_bytes,
+           (size_t)n_blocks * sizeof(uint32_t));
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+    for (int b = 0; b < n_blocks; b++)
+        memcpy(dst + enc->block_offset[b],
+               enc->scratch + (size_t)b * BLOCK_WORST_BYTES,
+               enc->block_bytes[b]);
+}
+
+void traj_encoder_free(TrajEncoder* enc) {
+    free(enc->scratch);
+    free(enc->block_bytes);
+    free(enc->block_offset);
+    memset(enc, 0, sizeof(*enc));
+}
+
+bool traj_check_magic(FILE* f) {
+    char magic[8];
+    return fread(magic, 1, 8, f) == 8 && memcmp(magic, TRAJ_FILE_MAGIC, 8) == 0;
+}
+
+/** Walk the frame headers, skipping the payloads. Frames a run wrote
+ * past its checkpoint, and a frame cut short by a crash, are dropped.
+ * ----------------------------------------------------------------- */
+uint64_t traj_resume_bytes(FILE* f, double resume_time) {
+    uint64_t keep = (uint64_t)ftell(f);
+    fseek(f, 0, SEEK_END);
+    uint64_t file_size = (uint64_t)ftell(f);
+    fseek(f, (long)keep, SEEK_SET);
+
+    TrajFrameHeader h;
+    while (fread(&h, sizeof(h), 1, f) == 1 &&
+           memcmp(h.magic, "NTZF", 4) == 0 &&
+           h.time <= resume_time * (1.0 + 1e-12) &&
+           h.payload_bytes <= file_size - keep - sizeof(h)) {
+        keep += sizeof(h) + h.payload_bytes;
+        if (fseek(f, (long)keep, SEEK_SET) != 0)
+            break;
+    }
+    return keep;
+}
+
+bool traj_read_frame(FILE* f, TrajFrame* frame) {
+    TrajFrameHeader* h = &frame->header;
+    frame->pos_x = frame->pos_y = frame->vx = frame->vy = NULL;
+    if (fread(h, sizeof(*h), 1, f) != 1)
+        return false;
+    if (memcmp(h->magic, "NTZF", 4) != 0 || h->N < 0 ||
+        h->n_blocks != (uint32_t)((h->N + TRAJ_BLOCK - 1) / TRAJ_BLOCK)) {
+        fprintf(stderr, "Error: corrupt trajectory frame header.\n");
+        return false;
+    }
+
+    /* The size table must fit in the payload, and the payload in what is
+     * left of the file, before either is trusted with an allocation */
+    uint64_t table_bytes = (uint64_t)h->n_blocks * sizeof(uint32_t);
+    long here = ftell(f);
+    uint64_t left = UINT64_MAX;
+    if (here >= 0 && fseek(f, 0, SEEK_END) == 0) {
+        long end = ftell(f);
+        if (end >= here) left = (uint64_t)(end - here);
+        fseek(f, here, SEEK_SET);
+    }
+    if (h->payload_bytes < table_bytes || h->payload_bytes > left ||
+        h->payload_bytes > SIZE_MAX) {
+        fprintf(stderr, "Error: corrupt or truncated trajectory frame.\n");
+        return false;
+    }
+
+    unsigned char* payload = malloc(h->payload_bytes ? h->payload_bytes : 1);
+    size_t n = (size_t)h->N;
+    frame->pos_x = malloc(n * sizeof(double) + 1);
+    frame->pos_y = malloc(n * sizeof(double) + 1);
+    frame->vx    = malloc(n * sizeof(double) + 1);
+    frame->vy    = malloc(n * sizeof(double) + 1);
+    if (!payload || !frame->pos_x || !frame->pos_y || !frame->vx ||
+        !frame->vy) {
+        fprintf(stderr, "Error: Memory allocation failed for trajectory "
+                        "frame.\n");
+        exit(1);
+    }
+    if (fread(payload, 1, h->payload_bytes, f) != h->payload_bytes) {
+        fprintf(stderr, "Error: truncated trajectory frame.\n");
+        free(payload);
+        traj_free_frame(frame);
+        return false;
+    }
+
+    int n_blocks = (int)h->n_blocks;
+    const uint32_t* sizes = (const uint32_t*)payload;
+    uint64_t offset = table_bytes;
+    size_t* offsets = malloc((size_t)n_blocks * sizeof(size_t) + 1);
+    if (!offsets) {
+        fprintf(stderr, "Error: Memory allocation failed for trajectory "
+                        "frame.\n");
+        exit(1);
+    }
+    for (int b = 0; b < n_blocks; b++) {
+        offsets[b] = (size_t)offset;
+        offset += sizes[b];
+    }
+    bool ok = offset == h->payload_bytes;
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, 1) reduction(&& : ok)
+#endif
+    for (int b = 0; b < n_blocks; b++) {
+        int first = b * TRAJ_BLOCK;
+        int count = h->N - first < TRAJ_BLOCK ? h->N - first : TRAJ_BLOCK;
+        if (ok && !decode_block(payload + offsets[b], sizes[b], first, count,
+                                h, frame))
+            ok = false;
+    }
+
+    free(offsets);
+    free(payload);
+    if (!ok) {
+        fprintf(stderr, "Error: corrupt trajectory block.\n");
+        traj_free_frame(frame);
+    }
+    return ok;
+}
+
+void traj_free_frame(TrajFrame* frame) {
+    free(frame->pos_x);
+    free(frame->pos_y);
+    free(frame->vx);
+    free(frame->vy);
+    frame->pos_x = frame->pos_y = frame->vx = frame->vy = NULL;
+}
+
+/* ---------------------------------------------------------------- */
+
+static inline void bw_put(BitWriter* w, uint64_t v, int bits) {
+    /* bits <= 32, so acc never overflows with at most 7 pending bits */
+    w->acc |= v << w->n;
+    w->n += bits;
+    while (w->n >= 8) {
+        *w->p++ = (unsigned char)w->acc;
+        w->acc >>= 8;
+        w->n -= 8;
+    }
+}
+
+static inline void bw_flush(BitWriter* w) {
+    if (w->n > 0)
+        *w->p++ = (unsigned char)w->acc;
+    w->acc = 0;
+    w->n = 0;
+}
+
+static inline uint64_t br_get(BitReader* r, int bits) {
+    while (r->n < bits) {
+        uint64_t byte = r->p < r->end ? *r->p++ : 0;
+        r->acc |= byte << r->n;
+        r->n += 8;
+    }
+    uint64_t v = r->acc & ((1ULL << bits) - 1);  /* bits <= 32 */
+    r->acc >>= bits;
+    r->n -= bits;
+    return v;
+}
+
+static inline uint64_t zigzag(int64_t d) {
+    return ((uint64_t)d << 1) ^ (uint64_t)(d >> 63);
+}
+
+static inline int64_t unzigzag(uint64_t z) {
+    return (int64_t)(z >> 1) ^ -(int64_t)(z & 1);
+}
+
+static inline size_t rice_bits(uint64_t v, int k) {
+    uint64_t q = v >> k;
+    return q < RICE_ESCAPE ? (size_t)q + 1 + (size_t)k : RICE_ESCAPE + 64;
+}
+
+static inline void rice_put(BitWriter* w, uint64_t v, int k) {
+    uint64_t q = v >> k;
+    if (q >= RICE_ESCAPE) {
+        bw_put(w, (1ULL << RICE_ESCAPE) - 1, RICE_ESCAPE);
+        bw_put(w, v & 0xffffffffULL, 32);
+        bw_put(w, v >> 32, 32);
+        return;
+    }
+    bw_put(w, (1ULL << q) - 1, (int)q + 1);  /* q ones then a zero */
+    if (k > 32) {
+        bw_put(w, v & 0xffffffffULL, 32);
+        bw_put(w, (v >> 32) & ((1ULL << (k - 32)) - 1), k - 32);
+    } else if (k > 0) {
+        bw_put(w, v & ((1ULL << k) - 1), k);
+    }
+}
+
+static inline uint64_t rice_get(BitReader* r, int k) {
+    uint64_t q = 0;
+    while (q < RICE_ESCAPE && br_get(r, 1))
+        q++;
+    if (q == RICE_ESCAPE) {
+        uint64_t lo = br_get(r, 32);
+        return lo | (br_get(r, 32) << 32);
+    }
+    uint64_t low = 0;
+    if (k > 32) {
+        low = br_get(r, 32);
+        low |= br_get(r, k - 32) << 32;
+    } else if (k > 0) {
+        low = br_get(r, k);
+    }
+    return (q << k) | low;
+}
+
+/** Encode one block: for each field a Rice parameter, the stream length
+ * and the Rice-coded zigzag deltas of the quantized values.
+ * ----------------------------------------------------------------- */
+static size_t encode_block(const ParticleSystem* sys, int first, int count,
+                           const TrajFrameHeader* h, unsigned char* dst) {
+    const double* fields[TRAJ_FIELDS] = { sys->pos_x, sys->pos_y, sys->vx,
+                                          sys->vy };
+    uint64_t zz[TRAJ_BLOCK];
+    unsigned char* out = dst;
+
+    for (int f = 0; f < TRAJ_FIELDS; f++) {
+        const double* a = fields[f] + first;
+        double origin = h->origin[f];
+        double inv_q  = 1.0 / h->quantum[f];
+
+        /* 0 <= u <= 2^48 (QUANTUM_BITS), so zz < 2^50 and, over at most
+         * TRAJ_BLOCK = 2^12 values, sum < 2^62 */
+        int64_t prev = 0;
+        uint64_t sum = 0;
+        for (int i = 0; i < count; i++) {
+            int64_t u = (int64_t)llround((a[i] - origin) * inv_q);
+            zz[i] = zigzag(u - prev);
+            prev = u;
+            sum += zz[i];
+        }
+
+        /* Start near log2(mean) and keep the cheapest of three neighbours */
+        double mean = (double)sum / (count > 0 ? count : 1);
+        int k0 = mean >= 1.0 ? (int)log2(mean) : 0;
+        if (k0 > RICE_K_MAX) k0 = RICE_K_MAX;   /* noisy fine-grained data */
+        int k = k0;
+        size_t best = (size_t)-1;
+        for (int cand = k0 - 1; cand <= k0 + 1; cand++) {
+            if (cand < 0 || cand > RICE_K_MAX)
+                continue;
+            size_t bits = 0;
+            for (int i = 0; i < count; i++)
+                bits += rice_bits(zz[i], cand);
+            if (bits < best) {
+                best = bits;
+                k = cand;
+            }
+        }
+
+        BitWriter w = { out + FIELD_HEADER_BYTES, 0, 0 };
+        for (int i = 0; i < count; i++)
+            rice_put(&w, zz[i], k);
+        bw_flush(&w);
+
+        uint32_t len = (uint32_t)(w.p - (out + FIELD_HEADER_BYTES));
+        out[0] = (unsigned char)k;
+        memcpy(out + 1, &len, sizeof(len));
+        out = w.p;
+    }
+    return (size_t)(out - dst);
+}
+
+static bool decode_block(const unsigned char* src, size_t len, int first,
+                         int count, const TrajFrameHeader* h,
+                         TrajFrame* frame) {
+    double* fields[TRAJ_FIELDS] = { frame->pos_x, frame->pos_y, frame->vx,
+                                    frame->vy };
+    const unsigned char* p   = src;
+    const unsigned char* end = src + len;
+
+    for (int f = 0; f < TRAJ_FIELDS; f++) {
+        if (end - p < FIELD_HEADER_BYTES)
+            return false;
+        int k = p[0];
+        uint32_t stream_len;
+        memcpy(&stream_len, p + 1, sizeof(stream_len));
+        p += FIELD_HEADER_BYTES;
+        if (k > RICE_K_MAX || (size_t)(end - p) < stream_len)
+            return false;
+
+        BitReader r = { p, p + stream_len, 0, 0 };
+        double* a = fields[f] + first;
+        int64_t u = 0;
+        for (int i = 0; i < count; i++) {
+            u += unzigzag(rice_get(&r, k));
+            a[i] = h->origin[f] + (double)u * h->quantum[f];
+        }
+        p += stream_len;
+    }
+    return true;
+}
+
+/** Minimum of two arrays and the larger of their two ranges; false if
+ * a value is NaN or infinite, or the range overflows.
+ * ----------------------------------------------------------------- */
+static bool field_extent(const double* a, const double* b, int N,
+                         double* min_a, double* min_b, double* extent) {
+    double a_lo = INFINITY, a_hi = -INFINITY;
+    double b_lo = INFINITY, b_hi = -INFINITY;
+    int n_bad = 0;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) \
+    reduction(min : a_lo, b_lo) reduction(max : a_hi, b_hi) reduction(+ : n_bad)
+#endif
+    for (int i = 0; i < N; i++) {
+        n_bad += !isfinite(a[i]) || !isfinite(b[i]);
+        if (a[i] < a_lo) a_lo = a[i];
+        if (a[i] > a_hi) a_hi = a[i];
+        if (b[i] < b_lo) b_lo = b[i];
+        if (b[i] > b_hi) b_hi = b[i];
+    }
+    if (N == 0)
+        a_lo = a_hi = b_lo = b_hi = 0.0;
+    *min_a  = a_lo;
+    *min_b  = b_lo;
+    *extent = (a_hi - a_lo) > (b_hi - b_lo) ? (a_hi - a_lo) : (b_hi - b_lo);
+    return n_bad == 0 && isfinite(*extent);
+}
@@ -0,0 +1,68 @@
+#ifndef TRAJ_H
+#define TRAJ_H
+
+#include "types.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* Compressed trajectory (.ntz): an 8-byte file magic followed by frames.
+ * Each frame stores x, y, vx, vy quantized to a step derived from the
+ * frame's extent, delta-coded against the previous particle and
+ * Rice-coded in independent blocks of TRAJ_BLOCK particles. */
+#define TRAJ_FILE_MAGIC "NBTRAJ01"
+#define TRAJ_BLOCK      4096
+#define TRAJ_FIELDS     4
+
+typedef struct {
+    char     magic[4];               /* "NTZF" */
+    uint32_t n_blocks;
+    int32_t  step;
+    int32_t  N;
+    double   time;
+    double   origin[TRAJ_FIELDS];    /* per-field minimum */
+    double   quantum[TRAJ_FIELDS];   /* per-field quantization step */
+    uint64_t payload_bytes;          /* block size table + blocks */
+} TrajFrameHeader;
+
+typedef struct {
+    TrajFrameHeader header;
+    double* pos_x;
+    double* pos_y;
+    double* vx;
+    double* vy;
+} TrajFrame;
+
+typedef struct {
+    unsigned char* scratch;      /* worst-case space for every block */
+    size_t         scratch_cap;
+    uint32_t*      block_bytes;
+    size_t*        block_offset;
+    int            blocks_cap;
+    TrajFrameHeader header;
+} TrajEncoder;
+
+// Encode one frame; every value is within rel_error * field extent, or
+// 2^-49 of the extent when rel_error is finer than that.
+// Returns the encoded size, which traj_emit then copies out, or 0 if a
+// value is NaN or infinite; such a frame cannot be quantized.
+size_t traj_encode(TrajEncoder* enc, const ParticleSystem* sys, int step,
+                   double time, double rel_error);
+void   traj_emit(const TrajEncoder* enc, unsigned char* dst);
+void   traj_encoder_free(TrajEncoder* enc);
+
+// Consume and verify the file magic; call once before reading frames.
+bool traj_check_magic(FILE* f);
+
+// Length of the file up to the end of the last whole frame at or before
+// resume_time, reading headers from the current position, just after
+// the magic; a resumed run truncates the file there and appends.
+uint64_t traj_resume_bytes(FILE* f, double resume_time);
+
+// Read and decode the next frame into freshly allocated arrays (release
+// them with traj_free_frame); false at end of file or on error.
+bool traj_read_frame(FILE* f, TrajFrame* frame);
+void traj_free_frame(TrajFrame* frame);
+
+#endif
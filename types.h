@@ -1,6 +1,15 @@
 #ifndef TYPES_H
 #define TYPES_H
 
+#include <stdint.h>
+
+/* Persistent particle ids; configure with -DNBODY_ID64=ON for 64 bits */
+#ifdef NBODY_ID64
+typedef uint64_t ParticleId;
+#else
+typedef uint32_t ParticleId;
+#endif
+
 typedef struct {
     int N;
     double* pos_x;
@@ -10,6 +19,9 @@ typedef struct {
     double* vy;
     double* fx;
     double* fy;
+    double* brightness;  /* not used by the kernels, carried for output */
+    ParticleId* id;      /* persistent ids (ids.h), NULL = not kept */
+    int*    index_of;    /* current index of each id, NULL = not kept */
 } ParticleSystem;
 
 typedef struct {
@@ -17,6 +29,10 @@ typedef struct {
     int    n_threads;
     int    k_clusters;  /* 0 = use Morton ordering, >0 = use k-means clustering */
     double current_time;
+    double* potential;  /* per-particle potential to fill, NULL = forces only */
+    double tracer_mass; /* bodies this light only feel gravity, never source it */
+    double heavy_mass;  /* bodies heavier act by direct summation, 0 = none */
+    double outlier_radius; /* also those farther from the centre of mass */
 } KernelConfig;
 
 #endif